@@ -0,0 +1,416 @@
+#include "assets.h"
+#include "gl_common.h"
+#include "gl_state.h"
+#include "shader_utils.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+string asset_normalize_path(const string &path)
+{
+  bool absolute = !path.empty() && ('/' == path[0] || '\\' == path[0]);
+  vector<string> parts;
+  string part;
+  for (size_t i = 0; i <= path.size(); i++)
+  {
+    char c = (i < path.size()) ? path[i] : '/';
+    if (c != '/' && c != '\\')
+    {
+      part += c;
+      continue;
+    }
+    if (part.empty() || part == ".")
+      ;
+    else if (part == ".." && !parts.empty() && parts.back() != "..")
+      parts.pop_back();
+    // above the root is the root
+    else if (part != ".." || !absolute)
+      parts.push_back(part);
+    part.clear();
+  }
+
+  string normalized = absolute ? "/" : "";
+  for (size_t i = 0; i < parts.size(); i++)
+  {
+    if (i > 0)
+      normalized += '/';
+    normalized += parts[i];
+  }
+  return normalized;
+}
+
+void assets_init(AssetManager &manager, GpuResources* resources)
+{
+  manager.assets.clear();
+  manager.free_handles.clear();
+  manager.by_key.clear();
+  manager.resources = resources;
+  manager.hits = manager.misses = manager.waits = manager.evictions = 0;
+  manager.bytes_resident = 0;
+}
+
+// the asset's data, whatever other threads add meanwhile
+static Asset &asset_at(AssetManager &manager, AssetHandle handle)
+{
+  lock_guard<mutex> guard(manager.lock);
+  return manager.assets[handle];
+}
+
+// with the lock held; a failed asset's slot is free once nobody waits on it
+static void drop_reference(AssetManager &manager, AssetHandle handle)
+{
+  Asset &asset = manager.assets[handle];
+  asset.refs--;
+  if (0 == asset.refs && ASSET_FAILED == asset.state)
+  {
+    asset.state = ASSET_EMPTY;
+    manager.free_handles.push_back(handle);
+  }
+}
+
+// The asset called name, with a reference taken. When load comes back set,
+// the caller has to load it and call finish_load; other callers for the
+// same name wait until then. Returns -1 when the asset failed to load.
+static AssetHandle acquire(AssetManager &manager, AssetType type, const string &name, bool &load)
+{
+  uint64_t key = source_hash(name);
+  load = false;
+  unique_lock<mutex> guard(manager.lock);
+  unordered_map<uint64_t, AssetHandle>::iterator found = manager.by_key.find(key);
+  if (found != manager.by_key.end())
+  {
+    AssetHandle handle = found->second;
+    Asset &asset = manager.assets[handle];
+    if (asset.name != name)
+    {
+      cerr << "assets: " << name << " has the key of " << asset.name << endl;
+      return -1;
+    }
+    asset.refs++;
+    if (ASSET_LOADING == asset.state)
+    {
+      manager.waits++;
+      manager.loaded.wait(guard, [&asset] { return ASSET_LOADING != asset.state; });
+    }
+    if (ASSET_FAILED == asset.state)
+    {
+      drop_reference(manager, handle);
+      return -1;
+    }
+    manager.hits++;
+    return handle;
+  }
+
+  AssetHandle handle;
+  if (manager.free_handles.empty())
+  {
+    handle = manager.assets.size();
+    manager.assets.push_back(Asset());
+  }
+  else
+  {
+    handle = manager.free_handles.back();
+    manager.free_handles.pop_back();
+    manager.assets[handle] = Asset();
+  }
+  Asset &asset = manager.assets[handle];
+  asset.type = type;
+  asset.state = ASSET_LOADING;
+  asset.key = key;
+  asset.name = name;
+  asset.refs = 1;
+  asset.bytes = 0;
+  asset.shader = 0;
+  manager.by_key[key] = handle;
+  manager.misses++;
+  load = true;
+  return handle;
+}
+
+// publish the loader's result and wake the threads waiting for it
+static AssetHandle finish_load(AssetManager &manager, AssetHandle handle, bool ok)
+{
+  {
+    lock_guard<mutex> guard(manager.lock);
+    Asset &asset = manager.assets[handle];
+    if (ok)
+    {
+      asset.state = ASSET_READY;
+      manager.bytes_resident += asset.bytes;
+    }
+    else
+    {
+      // the next acquire tries again
+      asset.state = ASSET_FAILED;
+      manager.by_key.erase(asset.key);
+      drop_reference(manager, handle);
+    }
+  }
+  manager.loaded.notify_all();
+  return ok ? handle : -1;
+}
+
+AssetHandle assets_acquire_obj(AssetManager &manager, const string &path)
+{
+  string normalized = asset_normalize_path(path);
+  bool load;
+  AssetHandle handle = acquire(manager, ASSET_OBJ, normalized + "|obj", load);
+  if (!load) return handle;
+
+  Asset &asset = asset_at(manager, handle);
+  // load_obj exits when it cannot open the file
+  bool ok = ifstream(normalized.c_str()).good();
+  if (!ok)
+    cerr << "assets: cannot open " << normalized << endl;
+  else
+  {
+    load_obj(normalized, asset.vertices, asset.normals, asset.elements);
+    ok = !asset.vertices.empty() && !asset.elements.empty();
+    if (!ok)
+      cerr << "assets: no geometry in " << normalized << endl;
+  }
+  asset.bytes = asset.vertices.size() * sizeof(glm::vec4) + asset.normals.size() * sizeof(glm::vec3)
+    + asset.elements.size() * sizeof(GLushort);
+  return finish_load(manager, handle, ok);
+}
+
+// what the mesh's vertex and index buffers hold
+static size_t mesh_bytes(const Mesh &mesh)
+{
+  GLint size = 0;
+  size_t bytes = 0;
+  for (int i = 0; i <= mesh.stream_count; i++)
+  {
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, i < mesh.stream_count ? mesh.vbo[i] : mesh.ibo);
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+    bytes += size;
+  }
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+  return bytes;
+}
+
+AssetHandle assets_acquire_mesh(AssetManager &manager, const string &path,
+  GLuint coord_location, GLuint normal_location)
+{
+  char options[32];
+  snprintf(options, sizeof(options), "|mesh %u %u", coord_location, normal_location);
+  bool load;
+  AssetHandle handle = acquire(manager, ASSET_MESH, asset_normalize_path(path) + options, load);
+  if (!load) return handle;
+
+  // the OBJ stays loaded with the mesh until it is evicted too
+  AssetHandle obj = assets_acquire_obj(manager, path);
+  bool ok = obj >= 0;
+  Asset &asset = asset_at(manager, handle);
+  if (ok)
+  {
+    const Asset &geometry = assets_get(manager, obj);
+    ok = mesh_create_obj(asset.mesh, geometry.vertices, geometry.normals, geometry.elements,
+      coord_location, normal_location);
+    if (ok)
+      asset.bytes = mesh_bytes(asset.mesh);
+    assets_release(manager, obj);
+  }
+  return finish_load(manager, handle, ok);
+}
+
+AssetHandle assets_acquire_shader(AssetManager &manager, const string &filename, GLenum type,
+  int glsl_version, const string &defines)
+{
+  char options[32];
+  snprintf(options, sizeof(options), "|shader %x %d|", type, glsl_version);
+  bool load;
+  AssetHandle handle = acquire(manager, ASSET_SHADER, asset_normalize_path(filename) + options + defines, load);
+  if (!load) return handle;
+
+  Asset &asset = asset_at(manager, handle);
+  asset.shader = create_shader(filename, type, glsl_version, defines);
+  if (asset.shader)
+  {
+    GLint length = 0;
+    glGetShaderiv(asset.shader, GL_SHADER_SOURCE_LENGTH, &length);
+    asset.bytes = length;
+  }
+  return finish_load(manager, handle, 0 != asset.shader);
+}
+
+void assets_retain(AssetManager &manager, AssetHandle handle)
+{
+  lock_guard<mutex> guard(manager.lock);
+  manager.assets[handle].refs++;
+}
+
+void assets_release(AssetManager &manager, AssetHandle handle)
+{
+  lock_guard<mutex> guard(manager.lock);
+  if (handle < 0 || handle >= (int)manager.assets.size() || manager.assets[handle].refs <= 0)
+  {
+    cerr << "assets_release: no reference to asset " << handle << endl;
+    return;
+  }
+  // stays loaded, for the next acquire or assets_evict_unused
+  manager.assets[handle].refs--;
+}
+
+const Asset &assets_get(AssetManager &manager, AssetHandle handle)
+{
+  return asset_at(manager, handle);
+}
+
+// with the lock held
+static void unload(AssetManager &manager, Asset &asset)
+{
+  GpuResources* resources = manager.resources;
+  switch (asset.type)
+  {
+  case ASSET_OBJ:
+    vector<glm::vec4>().swap(asset.vertices);
+    vector<glm::vec3>().swap(asset.normals);
+    vector<GLushort>().swap(asset.elements);
+    break;
+  case ASSET_MESH:
+    mesh_free(asset.mesh, resources);
+    break;
+  case ASSET_SHADER:
+    gpu_delete(resources, GPU_SHADER, asset.shader);
+    asset.shader = 0;
+    break;
+  }
+  manager.bytes_resident -= asset.bytes;
+  asset.bytes = 0;
+}
+
+size_t assets_evict_unused(AssetManager &manager)
+{
+  lock_guard<mutex> guard(manager.lock);
+  size_t freed = 0;
+  for (size_t handle = 0; handle < manager.assets.size(); handle++)
+  {
+    Asset &asset = manager.assets[handle];
+    if (ASSET_READY != asset.state || asset.refs > 0) continue;
+    freed += asset.bytes;
+    unload(manager, asset);
+    manager.by_key.erase(asset.key);
+    asset.state = ASSET_EMPTY;
+    manager.free_handles.push_back(handle);
+    manager.evictions++;
+  }
+  return freed;
+}
+
+void assets_free(AssetManager &manager)
+{
+  lock_guard<mutex> guard(manager.lock);
+  for (size_t handle = 0; handle < manager.assets.size(); handle++)
+    if (ASSET_READY == manager.assets[handle].state)
+      unload(manager, manager.assets[handle]);
+  manager.assets.clear();
+  manager.free_handles.clear();
+  manager.by_key.clear();
+  manager.bytes_resident = 0;
+}
+
+void assets_print_stats(AssetManager &manager)
+{
+  lock_guard<mutex> guard(manager.lock);
+  int loaded = 0, unreferenced = 0;
+  for (size_t handle = 0; handle < manager.assets.size(); handle++)
+  {
+    if (ASSET_READY != manager.assets[handle].state) continue;
+    loaded++;
+    if (0 == manager.assets[handle].refs)
+      unreferenced++;
+  }
+  printf("assets: %d loaded, %d unreferenced, %.1f KB resident, %ld hits, %ld misses, %ld waits, %ld evicted\n",
+    loaded, unreferenced, manager.bytes_resident / 1024.0, manager.hits, manager.misses, manager.waits,
+    manager.evictions);
+}
+
+// ----- BENCHMARK -----
+
+void assets_benchmark(int count)
+{
+  const string OBJ = "suzanne.obj";
+  GpuResources resources;
+  gpu_resources_init(resources);
+  AssetManager manager;
+  assets_init(manager, &resources);
+  printf("%d loads of %s and the cube shaders, %d threads\n", count, OBJ.c_str(), parallel_threads());
+
+  // every thread asks for the OBJ at once
+  Clock::time_point start = Clock::now();
+  parallel_for(count, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; i++)
+    {
+      vector<glm::vec4> vertices;
+      vector<glm::vec3> normals;
+      vector<GLushort> elements;
+      load_obj(OBJ, vertices, normals, elements);
+    }
+  });
+  double direct_seconds = seconds_since(start);
+  vector<AssetHandle> objs(count);
+  start = Clock::now();
+  parallel_for(count, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; i++)
+      objs[i] = assets_acquire_obj(manager, OBJ);
+  });
+  printf("  %-8s %10.3f ms directly %10.3f ms through the manager\n", "parse", direct_seconds * 1000.0,
+    seconds_since(start) * 1000.0);
+
+  // the GL objects, on this thread
+  start = Clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    vector<glm::vec4> vertices;
+    vector<glm::vec3> normals;
+    vector<GLushort> elements;
+    load_obj(OBJ, vertices, normals, elements);
+    Mesh mesh;
+    mesh_create_obj(mesh, vertices, normals, elements, 0, 1);
+    GLuint vs = create_shader("cube.v.glsl", GL_VERTEX_SHADER);
+    GLuint fs = create_shader("cube.f.glsl", GL_FRAGMENT_SHADER);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    mesh_free(mesh);
+  }
+  glFinish();
+  direct_seconds = seconds_since(start);
+  vector<AssetHandle> handles;
+  start = Clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    // the same files by other names
+    handles.push_back(assets_acquire_mesh(manager, (i % 2) ? OBJ : "./" + OBJ, 0, 1));
+    handles.push_back(assets_acquire_shader(manager, "cube.v.glsl", GL_VERTEX_SHADER));
+    handles.push_back(assets_acquire_shader(manager, "cube.f.glsl", GL_FRAGMENT_SHADER));
+  }
+  glFinish();
+  printf("  %-8s %10.3f ms directly %10.3f ms through the manager\n", "upload", direct_seconds * 1000.0,
+    seconds_since(start) * 1000.0);
+  assets_print_stats(manager);
+
+  for (int i = 0; i < count; i++)
+    if (objs[i] >= 0)
+      assets_release(manager, objs[i]);
+  for (size_t i = 0; i < handles.size(); i++)
+    if (handles[i] >= 0)
+      assets_release(manager, handles[i]);
+  size_t freed = assets_evict_unused(manager);
+  printf("  all released, %.1f KB evicted\n", freed / 1024.0);
+  assets_print_stats(manager);
+  assets_free(manager);
+  gpu_resources_free(resources);
+}
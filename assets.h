@@ -0,0 +1,98 @@
+#ifndef _ASSETS_H
+#define _ASSETS_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "gpu_resources.h"
+
+enum AssetType
+{
+  ASSET_OBJ,     // load_obj output, CPU only
+  ASSET_MESH,    // an OBJ uploaded with mesh_create_obj
+  ASSET_SHADER,  // a create_shader object
+};
+
+enum AssetState { ASSET_EMPTY, ASSET_LOADING, ASSET_READY, ASSET_FAILED };  // EMPTY: a free slot
+
+struct Asset
+{
+  AssetType type;
+  AssetState state;
+  uint64_t key;
+  std::string name;  // normalized path and import options, the key's text
+  int refs;
+  size_t bytes;      // in memory for OBJs, uploaded for GL assets
+
+  std::vector<glm::vec4> vertices;  // ASSET_OBJ
+  std::vector<glm::vec3> normals;
+  std::vector<GLushort> elements;
+  Mesh mesh;                        // ASSET_MESH
+  GLuint shader;                    // ASSET_SHADER
+};
+
+// an index into the manager's assets, -1 for none
+typedef int AssetHandle;
+
+// Loaded assets by the hash of their path and import options, so loading
+// the same file the same way twice hands out the same asset. Each handle
+// is a reference; an asset nobody references stays loaded until
+// assets_evict_unused. The manager can be used from any thread, and a
+// thread asking for an asset another one is loading waits for that load.
+// GL assets must still be acquired and evicted on the GL thread.
+struct AssetManager
+{
+  std::mutex lock;
+  std::condition_variable loaded;
+  std::deque<Asset> assets;    // references stay valid as it grows
+  std::vector<AssetHandle> free_handles;
+  std::unordered_map<uint64_t, AssetHandle> by_key;
+  GpuResources* resources;     // evicted GL objects go through its queue, NULL to delete them right away
+
+  long hits, misses, waits, evictions;
+  size_t bytes_resident;
+};
+
+// "./a//b/../c" is "a/c"; backslashes count as slashes
+std::string asset_normalize_path(const std::string &path);
+
+void assets_init(AssetManager &manager, GpuResources* resources);
+// drops every asset, referenced or not
+void assets_free(AssetManager &manager);
+
+// the assets, -1 with a displayed error when they do not load
+AssetHandle assets_acquire_obj(AssetManager &manager, const std::string &path);
+// positions at coord_location and normals at normal_location
+AssetHandle assets_acquire_mesh(AssetManager &manager, const std::string &path,
+  GLuint coord_location, GLuint normal_location);
+AssetHandle assets_acquire_shader(AssetManager &manager, const std::string &filename, GLenum type,
+  int glsl_version = 120, const std::string &defines = "");
+// one more reference to an acquired asset
+void assets_retain(AssetManager &manager, AssetHandle handle);
+void assets_release(AssetManager &manager, AssetHandle handle);
+
+// the loaded asset, valid while a reference is held
+const Asset &assets_get(AssetManager &manager, AssetHandle handle);
+
+// unload the assets nobody references, returns the bytes freed
+size_t assets_evict_unused(AssetManager &manager);
+
+void assets_print_stats(AssetManager &manager);
+
+// Load suzanne.obj on every thread at once, then its mesh and the cube
+// shaders count times, each directly and through the manager, printing
+// the times, the loads made and the bytes evicted afterwards.
+void assets_benchmark(int count);
+
+#endif
@@ -0,0 +1,310 @@
+#include "batch.h"
+#include "gl_common.h"
+#include "shader_utils.h"
+#include "program_info.h"
+#include "profiler.h"
+#include "gl_state.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <chrono>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+enum { BATCH_COORD3D, BATCH_TEXCOORD };
+// SSBO binding of the per-draw model matrices, as declared in batch.v.glsl
+enum { BATCH_TRANSFORM_BINDING = 0 };
+
+int batch_supported()
+{
+  return GLEW_VERSION_3_2 ? 1 : 0;
+}
+
+int batch_multi_draw_supported()
+{
+  return (GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters) ? 1 : 0;
+}
+
+int batch_init(Batch &batch, bool multi_draw, int max_draws)
+{
+  batch.multi_draw = multi_draw;
+  batch.max_draws = max_draws;
+  batch.vao = batch.vbo = batch.ibo = 0;
+  batch.draw_count = batch.draw_calls = 0;
+
+  int glsl_version = multi_draw ? 430 : 120;
+  GLuint vs = create_shader("batch.v.glsl", GL_VERTEX_SHADER, glsl_version);
+  if (0 == vs) return 0;
+  GLuint fs = create_shader("cube.f.glsl", GL_FRAGMENT_SHADER, glsl_version);
+  if (0 == fs) return 0;
+
+  const char* const attribute_names[] = { "coord3d", "texcoord" };
+  batch.program = glCreateProgram();
+  glAttachShader(batch.program, vs);
+  glAttachShader(batch.program, fs);
+  program_bind_attributes(batch.program, attribute_names, 2);
+  glLinkProgram(batch.program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+
+  ProgramInfo info;
+  if (!program_reflect(batch.program, info))
+  {
+    cerr << "glLinkProgram:";
+    print_log(batch.program);
+    return 0;
+  }
+  const ProgramVarName expected[] = {
+    { "view_projection", VAR_UNIFORM },
+    { "mytexture", VAR_UNIFORM },
+    { "model", VAR_UNIFORM },
+  };
+  GLint locations[3];
+  // the multi-draw path reads its model matrices from the SSBO instead
+  if (!program_require(info, expected, multi_draw ? 2 : 3, locations)) return 0;
+  batch.uniform_view_projection = locations[0];
+  batch.uniform_mytexture = locations[1];
+  batch.uniform_model = multi_draw ? -1 : locations[2];
+
+  if (multi_draw)
+  {
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &batch.transforms_alignment);
+    GLsizeiptr region_size = max_draws * (sizeof(glm::mat4) + sizeof(DrawElementsIndirectCommand))
+      + batch.transforms_alignment;
+    if (!stream_buffer_create(batch.stream, region_size)) return 0;
+  }
+  else
+  {
+    batch.cpu_commands.resize(max_draws);
+    batch.cpu_transforms.resize(max_draws);
+    batch.commands = &batch.cpu_commands[0];
+    batch.transforms = &batch.cpu_transforms[0];
+  }
+  return 1;
+}
+
+void batch_free(Batch &batch)
+{
+  glDeleteVertexArrays(1, &batch.vao);
+  glDeleteBuffers(1, &batch.vbo);
+  glDeleteBuffers(1, &batch.ibo);
+  if (batch.multi_draw)
+    stream_buffer_free(batch.stream);
+  glDeleteProgram(batch.program);
+  gl_state_invalidate();
+  batch.meshes.clear();
+  batch.cpu_commands.clear();
+  batch.cpu_transforms.clear();
+  batch.draw_count = 0;
+}
+
+int batch_add_mesh(Batch &batch, const vector<Vertex> &vertices, const vector<GLushort> &elements)
+{
+  // indices stay relative to the mesh, base_vertex moves them at draw time
+  BatchMesh mesh;
+  mesh.first_index = batch.elements.size();
+  mesh.base_vertex = batch.vertices.size();
+  mesh.index_count = elements.size();
+  batch.vertices.insert(batch.vertices.end(), vertices.begin(), vertices.end());
+  batch.elements.insert(batch.elements.end(), elements.begin(), elements.end());
+  batch.meshes.push_back(mesh);
+  return batch.meshes.size() - 1;
+}
+
+void batch_upload(Batch &batch)
+{
+  glGenVertexArrays(1, &batch.vao);
+  gl_state_bind_vertex_array(batch.vao);
+
+  glGenBuffers(1, &batch.vbo);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, batch.vbo);
+  glBufferData(GL_ARRAY_BUFFER, batch.vertices.size() * sizeof(Vertex), &batch.vertices[0], GL_STATIC_DRAW);
+  glEnableVertexAttribArray(BATCH_COORD3D);
+  glVertexAttribPointer(BATCH_COORD3D, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    (const GLvoid*)offsetof(Vertex, position));
+  glEnableVertexAttribArray(BATCH_TEXCOORD);
+  glVertexAttribPointer(BATCH_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    (const GLvoid*)offsetof(Vertex, texcoord));
+
+  glGenBuffers(1, &batch.ibo);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch.ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, batch.elements.size() * sizeof(GLushort), &batch.elements[0], GL_STATIC_DRAW);
+
+  gl_state_bind_vertex_array(0);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  batch.vertices.clear();
+  batch.elements.clear();
+}
+
+void batch_begin(Batch &batch)
+{
+  batch.draw_count = 0;
+  if (!batch.multi_draw) return;
+
+  // both arrays are sized for max_draws, which batch_init made room for
+  stream_buffer_begin_frame(batch.stream);
+  batch.transforms = (glm::mat4*)stream_buffer_alloc(batch.stream, batch.max_draws * sizeof(glm::mat4),
+    batch.transforms_alignment, batch.transforms_offset);
+  batch.commands = (DrawElementsIndirectCommand*)stream_buffer_alloc(batch.stream,
+    batch.max_draws * sizeof(DrawElementsIndirectCommand), sizeof(GLuint), batch.commands_offset);
+}
+
+int batch_draw(Batch &batch, int mesh, const glm::mat4 &model)
+{
+  int draw = batch_reserve(batch, 1);
+  if (draw < 0)
+    return 0;
+  batch_write(batch, draw, mesh, model);
+  return 1;
+}
+
+int batch_reserve(Batch &batch, int count)
+{
+  if (batch.draw_count + count > batch.max_draws)
+    return -1;
+  int first = batch.draw_count;
+  batch.draw_count += count;
+  return first;
+}
+
+void batch_write(Batch &batch, int draw, int mesh, const glm::mat4 &model)
+{
+  const BatchMesh &m = batch.meshes[mesh];
+  DrawElementsIndirectCommand &command = batch.commands[draw];
+  command.count = m.index_count;
+  command.instance_count = 1;
+  command.first_index = m.first_index;
+  command.base_vertex = m.base_vertex;
+  command.base_instance = 0;
+  batch.transforms[draw] = model;
+}
+
+void batch_submit(Batch &batch, const glm::mat4 &view_projection, GLuint texture_id)
+{
+  PROFILE_SCOPE("batch submit");
+  batch.draw_calls = 0;
+  if (0 == batch.draw_count) return;
+
+  gl_state_use_program(batch.program);
+  gl_state_uniform_matrix_4fv(batch.uniform_view_projection, glm::value_ptr(view_projection));
+  gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture_id);
+  gl_state_uniform_1i(batch.uniform_mytexture, 0);
+  gl_state_bind_vertex_array(batch.vao);
+
+  if (batch.multi_draw)
+  {
+    stream_buffer_flush(batch.stream);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BATCH_TRANSFORM_BINDING, batch.stream.buffer,
+      batch.transforms_offset, batch.draw_count * sizeof(glm::mat4));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.stream.buffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+      (const GLvoid*)batch.commands_offset, batch.draw_count, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    stream_buffer_end_frame(batch.stream);
+    batch.draw_calls = 1;
+  }
+  else
+  {
+    for (int i = 0; i < batch.draw_count; i++)
+    {
+      const DrawElementsIndirectCommand &command = batch.commands[i];
+      gl_state_uniform_matrix_4fv(batch.uniform_model, glm::value_ptr(batch.transforms[i]));
+      glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_SHORT,
+        (const GLvoid*)(command.first_index * sizeof(GLushort)), command.base_vertex);
+    }
+    batch.draw_calls = batch.draw_count;
+  }
+  gl_state_bind_vertex_array(0);
+}
+
+// ----- BENCHMARK -----
+
+// time FRAMES frames of the scene through one batch, returns CPU ms per frame
+static double run_scene(Batch &batch, int objects, const int mesh_ids[2], GLuint texture_id)
+{
+  const int FRAMES = 60;
+  int side = (int)ceil(sqrt((double)objects));
+  float extent = 3.0f * side;
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0, extent, extent), glm::vec3(0.0, 0.0, 0.0),
+    glm::vec3(0.0, 1.0, 0.0));
+  glm::mat4 projection = glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 4.0f * extent);
+
+  double seconds = 0.0;
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    gl_state_clear_color(1.0, 1.0, 1.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+
+    Clock::time_point start = Clock::now();
+    batch_begin(batch);
+    for (int n = 0; n < objects; n++)
+    {
+      glm::vec3 position(3.0f * (n % side - side / 2), 0.0f, 3.0f * (n / side - side / 2));
+      glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+      // alternate the meshes, so consecutive draws are never the same one
+      batch_draw(batch, mesh_ids[n % 2], glm::rotate(model, frame * 0.05f + n, glm::vec3(0.0, 1.0, 0.0)));
+    }
+    batch_submit(batch, projection * view, texture_id);
+    seconds += seconds_since(start);
+  }
+  glFinish();
+  return seconds * 1000.0 / FRAMES;
+}
+
+void batch_benchmark(int objects, GLuint texture_id, AssetManager &assets)
+{
+  if (!batch_supported())
+  {
+    cerr << "Error: batching needs OpenGL 3.2" << endl;
+    return;
+  }
+
+  vector<Vertex> cube_vertices, suzanne_vertices;
+  vector<GLushort> cube_elements;
+  cube_geometry(cube_vertices, cube_elements);
+
+  AssetHandle suzanne = assets_acquire_obj(assets, "suzanne.obj");
+  if (suzanne < 0) return;
+  obj_geometry(assets_get(assets, suzanne).vertices, suzanne_vertices);
+  vector<GLushort> suzanne_elements = assets_get(assets, suzanne).elements;
+  assets_release(assets, suzanne);
+
+  gl_state_enable(GL_DEPTH_TEST, true);
+  printf("%d objects\n", objects);
+  for (int multi_draw = 0; multi_draw < 2; multi_draw++)
+  {
+    const char* name = multi_draw ? "multi-draw indirect" : "draw loop";
+    if (multi_draw && !batch_multi_draw_supported())
+    {
+      printf("  %-20s not supported by this context\n", name);
+      continue;
+    }
+
+    Batch batch;
+    if (!batch_init(batch, multi_draw, objects)) return;
+    int mesh_ids[2];
+    mesh_ids[0] = batch_add_mesh(batch, cube_vertices, cube_elements);
+    mesh_ids[1] = batch_add_mesh(batch, suzanne_vertices, suzanne_elements);
+    batch_upload(batch);
+
+    double ms = run_scene(batch, objects, mesh_ids, texture_id);
+    printf("  %-20s %8d draw calls/frame %10.3f ms CPU/frame\n", name, batch.draw_calls, ms);
+    if (multi_draw)
+      stream_buffer_print_stats(batch.stream, "  stream buffer");
+    batch_free(batch);
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "stream_buffer.h"
+#include "assets.h"
+
+// the record glMultiDrawElementsIndirect reads for every draw
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "indirect commands are 5 packed 32-bit values");
+
+// where a mesh lives in the batch's shared buffers
+struct BatchMesh
+{
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint index_count;
+};
+
+// Many meshes packed into one vertex and one index buffer. Each frame the
+// draws are recorded as indirect commands plus a model matrix per draw, and
+// submitted with a single glMultiDrawElementsIndirect; the shader picks its
+// matrix from an SSBO with gl_DrawIDARB. Both are written straight into a
+// persistently mapped stream buffer. Older contexts loop over the commands
+// with glDrawElementsBaseVertex and a model uniform instead.
+struct Batch
+{
+  bool multi_draw;
+  int max_draws;
+  GLuint vao, vbo, ibo;
+  std::vector<Vertex> vertices;   // cleared by batch_upload
+  std::vector<GLushort> elements;
+  std::vector<BatchMesh> meshes;
+
+  // this frame's draws, in the stream buffer or in the CPU vectors below
+  DrawElementsIndirectCommand* commands;
+  glm::mat4* transforms;
+  int draw_count;
+  StreamBuffer stream;
+  GLintptr commands_offset, transforms_offset;
+  GLint transforms_alignment;
+  std::vector<DrawElementsIndirectCommand> cpu_commands;
+  std::vector<glm::mat4> cpu_transforms;
+
+  GLuint program;
+  GLint uniform_view_projection, uniform_model, uniform_mytexture;
+  int draw_calls;  // GL draw calls made by the last batch_submit
+};
+
+// base vertex draws need GL 3.2
+int batch_supported();
+// GL 4.3 plus ARB_shader_draw_parameters for gl_DrawIDARB
+int batch_multi_draw_supported();
+
+// returns 1 when all is ok, 0 with a displayed error
+int batch_init(Batch &batch, bool multi_draw, int max_draws);
+void batch_free(Batch &batch);
+
+// append a mesh to the shared buffers, returns its id for batch_draw
+int batch_add_mesh(Batch &batch, const std::vector<Vertex> &vertices, const std::vector<GLushort> &elements);
+// create the GL buffers once every mesh has been added
+void batch_upload(Batch &batch);
+
+void batch_begin(Batch &batch);
+// returns 0 when max_draws draws were already recorded this frame
+int batch_draw(Batch &batch, int mesh, const glm::mat4 &model);
+// Reserve count draws and return the first one, or -1 when they don't fit.
+// Different threads may batch_write different reserved draws at once.
+int batch_reserve(Batch &batch, int count);
+void batch_write(Batch &batch, int draw, int mesh, const glm::mat4 &model);
+void batch_submit(Batch &batch, const glm::mat4 &view_projection, GLuint texture_id);
+
+// Draw the same scene of cubes and suzannes through the draw loop and
+// through glMultiDrawElementsIndirect, printing calls and CPU time per frame.
+void batch_benchmark(int objects, GLuint texture_id, AssetManager &assets);
+
+#endif
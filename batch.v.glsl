@@ -0,0 +1,25 @@
+#ifdef HAVE_SSBO
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+attribute vec3 coord3d;
+attribute vec2 texcoord;
+varying vec2 f_texcoord;
+uniform mat4 view_projection;
+#ifdef HAVE_SSBO
+// one model matrix per draw of the glMultiDrawElementsIndirect call
+layout(std430, binding = 0) readonly buffer DrawTransforms
+{
+  mat4 draw_models[];
+};
+#define MODEL draw_models[gl_DrawIDARB]
+#else
+// older contexts issue a draw per object and set this in between
+uniform mat4 model;
+#define MODEL model
+#endif
+
+void main(void)
+{
+  gl_Position = view_projection * MODEL * vec4(coord3d, 1.0);
+  f_texcoord = texcoord;
+}
@@ -0,0 +1,559 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "shader_utils.h"
+#include "program_info.h"
+#include "uniform_buffer.h"
+#include "render_backend.h"
+#include "gl_state.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The file is the header, then chunks of a type, a payload size and the
+// payload; every integer is 32 bits in the capturing machine's byte order.
+static const char CAPTURE_MAGIC[8] = "CUBECAP";
+static const int32_t CAPTURE_VERSION = 1;
+
+enum
+{
+  CHUNK_TEXTURE,
+  CHUNK_MESH,
+  CHUNK_PROGRAM,
+  CHUNK_UNIFORM_BUFFERS,
+  CHUNK_FRAME,
+};
+
+// ----- WRITING -----
+
+static void put(vector<uint8_t> &out, const void* data, size_t size)
+{
+  size_t at = out.size();
+  out.resize(at + size);
+  if (size > 0)
+    memcpy(&out[at], data, size);
+}
+
+static void put_int(vector<uint8_t> &out, int32_t value)
+{
+  put(out, &value, sizeof(value));
+}
+
+static void put_string(vector<uint8_t> &out, const string &s)
+{
+  put_int(out, s.size());
+  put(out, s.data(), s.size());
+}
+
+static void write_chunk(Capture &capture, int32_t type, const vector<uint8_t> &payload)
+{
+  int32_t size = payload.size();
+  capture.out.write((const char*)&type, sizeof(type));
+  capture.out.write((const char*)&size, sizeof(size));
+  if (size > 0)
+    capture.out.write((const char*)&payload[0], size);
+}
+
+int capture_open(Capture &capture, const string &filename, int width, int height)
+{
+  capture.out.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!capture.out)
+  {
+    cerr << "capture_open: cannot write " << filename << endl;
+    return 0;
+  }
+  capture.frames = 0;
+  vector<uint8_t> header;
+  put(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+  put_int(header, CAPTURE_VERSION);
+  put_int(header, width);
+  put_int(header, height);
+  capture.out.write((const char*)&header[0], header.size());
+  return 1;
+}
+
+int capture_close(Capture &capture)
+{
+  capture.out.close();
+  if (capture.out.fail())
+  {
+    cerr << "capture_close: the capture could not be written" << endl;
+    return 0;
+  }
+  return 1;
+}
+
+void capture_texture(Capture &capture, GLuint texture_id)
+{
+  GLint width = 0, height = 0, internal_format = GL_RGBA, min_filter = GL_LINEAR, mag_filter = GL_LINEAR;
+  gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture_id);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &min_filter);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &mag_filter);
+  // read back as RGBA, whatever the format, rows are then always 4-byte aligned
+  vector<uint8_t> pixels(4 * width * height);
+  if (!pixels.empty())
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+  vector<uint8_t> payload;
+  put_int(payload, texture_id);
+  put_int(payload, width);
+  put_int(payload, height);
+  put_int(payload, internal_format);
+  put_int(payload, min_filter);
+  put_int(payload, mag_filter);
+  put(payload, pixels.empty() ? NULL : &pixels[0], pixels.size());
+  write_chunk(capture, CHUNK_TEXTURE, payload);
+}
+
+// a whole buffer's contents
+static void read_buffer(GLenum target, GLuint buffer, vector<uint8_t> &data)
+{
+  GLint size = 0;
+  gl_state_bind_buffer(target, buffer);
+  glGetBufferParameteriv(target, GL_BUFFER_SIZE, &size);
+  data.resize(size);
+  if (size > 0)
+    glGetBufferSubData(target, 0, size, &data[0]);
+}
+
+void capture_mesh(Capture &capture, const Mesh &mesh)
+{
+  // the element buffer binding belongs to whichever VAO is bound
+  if (mesh.vao)
+    gl_state_bind_vertex_array(0);
+
+  vector<uint8_t> payload, data;
+  put_int(payload, mesh.stream_count);
+  for (int i = 0; i < mesh.stream_count; i++)
+  {
+    read_buffer(GL_ARRAY_BUFFER, mesh.vbo[i], data);
+    put_int(payload, mesh.location[i]);
+    put_int(payload, mesh.components[i]);
+    put_int(payload, data.size());
+    put(payload, data.empty() ? NULL : &data[0], data.size());
+  }
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+
+  read_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo, data);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  data.resize(mesh.index_count * sizeof(GLushort));
+  put_int(payload, mesh.index_count);
+  put(payload, data.empty() ? NULL : &data[0], data.size());
+  write_chunk(capture, CHUNK_MESH, payload);
+}
+
+void capture_pool_mesh(Capture &capture, const GeometryPool &pool, int id,
+  GLuint coord_location, GLuint texcoord_location)
+{
+  const GeometryRange &range = pool.meshes[id];
+  vector<Vertex> vertices(range.vertex_count);
+  vector<GLushort> elements(range.index_count);
+  // through the copy target, the pool's VAO keeps its element buffer
+  glBindBuffer(GL_COPY_READ_BUFFER, pool.vbo);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, range.first_vertex * sizeof(Vertex),
+    vertices.size() * sizeof(Vertex), &vertices[0]);
+  glBindBuffer(GL_COPY_READ_BUFFER, pool.ibo);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, range.first_index * sizeof(GLushort),
+    elements.size() * sizeof(GLushort), &elements[0]);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  vector<GLfloat> positions, texcoords;
+  for (size_t i = 0; i < vertices.size(); i++)
+  {
+    positions.insert(positions.end(), &vertices[i].position.x, &vertices[i].position.x + 3);
+    texcoords.insert(texcoords.end(), &vertices[i].texcoord.x, &vertices[i].texcoord.x + 2);
+  }
+
+  vector<uint8_t> payload;
+  put_int(payload, 2);
+  put_int(payload, coord_location);
+  put_int(payload, 3);
+  put_int(payload, positions.size() * sizeof(GLfloat));
+  put(payload, &positions[0], positions.size() * sizeof(GLfloat));
+  put_int(payload, texcoord_location);
+  put_int(payload, 2);
+  put_int(payload, texcoords.size() * sizeof(GLfloat));
+  put(payload, &texcoords[0], texcoords.size() * sizeof(GLfloat));
+  put_int(payload, elements.size());
+  put(payload, &elements[0], elements.size() * sizeof(GLushort));
+  write_chunk(capture, CHUNK_MESH, payload);
+}
+
+void capture_program(Capture &capture, GLuint program, const string &vs_source, const string &fs_source,
+  int glsl_version, const char* const attributes[], int attribute_count)
+{
+  ProgramInfo info;
+  program_reflect(program, info);
+
+  vector<uint8_t> payload;
+  put_int(payload, program);
+  put_int(payload, glsl_version);
+  put_string(payload, vs_source);
+  put_string(payload, fs_source);
+  put_int(payload, attribute_count);
+  for (int i = 0; i < attribute_count; i++)
+    put_string(payload, attributes[i]);
+
+  // the uniform locations the frames use, and whether the blocks need binding
+  int uniforms = 0, blocks = 0;
+  for (size_t i = 0; i < info.vars.size(); i++)
+  {
+    uniforms += VAR_UNIFORM == info.vars[i].kind;
+    blocks += VAR_BLOCK == info.vars[i].kind;
+  }
+  put_int(payload, blocks);
+  put_int(payload, uniforms);
+  for (size_t i = 0; i < info.vars.size(); i++)
+    if (VAR_UNIFORM == info.vars[i].kind)
+    {
+      put_string(payload, info.vars[i].name);
+      put_int(payload, info.vars[i].location);
+    }
+  write_chunk(capture, CHUNK_PROGRAM, payload);
+}
+
+void capture_uniform_buffers(Capture &capture, int max_objects)
+{
+  vector<uint8_t> payload;
+  put_int(payload, max_objects);
+  write_chunk(capture, CHUNK_UNIFORM_BUFFERS, payload);
+}
+
+void capture_frame(Capture &capture, const vector<uint8_t> &stream)
+{
+  write_chunk(capture, CHUNK_FRAME, stream);
+  capture.frames++;
+}
+
+// ----- REPLAY -----
+
+// reads past the end fail once and then return zeroes
+struct Reader
+{
+  const uint8_t* data;
+  size_t size, at;
+  bool ok;
+};
+
+static void get(Reader &in, void* data, size_t size)
+{
+  if (!in.ok || size > in.size - in.at)
+  {
+    in.ok = false;
+    memset(data, 0, size);
+    return;
+  }
+  memcpy(data, in.data + in.at, size);
+  in.at += size;
+}
+
+static int32_t get_int(Reader &in)
+{
+  int32_t value;
+  get(in, &value, sizeof(value));
+  return value;
+}
+
+static string get_string(Reader &in)
+{
+  int32_t size = get_int(in);
+  if (size < 0 || (size_t)size > in.size - in.at)
+  {
+    in.ok = false;
+    return "";
+  }
+  string s((const char*)in.data + in.at, size);
+  in.at += size;
+  return s;
+}
+
+// the resources a capture's frames draw with, in this context
+struct ReplayScene
+{
+  vector<GLuint> textures, programs;
+  vector<Mesh> meshes;
+  bool use_ubo;
+  UniformBuffers ubo;
+  ReplayNames names;
+};
+
+// name is the recorded one, table grows to hold it
+static void set_name(vector<GLuint> &table, int name, GLuint value)
+{
+  if ((size_t)name >= table.size())
+    table.resize(name + 1, 0);
+  table[name] = value;
+}
+
+static int replay_texture(Reader &in, ReplayScene &scene)
+{
+  int recorded = get_int(in);
+  GLint width = get_int(in), height = get_int(in);
+  GLint internal_format = get_int(in), min_filter = get_int(in), mag_filter = get_int(in);
+  if (!in.ok || width < 0 || height < 0 || 4 * (size_t)width * height > in.size - in.at)
+    return 0;
+
+  GLuint texture_id;
+  glGenTextures(1, &texture_id);
+  gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture_id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+    in.data + in.at);
+  in.at += 4 * width * height;
+  scene.textures.push_back(texture_id);
+  set_name(scene.names.textures, recorded, texture_id);
+  return 1;
+}
+
+static int replay_mesh(Reader &in, ReplayScene &scene)
+{
+  MeshStream streams[MESH_MAX_STREAMS];
+  int stream_count = get_int(in);
+  if (stream_count < 0 || stream_count > MESH_MAX_STREAMS) return 0;
+  for (int i = 0; i < stream_count; i++)
+  {
+    streams[i].location = get_int(in);
+    streams[i].components = get_int(in);
+    streams[i].size = get_int(in);
+    if (!in.ok || streams[i].size < 0 || (size_t)streams[i].size > in.size - in.at) return 0;
+    streams[i].data = (const GLfloat*)(in.data + in.at);
+    in.at += streams[i].size;
+  }
+  GLsizei index_count = get_int(in);
+  if (!in.ok || index_count < 0 || index_count * sizeof(GLushort) > in.size - in.at) return 0;
+  const GLushort* elements = (const GLushort*)(in.data + in.at);
+  in.at += index_count * sizeof(GLushort);
+
+  Mesh mesh;
+  if (!mesh_create(mesh, streams, stream_count, elements, index_count)) return 0;
+  scene.meshes.push_back(mesh);
+  return 1;
+}
+
+static int replay_program(Reader &in, ReplayScene &scene)
+{
+  int recorded = get_int(in);
+  int glsl_version = get_int(in);
+  string vs_source = get_string(in), fs_source = get_string(in);
+  int attribute_count = get_int(in);
+  if (!in.ok || attribute_count < 0) return 0;
+  vector<string> attributes(attribute_count);
+  for (int i = 0; i < attribute_count; i++)
+    attributes[i] = get_string(in);
+  int blocks = get_int(in);
+  if (!in.ok) return 0;
+
+  GLuint vs = create_shader_source("captured vertex shader", vs_source, GL_VERTEX_SHADER, glsl_version);
+  if (0 == vs) return 0;
+  GLuint fs = create_shader_source("captured fragment shader", fs_source, GL_FRAGMENT_SHADER, glsl_version);
+  if (0 == fs) return 0;
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vs);
+  glAttachShader(program, fs);
+  for (int i = 0; i < attribute_count; i++)
+    glBindAttribLocation(program, i, attributes[i].c_str());
+  glLinkProgram(program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  GLint link_ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+  if (!link_ok)
+  {
+    cerr << "glLinkProgram:";
+    print_log(program);
+    return 0;
+  }
+  scene.programs.push_back(program);
+  set_name(scene.names.programs, recorded, program);
+
+  ProgramInfo info;
+  if (!program_reflect(program, info)) return 0;
+  if (blocks > 0 && !ubo_bind_program(info)) return 0;
+
+  // the recorded locations, to the ones of the same names here
+  if ((size_t)recorded >= scene.names.locations.size())
+    scene.names.locations.resize(recorded + 1);
+  vector<GLint> &locations = scene.names.locations[recorded];
+  int uniforms = get_int(in);
+  for (int i = 0; i < uniforms && in.ok; i++)
+  {
+    string name = get_string(in);
+    GLint location = get_int(in);
+    if (location < 0) continue;
+    if ((size_t)location >= locations.size())
+      locations.resize(location + 1, -1);
+    locations[location] = program_location(info, name_hash(name.c_str()), VAR_UNIFORM);
+  }
+  return in.ok;
+}
+
+static void free_scene(ReplayScene &scene)
+{
+  for (size_t i = 0; i < scene.programs.size(); i++)
+    glDeleteProgram(scene.programs[i]);
+  for (size_t i = 0; i < scene.meshes.size(); i++)
+    mesh_free(scene.meshes[i]);
+  if (!scene.textures.empty())
+    glDeleteTextures(scene.textures.size(), &scene.textures[0]);
+  if (scene.use_ubo)
+    ubo_free(scene.ubo);
+  gl_state_invalidate();
+}
+
+// an offscreen target of the captured size, 0 draws to the window instead
+static GLuint create_target(int width, int height, GLuint renderbuffers[2])
+{
+  if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object)
+  {
+    cerr << "capture_replay: no framebuffer objects, drawing to the window" << endl;
+    return 0;
+  }
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(2, renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+  if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER))
+  {
+    cerr << "capture_replay: incomplete framebuffer, drawing to the window" << endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, renderbuffers);
+    return 0;
+  }
+  return fbo;
+}
+
+int capture_replay(const string &filename, int repeats)
+{
+  ifstream file(filename.c_str(), ios::in | ios::binary);
+  if (!file)
+  {
+    cerr << "capture_replay: cannot read " << filename << endl;
+    return 0;
+  }
+  vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  Reader in = { data.empty() ? NULL : &data[0], data.size(), 0, true };
+  char magic[sizeof(CAPTURE_MAGIC)];
+  get(in, magic, sizeof(magic));
+  int version = get_int(in), width = get_int(in), height = get_int(in);
+  if (!in.ok || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) || CAPTURE_VERSION != version)
+  {
+    cerr << "capture_replay: " << filename << " is not a version " << CAPTURE_VERSION << " capture" << endl;
+    return 0;
+  }
+
+  // resources are made as they come, frames are only located
+  ReplayScene scene;
+  scene.use_ubo = false;
+  vector<vector<uint8_t> > frames;
+  int ok = 1;
+  while (ok && in.at < in.size)
+  {
+    int type = get_int(in), size = get_int(in);
+    if (!in.ok || size < 0 || (size_t)size > in.size - in.at)
+    {
+      ok = 0;
+      break;
+    }
+    Reader chunk = { in.data + in.at, (size_t)size, 0, true };
+    in.at += size;
+    switch (type)
+    {
+    case CHUNK_TEXTURE:
+      ok = replay_texture(chunk, scene);
+      break;
+    case CHUNK_MESH:
+      ok = replay_mesh(chunk, scene);
+      break;
+    case CHUNK_PROGRAM:
+      ok = replay_program(chunk, scene);
+      break;
+    case CHUNK_UNIFORM_BUFFERS:
+      if (!ubo_supported())
+      {
+        cerr << "capture_replay: the capture draws with uniform blocks, which need OpenGL 3.1" << endl;
+        ok = 0;
+        break;
+      }
+      ok = !scene.use_ubo && ubo_init(scene.ubo, get_int(chunk));
+      scene.use_ubo = ok;
+      break;
+    case CHUNK_FRAME:
+      frames.push_back(vector<uint8_t>(chunk.data, chunk.data + chunk.size));
+      break;
+    }
+  }
+  if (!ok || frames.empty())
+  {
+    cerr << "capture_replay: " << filename << " is corrupt, has no frames or could not be recreated" << endl;
+    free_scene(scene);
+    return 0;
+  }
+
+  GLuint renderbuffers[2];
+  GLuint fbo = create_target(width, height, renderbuffers);
+  glViewport(0, 0, width, height);
+  RenderBackend backend;
+  render_backend_init(backend, RENDER_BACKEND_GL, &scene.meshes, scene.use_ubo ? &scene.ubo : NULL);
+
+  // every frame is finished before the next, its time covers CPU and GPU
+  vector<double> times;
+  Clock::time_point start = Clock::now();
+  for (int repeat = 0; repeat < repeats && ok; repeat++)
+    for (size_t frame = 0; frame < frames.size(); frame++)
+    {
+      Clock::time_point frame_start = Clock::now();
+      if (render_replay(frames[frame], backend, &scene.names) < 0)
+      {
+        ok = 0;
+        break;
+      }
+      glFinish();
+      times.push_back(seconds_since(frame_start));
+    }
+  double seconds = seconds_since(start);
+
+  if (ok)
+  {
+    long commands = 0;
+    for (int i = 0; i < RENDER_COMMAND_COUNT; i++)
+      commands += backend.commands[i];
+    sort(times.begin(), times.end());
+    printf("%s: %d frames of %dx%d, %d times, %ld commands/frame\n", filename.c_str(), (int)frames.size(),
+      width, height, repeats, commands / (long)times.size());
+    printf("  %8.3f ms/frame mean %8.3f median %8.3f min %8.3f max, %.1f fps\n",
+      seconds * 1000.0 / times.size(), times[times.size() / 2] * 1000.0, times.front() * 1000.0,
+      times.back() * 1000.0, times.size() / seconds);
+  }
+
+  if (fbo)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, renderbuffers);
+  }
+  free_scene(scene);
+  return ok;
+}
@@ -0,0 +1,50 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "mesh.h"
+#include "geometry_pool.h"
+
+// A session saved to one binary file: the textures, meshes, programs and
+// uniform buffers made at startup, read back from GL so the file holds
+// everything, then the render backend's command stream of every frame.
+// Replaying it needs nothing of the scene code, which makes frame times
+// comparable between builds and drivers, whatever the timing or input
+// was while capturing.
+struct Capture
+{
+  std::ofstream out;
+  int frames;
+};
+
+// returns 1 when all is ok, 0 with a displayed error
+int capture_open(Capture &capture, const std::string &filename, int width, int height);
+// returns 0 with a displayed error when the file could not be written
+int capture_close(Capture &capture);
+
+void capture_texture(Capture &capture, GLuint texture_id);
+// meshes are numbered in the order they are captured, like the backend's
+void capture_mesh(Capture &capture, const Mesh &mesh);
+// a pool mesh saved as a mesh of its own, positions and texcoords split
+// into streams at the locations the pool was created with
+void capture_pool_mesh(Capture &capture, const GeometryPool &pool, int id,
+  GLuint coord_location, GLuint texcoord_location);
+// the sources as create_shader gets them, attribute names[i] bound to i
+void capture_program(Capture &capture, GLuint program, const std::string &vs_source,
+  const std::string &fs_source, int glsl_version, const char* const attributes[], int attribute_count);
+void capture_uniform_buffers(Capture &capture, int max_objects);
+// a frame's recorded render backend stream
+void capture_frame(Capture &capture, const std::vector<uint8_t> &stream);
+
+// Recreate a capture's resources and draw its frames repeats times, as fast
+// as possible into an offscreen framebuffer of the captured size, printing
+// the frame times. Needs a current context with the caller's render state.
+// Returns 1 when all is ok, 0 with a displayed error.
+int capture_replay(const std::string &filename, int repeats);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <string>
 #include <fstream>
@@ -17,18 +18,80 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shader_utils.h"
+#include "program_info.h"
+#include "uniform_buffer.h"
+#include "pipeline.h"
+#include "mesh.h"
+#include "instancing.h"
+#include "batch.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "transform.h"
+#include "entities.h"
+#include "frame_scheduler.h"
+#include "profiler.h"
+#include "gl_trace.h"
+#include "render_backend.h"
+#include "capture.h"
+#include "render_queue.h"
+#include "geometry_pool.h"
+#include "gpu_resources.h"
+#include "assets.h"
+#include "residency.h"
+#include "texture_stream.h"
+#include "gl_state.h"
 #include "res_texture.c"
 
 using namespace std;
 
  // GLOBAL VARIABLES 
-GLuint program;
-GLuint vbo_cube_vertices, vbo_cube_texcoords;
-GLint attribute_coord3d, attribute_texcoord;
-GLuint texture_id;
-GLint uniform_m_transform;
-GLuint ibo_cube_elements;
-GLint uniform_mvp, uniform_mytexture;
+// the scene's renderables; their mesh handles are ids in geometry_pool, or
+// index meshes without GL 3.2; their materials hold the program, the
+// texture and the program's uniform locations
+EntityWorld world;
+GeometryPool geometry_pool;
+bool use_pool = false;
+vector<Mesh> meshes;
+int cube_entity, cube_material, cube_mesh;
+// GLSL 1.40 contexts get the matrices through uniform blocks, 1.20 through the material's uniform_mvp
+bool use_ubo = false;
+UniformBuffers uniform_buffers;
+int cube_object = -1;
+vector<PerObjectBlock> object_blocks;  // by slot, handed to the backend every frame
+// the draw path's commands go through this, GL unless a benchmark swaps it
+RenderBackend backend;
+// the frame's draws, sorted by state before they reach the backend
+RenderQueue draw_queue;
+// the cube's matrix for the 1.20 path and its depth, from update_frame
+glm::mat4 cube_mvp;
+float cube_depth;
+// the cube's placement and its spin below it, update_frame only changes the spin
+TransformHierarchy transforms;
+int cube_anchor_node, cube_spin_node;
+// the simulation advances in fixed steps, frames interpolate the last two
+FrameScheduler scheduler;
+float cube_angle = 0.0f, cube_previous_angle = 0.0f;
+bool frame_stats = false;
+// with --gl-trace, the GL calls of trace_frames frames are counted and saved to trace_filename
+string trace_filename;
+int trace_frames = 0;
+// with --capture, the resources and capture_frames frames are saved to capture
+Capture capture;
+int capture_frames = 0;
+// owns the program, deleting it once the GPU is done with it; the scene's
+// meshes, buffers and VAOs are deleted through its queue too
+GpuResources gpu_resources;
+GpuHandle program_handle = GPU_HANDLE_NONE;
+// shaders and OBJs, shared by the scene and the benchmarks
+AssetManager assets;
+// the texture may be evicted under --vram-budget, draws look its name up every
+// frame; the scene's other buffers and textures only count against the budget
+ResidencyManager residency;
+size_t vram_budget = 0;
+int cube_texture = -1;
+// with --stream-textures the texture fills in over the first frames instead, coarsest level first
+TextureStream texture_stream;
+bool stream_textures = false;
 
 int SCREEN_WIDTH = 800;
 int SCREEN_HEIGHT = 600;
@@ -39,6 +102,19 @@ const string FS_FILENAME = "cube.f.glsl";
 const int SCREEN_X = 600;
 const int SCREEN_Y = 300;
 const string TITLE = "Cube";
+const float Z_NEAR = 0.1f;
+const float Z_FAR = 10.0f;
+const double SIMULATION_STEP = 1.0 / 60.0;
+const float CUBE_SPIN = glm::radians(45.0f);  // radians per second
+const int FRAME_STATS_MS = 5000;
+// the scene pool's capacity, and how long an idle callback may spend compacting it
+const GLuint SCENE_POOL_VERTICES = 1 << 16;
+const GLuint SCENE_POOL_INDICES = 1 << 18;
+const double DEFRAGMENT_SECONDS = 0.001;
+
+// attributes get explicit locations at link time, so these never need a lookup
+enum { ATTRIBUTE_COORD3D, ATTRIBUTE_TEXCOORD, ATTRIBUTE_COUNT };
+const char* const ATTRIBUTE_NAMES[ATTRIBUTE_COUNT] = { "coord3d", "texcoord" };
 
 // STRUCTS
 
@@ -53,162 +129,215 @@ Returns 1 when all is ok, 0 with a displayed error
 int init_resources(void)
 {
 
-  // ----- VERTICES -----
-  GLfloat cube_vertices[] = {
-    // front
-    -1.0, -1.0,  1.0,
-     1.0, -1.0,  1.0,
-     1.0,  1.0,  1.0,
-    -1.0,  1.0,  1.0,
-    // top
-    -1.0,  1.0,  1.0,
-     1.0,  1.0,  1.0,
-     1.0,  1.0, -1.0,
-    -1.0,  1.0, -1.0,
-    // back
-     1.0, -1.0, -1.0,
-    -1.0, -1.0, -1.0,
-    -1.0,  1.0, -1.0,
-     1.0,  1.0, -1.0,
-    // bottom
-    -1.0, -1.0, -1.0,
-     1.0, -1.0, -1.0,
-     1.0, -1.0,  1.0,
-    -1.0, -1.0,  1.0,
-    // left
-    -1.0, -1.0, -1.0,
-    -1.0, -1.0,  1.0,
-    -1.0,  1.0,  1.0,
-    -1.0,  1.0, -1.0,
-    // right
-     1.0, -1.0,  1.0,
-     1.0, -1.0, -1.0,
-     1.0,  1.0, -1.0,
-     1.0,  1.0,  1.0,
-  };
-  glGenBuffers(1, &vbo_cube_vertices);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_vertices);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-
-  // ----- TEXTURE COORDINATES -----
-  GLfloat cube_texcoords[2*4*6] = {
-    // front
-    0.0, 0.0,
-    1.0, 0.0,
-    1.0, 1.0,
-    0.0, 1.0,
-  };
-  // same texture coords for all cube faces, so go through and copy to other 5 faces
-  for (int i = 1; i < 6; i++)
-    memcpy(&cube_texcoords[i*4*2], &cube_texcoords[0], 2*4*sizeof(GLfloat));
-
-  glGenBuffers(1, &vbo_cube_texcoords);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_texcoords);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(cube_texcoords), cube_texcoords, GL_STATIC_DRAW);
-
-  // ----- CUBE ELEMENTS -----
-  GLushort cube_elements[] = {
-    // front
-     0,  1,  2,
-     2,  3,  0,
-    // top
-     4,  5,  6,
-     6,  7,  4,
-    // back
-     8,  9, 10,
-    10, 11,  8,
-    // bottom
-    12, 13, 14,
-    14, 15, 12,
-    // left
-    16, 17, 18,
-    18, 19, 16,
-    // right
-    20, 21, 22,
-    22, 23, 20,
-  };
-  glGenBuffers(1, &ibo_cube_elements);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube_elements);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_elements), cube_elements, GL_STATIC_DRAW);
-  
+  // ----- CUBE MESH -----
+  // one pool holds the scene's meshes when the context has base vertex draws
+  use_pool = geometry_pool_supported();
+  if (use_pool)
+  {
+    if (!geometry_pool_init(geometry_pool, SCENE_POOL_VERTICES, SCENE_POOL_INDICES,
+      ATTRIBUTE_COORD3D, ATTRIBUTE_TEXCOORD)) return 0;
+    vector<Vertex> vertices;
+    vector<GLushort> elements;
+    cube_geometry(vertices, elements);
+    cube_mesh = geometry_pool_add(geometry_pool, vertices, elements);
+    if (cube_mesh < 0)
+    {
+      cerr << "The cube does not fit in the geometry pool" << endl;
+      return 0;
+    }
+  }
+  else
+  {
+    meshes.resize(1);
+    if (!mesh_create_cube(meshes[0], ATTRIBUTE_COORD3D, ATTRIBUTE_TEXCOORD)) return 0;
+    cube_mesh = 0;
+  }
+
+  // ----- TRANSFORMS -----
+  // move everything back 4 units
+  transform_init(transforms);
+  cube_anchor_node = transform_add(transforms, -1, glm::translate(glm::mat4(1.0f), glm::vec3(0.0, 0.0, -4.0)));
+  cube_spin_node = transform_add(transforms, cube_anchor_node, glm::mat4(1.0f));
+
   // ----- TEXTURE RGB -----
-  glGenTextures(1, &texture_id);
-  glBindTexture(GL_TEXTURE_2D, texture_id);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexImage2D(GL_TEXTURE_2D, // target
-         0,  // level, 0 = base, no minimap,
-         GL_RGB, // internalformat
-         res_texture.width,  // width
-         res_texture.height,  // height
-         0,  // border, always 0 in OpenGL ES
-         GL_RGB,  // format
-         GL_UNSIGNED_BYTE, // type
-         res_texture.pixel_data);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  GLuint texture_id;
+  gpu_resources_init(gpu_resources);
+  assets_init(assets, &gpu_resources);
+  residency_init(residency, vram_budget, &gpu_resources);
+  if (stream_textures)
+  {
+    if (!texture_stream_init(texture_stream, 256 << 10, 1 << 20, 2)) return 0;
+    int streamed = texture_stream_load(texture_stream, res_texture.width, res_texture.height,
+      res_texture.bytes_per_pixel, res_texture.pixel_data);
+    if (streamed < 0) return 0;
+    texture_id = texture_stream.textures[streamed].name;
+  }
+  else
+  {
+    cube_texture = residency_create_texture(residency,
+           res_texture.width,  // width
+           res_texture.height,  // height
+           GL_RGB, // internalformat
+           GL_RGB,  // format
+           GL_UNSIGNED_BYTE, // type
+           res_texture.pixel_data);
+    texture_id = residency_use(residency, cube_texture);
+  }
 
   // ----- CREATE SHADERS ------
-  GLuint vs, fs;
-  vs = create_shader("cube.v.glsl", GL_VERTEX_SHADER);
-  if (0 == vs) return 0;
-
-  fs = create_shader("cube.f.glsl", GL_FRAGMENT_SHADER);
-  if (0 == fs) return 0;
-
-  program = glCreateProgram();
-  glAttachShader(program, vs);
-  glAttachShader(program, fs);
-  glLinkProgram(program);
-  GLint link_ok = GL_FALSE;
-  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
-  if (!link_ok) {
-    cerr << "glLinkProgram:";
-    print_log(program);
+  int glsl_version = use_ubo ? 140 : 120;
+
+  // the embedded sources come with their hashes, which key the binary cache
+  string vs_source, fs_source;
+  uint64_t vs_hash, fs_hash;
+  if (!shader_source(VS_FILENAME, vs_source, vs_hash) || !shader_source(FS_FILENAME, fs_source, fs_hash))
+  {
+    cerr << "Missing shader " << VS_FILENAME << " or " << FS_FILENAME << endl;
     return 0;
   }
+  uint64_t program_key = program_cache_key(vs_hash, fs_hash, glsl_version);
 
-  // ----- BIND TO SHADER VARIABLES -----
-  const char* attribute_name = "coord3d";
-  attribute_coord3d = glGetAttribLocation(program, attribute_name);
-  if (-1 == attribute_coord3d)
+  GLuint program = load_program_binary(program_key);
+  if (0 == program)
   {
-    cerr << "Could not bind attribute " << attribute_name << endl;
-    return 0;
+    AssetHandle vs, fs;
+    vs = assets_acquire_shader(assets, VS_FILENAME, GL_VERTEX_SHADER, glsl_version);
+    if (vs < 0) return 0;
+
+    fs = assets_acquire_shader(assets, FS_FILENAME, GL_FRAGMENT_SHADER, glsl_version);
+    if (fs < 0)
+    {
+      assets_release(assets, vs);
+      return 0;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, assets_get(assets, vs).shader);
+    glAttachShader(program, assets_get(assets, fs).shader);
+    program_bind_attributes(program, ATTRIBUTE_NAMES, ATTRIBUTE_COUNT);
+    if (GLEW_ARB_get_program_binary)
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    // the manager keeps the shaders until they are evicted
+    glDetachShader(program, assets_get(assets, vs).shader);
+    glDetachShader(program, assets_get(assets, fs).shader);
+    assets_release(assets, vs);
+    assets_release(assets, fs);
+    GLint link_ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+    if (!link_ok) {
+      cerr << "glLinkProgram:";
+      print_log(program);
+      return 0;
+    }
+    save_program_binary(program, program_key);
   }
+  program_handle = gpu_register(gpu_resources, GPU_PROGRAM, program);
+
+  // ----- BIND TO SHADER VARIABLES -----
+  ProgramInfo program_info;
+  if (!program_reflect(program, program_info)) return 0;
+
+  const ProgramVarName expected[] = {
+    { "coord3d", VAR_ATTRIBUTE },
+    { "texcoord", VAR_ATTRIBUTE },
+    { "mytexture", VAR_UNIFORM },
+    { "mvp", VAR_UNIFORM },
+  };
+  GLint locations[4];
+  // the UBO path has no mvp uniform, its matrices come from the blocks
+  if (!program_require(program_info, expected, use_ubo ? 3 : 4, locations)) return 0;
+
+  GLint uniform_mytexture = locations[2];
+  GLint uniform_mvp = use_ubo ? -1 : locations[3];
 
-  attribute_name = "texcoord";
-  attribute_texcoord = glGetAttribLocation(program, attribute_name);
-  if (-1 == attribute_texcoord)
+  // ----- UNIFORM BUFFERS -----
+  if (use_ubo)
   {
-    cerr << "Could not bind attribute " << attribute_name << endl;
-    return 0;
+    if (!ubo_init(uniform_buffers, 1)) return 0;
+    if (!ubo_bind_program(program_info)) return 0;
+    cube_object = ubo_alloc_object(uniform_buffers);
+    object_blocks.resize(uniform_buffers.object_count);
   }
 
-  const char * uniform_name = "mvp";
-  uniform_mvp = glGetUniformLocation(program, uniform_name);
-  if (-1 == uniform_mvp)
+  // ----- RESIDENCY -----
+  // VAOs, mappings and the stream hold on to these names, they are never evicted
+  for (size_t i = 0; i < meshes.size(); i++)
   {
-    cerr << "Could not bind uniform " << uniform_name << endl;
-    return 0;
+    for (int s = 0; s < meshes[i].stream_count; s++)
+      residency_track(residency, RESIDENT_BUFFER, meshes[i].vbo[s]);
+    residency_track(residency, RESIDENT_BUFFER, meshes[i].ibo);
+  }
+  if (use_pool)
+  {
+    residency_track(residency, RESIDENT_BUFFER, geometry_pool.vbo);
+    residency_track(residency, RESIDENT_BUFFER, geometry_pool.ibo);
+  }
+  if (use_ubo)
+  {
+    residency_track(residency, RESIDENT_BUFFER, uniform_buffers.frame_buffer);
+    residency_track(residency, RESIDENT_BUFFER, uniform_buffers.objects.buffer);
   }
+  if (stream_textures)
+  {
+    residency_track(residency, RESIDENT_BUFFER, texture_stream.pbo);
+    for (size_t i = 0; i < texture_stream.textures.size(); i++)
+      residency_track(residency, RESIDENT_TEXTURE, texture_stream.textures[i].name,
+        texture_stream_bytes(texture_stream, i));
+  }
+
+  render_backend_init(backend, RENDER_BACKEND_GL, &meshes, use_ubo ? &uniform_buffers : NULL);
+  if (use_pool)
+    backend.pool = &geometry_pool;
+  backend.recording = capture_frames > 0;
+  render_queue_init(draw_queue);
 
-  uniform_name = "mytexture";
-  uniform_mytexture = glGetUniformLocation(program, uniform_name);
-  if (-1 == uniform_mvp)
+  // ----- CAPTURE -----
+  // read back from GL, so the capture has what was really uploaded
+  if (capture_frames > 0)
   {
-    cerr << "Could not bind uniform " << uniform_name << endl;
-    return 0;
+    if (stream_textures)
+      texture_stream_finish(texture_stream);
+    capture_texture(capture, texture_id);
+    if (use_pool)
+      capture_pool_mesh(capture, geometry_pool, cube_mesh, ATTRIBUTE_COORD3D, ATTRIBUTE_TEXCOORD);
+    else
+      capture_mesh(capture, meshes[0]);
+    capture_program(capture, program, vs_source, fs_source, glsl_version, ATTRIBUTE_NAMES, ATTRIBUTE_COUNT);
+    if (use_ubo)
+      capture_uniform_buffers(capture, uniform_buffers.object_capacity);
   }
 
+  // ----- ENTITIES -----
+  // the rotating cube fits in a sphere of radius sqrt(3) around its center
+  entities_init(world);
+  cube_entity = entity_create(world, COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_MATERIAL | COMPONENT_BOUNDS);
+  entity_set_mesh(world, cube_entity, cube_mesh);
+  cube_material = entities_add_material(world, program, texture_id, uniform_mytexture, uniform_mvp);
+  entity_set_material(world, cube_entity, cube_material);
+  entity_set_radius(world, cube_entity, sqrtf(3.0f));
+
   return 1;
 }
 
-void onIdle()
+// advance the animation by one fixed step
+void simulate(double seconds)
 {
-  // compute mvp
+  cube_previous_angle = cube_angle;
+  cube_angle += CUBE_SPIN * (float)seconds;
+  if (cube_angle > 2.0f * (float)M_PI)
+  {
+    cube_angle -= 2.0f * (float)M_PI;
+    cube_previous_angle -= 2.0f * (float)M_PI;
+  }
+}
 
-  // move everything back 4 units
-  glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, 0.0, -4.0));
+// alpha interpolates between the last two simulation steps
+void update_frame(float alpha)
+{
+  PROFILE_SCOPE("update");
+
+  // compute mvp
 
   // stand at (0, 2, 0) and look towards (0, 0, -4), with (0, 1, 0) being up
   glm::vec3 cameraLocation = glm::vec3(0.0, 2.0, 0.0);
@@ -222,79 +351,185 @@ void onIdle()
   glm::mat4 view = glm::lookAt(cameraLocation, lookTowards, up);
 
   // translate world to 2D screen
-  glm::mat4 projection = glm::perspective(45.0f, 1.0f*SCREEN_WIDTH/SCREEN_HEIGHT, 0.1f, 10.0f);
+  glm::mat4 projection = glm::perspective(45.0f, 1.0f*SCREEN_WIDTH/SCREEN_HEIGHT, Z_NEAR, Z_FAR);
 
   // rotate model 45 degrees every second
-  float angle = glutGet(GLUT_ELAPSED_TIME)/200*10; // 45 degrees a second
+  float angle = cube_previous_angle + (cube_angle - cube_previous_angle) * alpha;
   glm::vec3 axis_y(1.0, 0.0, 0.0);
-  glm::mat4 anim = glm::rotate(glm::mat4(1.0f), glm::radians(angle), axis_y);
+  glm::mat4 anim = glm::rotate(glm::mat4(1.0f), angle, axis_y);
+  transform_set_local(transforms, cube_spin_node, anim);
+  transform_update(transforms);
+  glm::mat4 model = transform_world(transforms, cube_spin_node);
+  entity_transform(world, cube_entity) = model;
+  // the cube's center in view space, looking down -z
+  cube_depth = -(view * model)[3].z / Z_FAR;
+
+  // onDisplay skips the cube while it is outside the view frustum
+  Frustum frustum;
+  frustum_from_matrix(projection * view, frustum);
+  entities_update_bounds(world);
+  entities_cull(world, frustum);
+
+  if (use_ubo)
+  {
+    static float last_seconds = 0.0f;
+    float seconds = (float)scheduler_now();
+
+    PerFrameBlock frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.time = glm::vec4(seconds, seconds - last_seconds, 0.0, 0.0);
+    last_seconds = seconds;
+    render_frame_block(backend, frame);
+
+    object_blocks[cube_object].model = model;
+    PROFILE_SCOPE("upload");
+    render_object_blocks(backend, &object_blocks[0], object_blocks.size());
+  }
+  else
+  {
+    // multiply it all through to get model-view-projection matrix (the model includes the animation)
+    // display_frame sends it through to our vertex shader
+    cube_mvp = projection * view * model;
+  }
+}
+
+// waits for the frame's time in the GLUT loop, so input is handled meanwhile
+void onTimer(int)
+{
+  int sleep_ms;
+  if (scheduler_frame_due(scheduler, sleep_ms))
+    glutPostRedisplay();
+  else
+    glutTimerFunc(sleep_ms, onTimer, 0);
+}
 
-  // multiply it all through to get model-view-projection matrix (with an animation at the start)
-  glm::mat4 mvp = projection * view * model * anim;
-  // glm::mat4 mvp = projection * view * model;
+// simulate, draw and swap, the profiler's frame
+void display_frame()
+{
+  PROFILE_SCOPE("display");
+  int steps = scheduler_begin_frame(scheduler);
+  for (int i = 0; i < steps; i++)
+    simulate(scheduler.step);
+  update_frame(scheduler_alpha(scheduler));
 
-  glUseProgram(program);
+  /* Clear the background as white */
+  render_clear(backend, glm::vec4(1.0, 1.0, 1.0, 1.0));
 
-  // send this data through to our vertex shader
-  glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+  render_queue_begin(draw_queue);
+  if (entity_visible(world, cube_entity))
+  {
+    const Archetype &archetype = world.archetypes[world.entity_archetype[cube_entity]];
+    int row = world.entity_row[cube_entity];
+    Material &material = world.materials[archetype.materials[row]];
+    // eviction may have given the texture another name
+    if (cube_texture >= 0)
+      material.texture_id = residency_use(residency, cube_texture);
+    material.program = gpu_name(gpu_resources, program_handle);
+    int mesh = archetype.meshes[row];
+    int pass = material.transparent ? RENDER_PASS_TRANSPARENT : RENDER_PASS_OPAQUE;
+    RenderDraw &draw = render_queue_add(draw_queue,
+      render_key(pass, material.program, material.texture_id, mesh, cube_depth));
+    draw.program = material.program;
+
+    // send texture rgb to shaders
+    draw.texture_id = material.texture_id;
+    draw.uniform_texture = material.uniform_texture;
+
+    // the VAO already knows the vertex format and the index count
+    draw.mesh = mesh;
+    draw.object = use_ubo ? cube_object : -1;
+    draw.uniform_mvp = material.uniform_mvp;
+    draw.mvp = cube_mvp;
+  }
+  render_queue_sort(draw_queue);
+  {
+    PROFILE_SCOPE("draw");
+    render_queue_submit(draw_queue, backend);
+  }
 
-  glutPostRedisplay();
+  // fences the uniform blocks too
+  render_frame_end(backend);
 
+  /* Display the result */
+  PROFILE_SCOPE("swap");
+  glutSwapBuffers();
+}
+
+// compacts the scene pool between frames, a little at a time, and goes
+// away once there are no holes left
+void onIdle()
+{
+  geometry_pool_defragment_for(geometry_pool, DEFRAGMENT_SECONDS);
+  if (!geometry_pool_fragmented(geometry_pool))
+    glutIdleFunc(NULL);
 }
 
 void onDisplay()
 {
-  /* Clear the background as white */
-  glClearColor(1.0, 1.0, 1.0, 1.0);
-  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram(program);
-
-  // send texture rgb to shaders
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture_id);
-  glUniform1i(uniform_mytexture, /*GL_TEXTURE*/0);
-
-  // send vertex and texture vertices to shaders
-  glEnableVertexAttribArray(attribute_coord3d);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_vertices);
-  glVertexAttribPointer(
-    attribute_coord3d,         // attribute
-    3,                         // number of elements per vertex, here (x,y,z)
-    GL_FLOAT,                  // the type of each element
-    GL_FALSE,                  // take our values as-is
-    0,                         // no extra data between each position
-    0                          // offset of first element
-  );
-
-  glEnableVertexAttribArray(attribute_texcoord);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_texcoords);
-  glVertexAttribPointer(
-    attribute_texcoord,                             // attribute
-    2,                                              // number of elements per vertex, here (x,y)
-    GL_FLOAT,                                       // the type of each element,
-    GL_FALSE,                                       // take our values as-is
-    0,                                              // no extra data between each position
-    0                                               // offset of first element
-  );
-
-  // push each element in buffer_vertices to the vertex shader
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube_elements);
-
-  // use glGetBufferParameteriv to grab the buffer size so we don't have to declare cube_elements.
-  int size;
-  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-  glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
-
-  /* Push each element in buffer_vertices to the vertex shader */
-  glDrawArrays(GL_TRIANGLES, 0, 3);
-
-  glDisableVertexAttribArray(attribute_coord3d);
-  glDisableVertexAttribArray(attribute_texcoord);
+  if (stream_textures)
+    texture_stream_update(texture_stream);
+  display_frame();
+  PROFILE_FRAME_END();
+  gl_state_frame_end();
+  residency_end_frame(residency);
+  gpu_resources_end_frame(gpu_resources);
+  // meshes removed this frame leave holes, idle time closes them
+  if (use_pool && geometry_pool_fragmented(geometry_pool))
+    glutIdleFunc(onIdle);
+  if (trace_frames > 0)
+  {
+    gl_trace_frame_end();
+    if (gl_trace_frames() == trace_frames)
+    {
+      gl_trace_report(stdout);
+      gl_trace_save(trace_filename);
+      glutLeaveMainLoop();
+      return;
+    }
+  }
+  if (capture_frames > 0)
+  {
+    capture_frame(capture, backend.stream);
+    backend.stream.clear();
+    if (capture.frames == capture_frames)
+    {
+      capture_close(capture);
+      glutLeaveMainLoop();
+      return;
+    }
+  }
 
-  /* Display the result */
-  glutSwapBuffers();
+  // keep drawing on demand until the texture is complete; display_frame
+  // clears the requests made before it
+  if (stream_textures && !texture_stream_idle(texture_stream))
+    scheduler_request_redraw(scheduler);
+
+  // sleep in the GLUT loop until the next frame, instead of spinning in an idle callback
+  int sleep_ms;
+  if (scheduler_end_frame(scheduler, sleep_ms))
+    glutTimerFunc(sleep_ms, onTimer, 0);
+}
+
+// space pauses and resumes the animation, any key redraws
+void onKeyboard(unsigned char key, int, int)
+{
+  if (' ' == key)
+    scheduler_set_animating(scheduler, !scheduler.animating);
+  scheduler_request_redraw(scheduler);
+  glutPostRedisplay();
+}
 
+void onStatsTimer(int)
+{
+  scheduler_print_stats(scheduler);
+  render_queue_print_stats(draw_queue);
+  gl_state_report(stdout);
+  gpu_resources_print_stats(gpu_resources);
+  residency_report(residency, stdout);
+  if (stream_textures)
+    texture_stream_report(texture_stream, stdout);
+  glutTimerFunc(FRAME_STATS_MS, onStatsTimer, 0);
 }
 
 void onReshape(int width, int height)
@@ -302,19 +537,68 @@ void onReshape(int width, int height)
   SCREEN_WIDTH = width;
   SCREEN_HEIGHT = height;
   glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+  scheduler_request_redraw(scheduler);
+}
+
+// the GL state every frame draws with; blending and face culling belong
+// to the render passes, the queue sets them
+void init_render_state()
+{
+  gl_state_enable(GL_DEPTH_TEST, true);
 }
 
 void free_resources()
 {
-  glDeleteProgram(program);
-  glDeleteBuffers(1, &vbo_cube_vertices);
-  glDeleteBuffers(1, &vbo_cube_texcoords);
-  glDeleteBuffers(1, &ibo_cube_elements);
-  glDeleteTextures(1, &texture_id);
+  PROFILE_FREE();
+  gpu_release(gpu_resources, program_handle);
+  for (size_t i = 0; i < meshes.size(); i++)
+    mesh_free(meshes[i], &gpu_resources);
+  if (use_pool)
+    geometry_pool_free(geometry_pool, &gpu_resources);
+  residency_free(residency);
+  if (stream_textures)
+    texture_stream_free(texture_stream);
+  if (use_ubo)
+    ubo_free(uniform_buffers, &gpu_resources);
+  assets_free(assets);
+  gpu_resources_free(gpu_resources);
 }
 
 int main(int argc, char* argv[])
 {
+  // CPU-only benchmarks, they need no window
+  for (int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    // --bench-cull N: frustum culling of N spheres (1M by default)
+    if (arg == "--bench-cull")
+    {
+      culling_benchmark((i + 1 < argc) ? atoi(argv[i + 1]) : 1000000);
+      return EXIT_SUCCESS;
+    }
+    // --gl-trace-diff BEFORE AFTER: compare two --gl-trace reports, fails when calls went up
+    if (arg == "--gl-trace-diff" && i + 2 < argc)
+      return gl_trace_diff(argv[i + 1], argv[i + 2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    // --bench-backend N: culling and command building of N entities on the null and recording backends
+    if (arg == "--bench-backend")
+    {
+      render_backend_benchmark((i + 1 < argc) ? atoi(argv[i + 1]) : 100000);
+      return EXIT_SUCCESS;
+    }
+    // --bench-queue N: sorting and submitting N draws on the null backend (1M by default)
+    if (arg == "--bench-queue")
+    {
+      render_queue_benchmark((i + 1 < argc) ? atoi(argv[i + 1]) : 1000000);
+      return EXIT_SUCCESS;
+    }
+    // --bench-transforms N: hierarchy updates of N nodes (100k by default)
+    if (arg == "--bench-transforms")
+    {
+      transform_benchmark((i + 1 < argc) ? atoi(argv[i + 1]) : 100000);
+      return EXIT_SUCCESS;
+    }
+  }
+
   // Glut-related initialising functions 
   glutInit(&argc, argv);
   glutInitContextVersion(2,0);
@@ -336,19 +620,192 @@ int main(int argc, char* argv[])
     cerr << "Error: your graphic card does not support OpenGL 2.0" << endl;
     return 1;
   }
+  // nothing is known of the state the context starts with
+  gl_state_invalidate();
+
+  // uniform blocks when the context has them, the plain 1.20 uniforms otherwise
+  use_ubo = ubo_supported();
+
+  // benchmark modes run instead of the interactive scene
+  int bench_instances = 0, bench_batch = 0, bench_occlusion = 0, bench_entities = 0, bench_passes = 0,
+    bench_geometry = 0, bench_assets = 0, bench_residency = 0, residency_working_set = 0,
+    bench_streaming = 0, streaming_size = 0;
+  double max_fps = 60.0;
+  bool on_demand = false;
+  int profile_frames = 0;
+  string capture_filename, replay_filename;
+  int replay_repeats = 10;
+  for (int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    // --bench-pipelines V F: link counts for V x F vertex/fragment permutations
+    if (arg == "--bench-pipelines" && i + 2 < argc)
+    {
+      return pipeline_benchmark(atoi(argv[i + 1]), atoi(argv[i + 2]), use_ubo ? 140 : 120) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    // --bench-instances N: instanced cubes and suzannes, 1 to N of them
+    if (arg == "--bench-instances")
+      bench_instances = (i + 1 < argc) ? atoi(argv[i + 1]) : 100000;
+    // --bench-batch N: N mixed objects through the draw loop and multi-draw indirect
+    if (arg == "--bench-batch")
+      bench_batch = (i + 1 < argc) ? atoi(argv[i + 1]) : 10000;
+    // --bench-occlusion N: N objects behind walls, with and without CPU occlusion culling
+    if (arg == "--bench-occlusion")
+      bench_occlusion = (i + 1 < argc) ? atoi(argv[i + 1]) : 10000;
+    // --bench-entities N: the systems of N entities, animated, culled and drawn
+    if (arg == "--bench-entities")
+      bench_entities = (i + 1 < argc) ? atoi(argv[i + 1]) : 100000;
+    // --bench-passes N: N cubes covering each other, blended in any order and in the opaque pass
+    if (arg == "--bench-passes")
+      bench_passes = (i + 1 < argc) ? atoi(argv[i + 1]) : 16;
+    // --bench-geometry N: N cubes with buffers of their own and out of a geometry pool, then churned
+    if (arg == "--bench-geometry")
+      bench_geometry = (i + 1 < argc) ? atoi(argv[i + 1]) : 10000;
+    // --bench-assets N: N loads of the same OBJ and shaders, directly and through the asset manager
+    if (arg == "--bench-assets")
+      bench_assets = (i + 1 < argc) ? atoi(argv[i + 1]) : 100;
+    // --bench-residency N W: N textures, W of them drawn per frame (64 and 16), under --vram-budget (8 MB)
+    if (arg == "--bench-residency")
+    {
+      bench_residency = (i + 1 < argc && atoi(argv[i + 1]) > 0) ? atoi(argv[i + 1]) : 64;
+      residency_working_set = (i + 2 < argc && atoi(argv[i + 2]) > 0) ? atoi(argv[i + 2]) : 16;
+    }
+    // --bench-streaming N SIZE: N textures of SIZE x SIZE (16 of 1024) uploaded at once, then streamed
+    if (arg == "--bench-streaming")
+    {
+      bench_streaming = (i + 1 < argc && atoi(argv[i + 1]) > 0) ? atoi(argv[i + 1]) : 16;
+      streaming_size = (i + 2 < argc && atoi(argv[i + 2]) > 0) ? atoi(argv[i + 2]) : 1024;
+    }
+    // --stream-textures: upload the texture from worker threads over the first frames, coarsest level first
+    if (arg == "--stream-textures")
+      stream_textures = true;
+    // --vram-budget MB: evict the least recently drawn textures and buffers beyond this
+    if (arg == "--vram-budget" && i + 1 < argc)
+      vram_budget = (size_t)(atof(argv[i + 1]) * 1048576.0);
+    // --fps N: frame rate cap, 0 leaves it to the swap interval
+    if (arg == "--fps" && i + 1 < argc)
+      max_fps = atof(argv[i + 1]);
+    // --on-demand: draw only on input or while the animation runs, space pauses it
+    if (arg == "--on-demand")
+      on_demand = true;
+    // --frame-stats: print frame rate, CPU use, power and state changes every 5 seconds
+    if (arg == "--frame-stats")
+      frame_stats = true;
+    // --profile N: print the CPU and GPU time of every profiled scope each N frames
+    if (arg == "--profile")
+      profile_frames = (i + 1 < argc) ? atoi(argv[i + 1]) : 120;
+    // --gl-trace FILE N: count the GL calls of N frames (300 by default), save them to FILE and quit
+    if (arg == "--gl-trace" && i + 1 < argc)
+    {
+      trace_filename = argv[i + 1];
+      trace_frames = (i + 2 < argc && atoi(argv[i + 2]) > 0) ? atoi(argv[i + 2]) : 300;
+    }
+    // --capture FILE N: save the resources and N frames (300 by default) to FILE and quit
+    if (arg == "--capture" && i + 1 < argc)
+    {
+      capture_filename = argv[i + 1];
+      capture_frames = (i + 2 < argc && atoi(argv[i + 2]) > 0) ? atoi(argv[i + 2]) : 300;
+    }
+    // --replay FILE N: draw a capture N times (10 by default) offscreen, as fast as possible
+    if (arg == "--replay" && i + 1 < argc)
+    {
+      replay_filename = argv[i + 1];
+      replay_repeats = (i + 2 < argc && atoi(argv[i + 2]) > 0) ? atoi(argv[i + 2]) : 10;
+    }
+  }
+
+  if (stream_textures && !texture_stream_supported())
+  {
+    cerr << "--stream-textures: pixel buffer objects need OpenGL 2.1, uploading at once" << endl;
+    stream_textures = false;
+  }
+  // an evicted texture comes back under a new name, which the capture never saw
+  if (capture_frames > 0 && vram_budget > 0)
+  {
+    cerr << "--capture: evicted textures would replay under unknown names, ignoring --vram-budget" << endl;
+    vram_budget = 0;
+  }
+
+  // a replay brings its own resources
+  if (!replay_filename.empty())
+  {
+    glutHideWindow();
+    init_render_state();
+    return capture_replay(replay_filename, replay_repeats) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
   // When all init functions run without errors,
   // the program can initialise the resources 
+  // hook GLEW's pointers before anything is created, so the trace knows every binding
+  if (trace_frames > 0)
+  {
+    gl_trace_install();
+    glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
+  }
+  if (capture_frames > 0)
+  {
+    if (!capture_open(capture, capture_filename, SCREEN_WIDTH, SCREEN_HEIGHT)) return EXIT_FAILURE;
+    glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
+  }
+
   if (1 == init_resources())
   {
-    /* We can display it if everything goes OK */
-    glutDisplayFunc(onDisplay);
-    glutReshapeFunc(onReshape);
-    glutIdleFunc(onIdle);
-    glEnable(GL_BLEND);
-    glEnable(GL_DEPTH_TEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glutMainLoop();
+    if (profile_frames > 0)
+    {
+      PROFILE_INIT(profile_frames);
+    }
+    GLuint texture_id = world.materials[cube_material].texture_id;
+    // the trace reports frames, what loading the scene called is not one
+    if (trace_frames > 0)
+      gl_trace_reset();
+    if (bench_instances > 0)
+    {
+      instancing_benchmark(bench_instances, texture_id, assets);
+    }
+    else if (bench_batch > 0)
+    {
+      batch_benchmark(bench_batch, texture_id, assets);
+    }
+    else if (bench_occlusion > 0)
+    {
+      occlusion_benchmark(bench_occlusion, texture_id, assets);
+    }
+    else if (bench_entities > 0)
+    {
+      entities_benchmark(bench_entities, texture_id, assets);
+    }
+    else if (bench_passes > 0)
+    {
+      render_pass_benchmark(bench_passes, texture_id);
+    }
+    else if (bench_geometry > 0)
+    {
+      geometry_pool_benchmark(bench_geometry, texture_id, assets);
+    }
+    else if (bench_assets > 0)
+    {
+      assets_benchmark(bench_assets);
+    }
+    else if (bench_residency > 0)
+    {
+      residency_benchmark(bench_residency, residency_working_set, vram_budget ? vram_budget : 8 << 20);
+    }
+    else if (bench_streaming > 0)
+    {
+      texture_stream_benchmark(bench_streaming, streaming_size);
+    }
+    else
+    {
+      /* We can display it if everything goes OK */
+      glutDisplayFunc(onDisplay);
+      glutReshapeFunc(onReshape);
+      glutKeyboardFunc(onKeyboard);
+      scheduler_init(scheduler, SIMULATION_STEP, max_fps, on_demand);
+      if (frame_stats)
+        glutTimerFunc(FRAME_STATS_MS, onStatsTimer, 0);
+      init_render_state();
+      glutMainLoop();
+    }
   }
 
   // If the program exits in the usual way,
@@ -1,10 +1,36 @@
 attribute vec3 coord3d;                  
 attribute vec2 texcoord;
+#ifdef INSTANCED
+attribute mat4 instance_model;
+#endif
 varying vec2 f_texcoord;
+#ifdef HAVE_UBO
+// std140 layouts mirrored by PerFrameBlock/PerObjectBlock in uniform_buffer.h
+layout(std140) uniform PerFrame
+{
+  mat4 view;
+  mat4 projection;
+  vec4 time;
+};
+layout(std140) uniform PerObject
+{
+  mat4 model;
+};
+#else
 uniform mat4 mvp;
+#endif
 
 void main(void) 
 {
+#if defined(HAVE_UBO) && defined(INSTANCED)
+  gl_Position = projection * view * instance_model * vec4(coord3d, 1.0);
+#elif defined(HAVE_UBO)
+  gl_Position = projection * view * model * vec4(coord3d, 1.0);
+#elif defined(INSTANCED)
+  // mvp holds projection * view, the model matrix comes with each instance
+  gl_Position = mvp * instance_model * vec4(coord3d, 1.0);
+#else
   gl_Position = mvp * vec4(coord3d, 1.0); 
+#endif
   f_texcoord = texcoord;
 }
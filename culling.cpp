@@ -0,0 +1,217 @@
+#include "culling.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CULLING_X86 1
+#endif
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+void frustum_from_matrix(const glm::mat4 &m, Frustum &frustum)
+{
+  // Gribb/Hartmann: each plane is the last row of m plus or minus another row.
+  // glm is column-major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i]).
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++)
+    rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+  frustum.planes[0] = rows[3] + rows[0];  // left
+  frustum.planes[1] = rows[3] - rows[0];  // right
+  frustum.planes[2] = rows[3] + rows[1];  // bottom
+  frustum.planes[3] = rows[3] - rows[1];  // top
+  frustum.planes[4] = rows[3] + rows[2];  // near
+  frustum.planes[5] = rows[3] - rows[2];  // far
+
+  for (int i = 0; i < 6; i++)
+  {
+    glm::vec4 &p = frustum.planes[i];
+    p = p / glm::length(glm::vec3(p));
+  }
+}
+
+bool sphere_in_frustum(const Frustum &frustum, const glm::vec3 &center, float radius)
+{
+  for (int i = 0; i < 6; i++)
+  {
+    const glm::vec4 &p = frustum.planes[i];
+    if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius)
+      return false;
+  }
+  return true;
+}
+
+void bounds_resize(SphereBounds &bounds, int count)
+{
+  bounds.count = count;
+  bounds.x.resize(count);
+  bounds.y.resize(count);
+  bounds.z.resize(count);
+  bounds.radius.resize(count);
+}
+
+void bounds_set(SphereBounds &bounds, int i, const glm::vec3 &center, float radius)
+{
+  bounds.x[i] = center.x;
+  bounds.y[i] = center.y;
+  bounds.z[i] = center.z;
+  bounds.radius[i] = radius;
+}
+
+static int cull_scalar(const Frustum &frustum, const SphereBounds &bounds, uint8_t* visible,
+  int begin, int end)
+{
+  int count = 0;
+  for (int i = begin; i < end; i++)
+  {
+    uint8_t inside = 1;
+    for (int p = 0; p < 6; p++)
+    {
+      const glm::vec4 &plane = frustum.planes[p];
+      float distance = plane.x * bounds.x[i] + plane.y * bounds.y[i] + plane.z * bounds.z[i] + plane.w;
+      inside &= distance >= -bounds.radius[i];
+    }
+    visible[i] = inside;
+    count += inside;
+  }
+  return count;
+}
+
+#ifdef CULLING_X86
+// 8 spheres per iteration: one distance per plane for all of them, and the
+// 8 inside flags come out of a single movemask
+__attribute__((target("avx2,fma,bmi2")))
+static int cull_avx2(const Frustum &frustum, const SphereBounds &bounds, uint8_t* visible,
+  int begin, int end)
+{
+  __m256 px[6], py[6], pz[6], pw[6];
+  for (int p = 0; p < 6; p++)
+  {
+    px[p] = _mm256_set1_ps(frustum.planes[p].x);
+    py[p] = _mm256_set1_ps(frustum.planes[p].y);
+    pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+    pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+  }
+
+  const float* xs = &bounds.x[0];
+  const float* ys = &bounds.y[0];
+  const float* zs = &bounds.z[0];
+  const float* rs = &bounds.radius[0];
+  int count = 0;
+  int i = begin;
+  for (; i + 8 <= end; i += 8)
+  {
+    __m256 x = _mm256_loadu_ps(xs + i);
+    __m256 y = _mm256_loadu_ps(ys + i);
+    __m256 z = _mm256_loadu_ps(zs + i);
+    __m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(rs + i));
+
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++)
+    {
+      __m256 d = _mm256_fmadd_ps(px[p], x, pw[p]);
+      d = _mm256_fmadd_ps(py[p], y, d);
+      d = _mm256_fmadd_ps(pz[p], z, d);
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GE_OQ));
+    }
+
+    // spread the 8 mask bits into 8 bytes of 0 or 1
+    unsigned mask = _mm256_movemask_ps(inside);
+    uint64_t bytes = _pdep_u64(mask, 0x0101010101010101ull);
+    memcpy(visible + i, &bytes, 8);
+    count += __builtin_popcount(mask);
+  }
+  return count + cull_scalar(frustum, bounds, visible, i, end);
+}
+#endif
+
+int culling_has_avx2()
+{
+#ifdef CULLING_X86
+  static int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+    && __builtin_cpu_supports("bmi2");
+  return has_avx2;
+#else
+  return 0;
+#endif
+}
+
+int cull_spheres(const Frustum &frustum, const SphereBounds &bounds, uint8_t* visible,
+  int begin, int end, bool use_simd)
+{
+#ifdef CULLING_X86
+  if (use_simd && culling_has_avx2())
+    return cull_avx2(frustum, bounds, visible, begin, end);
+#endif
+  return cull_scalar(frustum, bounds, visible, begin, end);
+}
+
+int cull_spheres_parallel(const Frustum &frustum, const SphereBounds &bounds, uint8_t* visible)
+{
+  // chunks are multiples of 8, so every thread but the last stays on the SIMD loop
+  atomic<int> count(0);
+  parallel_for(bounds.count, 16384, [&](int begin, int end) {
+    count += cull_spheres(frustum, bounds, visible, begin, end);
+  });
+  return count;
+}
+
+// ----- BENCHMARK -----
+
+void culling_benchmark(int count)
+{
+  // spheres scattered through a 1000-unit box around a camera at the origin
+  SphereBounds bounds;
+  bounds_resize(bounds, count);
+  srand(1);
+  for (int i = 0; i < count; i++)
+  {
+    glm::vec3 center(rand() % 1000 - 500.0f, rand() % 1000 - 500.0f, rand() % 1000 - 500.0f);
+    bounds_set(bounds, i, center, 0.5f + (rand() % 150) / 100.0f);
+  }
+
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, 1.0, 0.0));
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+  Frustum frustum;
+  frustum_from_matrix(projection * view, frustum);
+
+  vector<uint8_t> visible(count);
+  const int RUNS = 20;
+  printf("%d spheres, %d threads, AVX2 %s\n", count, parallel_threads(),
+    culling_has_avx2() ? "available" : "not available");
+
+  for (int path = 0; path < 3; path++)
+  {
+    // without AVX2 the last run still shows what the threads bring
+    const char* names[] = { "scalar", "avx2", "avx2 + threads" };
+    if (1 == path && !culling_has_avx2())
+      continue;
+
+    int visible_count = 0;
+    Clock::time_point start = Clock::now();
+    for (int run = 0; run < RUNS; run++)
+    {
+      if (2 == path)
+        visible_count = cull_spheres_parallel(frustum, bounds, &visible[0]);
+      else
+        visible_count = cull_spheres(frustum, bounds, &visible[0], 0, count, 1 == path);
+    }
+    printf("  %-16s %10.3f ms %10d visible\n", names[path], seconds_since(start) * 1000.0 / RUNS, visible_count);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef _CULLING_H
+#define _CULLING_H
+
+#include <stdint.h>
+#include <vector>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+// six planes (a, b, c, d), normals pointing inwards and normalized, so
+// dot(plane.xyz, p) + plane.w is the signed distance of p to the plane
+struct Frustum
+{
+  glm::vec4 planes[6];
+};
+
+// Bounding spheres in structure-of-arrays form, so 8 of them load into one
+// AVX register per component.
+struct SphereBounds
+{
+  std::vector<float> x, y, z, radius;
+  int count;
+};
+
+// planes of a projection * view (or projection * view * model) matrix
+void frustum_from_matrix(const glm::mat4 &m, Frustum &frustum);
+
+// test a single sphere, for the odd object outside any SphereBounds
+bool sphere_in_frustum(const Frustum &frustum, const glm::vec3 &center, float radius);
+
+void bounds_resize(SphereBounds &bounds, int count);
+void bounds_set(SphereBounds &bounds, int i, const glm::vec3 &center, float radius);
+
+// 1 when the CPU runs the AVX2 path, 0 when culling uses the scalar code
+int culling_has_avx2();
+
+// Set visible[i] to 1 for every sphere in [begin, end) touching the frustum,
+// 0 otherwise. Returns how many are visible. use_simd = false forces the
+// scalar code, for comparison.
+int cull_spheres(const Frustum &frustum, const SphereBounds &bounds, uint8_t* visible,
+  int begin, int end, bool use_simd = true);
+
+// the same over all spheres, split across parallel_for threads
+int cull_spheres_parallel(const Frustum &frustum, const SphereBounds &bounds, uint8_t* visible);
+
+// Cull count random spheres (1M by default) with each code path, printing
+// the time and the visible count. Needs no GL context.
+void culling_benchmark(int count);
+
+#endif
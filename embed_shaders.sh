@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# Validate GLSL sources and print a C++ header embedding them.
+# usage: ./embed_shaders.sh cube.v.glsl cube.f.glsl > embedded_shaders.h
+# Without glslangValidator this fails, SKIP_SHADER_VALIDATION=1 embeds the
+# sources unchecked.
+
+set -e
+
+# each source is checked against every header create_shader can prepend,
+# keep these in sync with shader_utils.cpp
+GLSL120='#version 120\n'
+GLSL140='#version 140\n#define HAVE_UBO\n'
+GLSL430='#version 430 compatibility\n#define HAVE_UBO\n#define HAVE_SSBO\n'
+VERT_KEYWORDS='#define attribute in\n#define varying out\n'
+FRAG_KEYWORDS='#define varying in\n#define texture2D texture\n'
+
+validate()
+{
+  local file=$1 stage=$2 header=$3 log
+  if ! log=$(printf "$header" | cat - "$file" | glslangValidator --stdin -S $stage); then
+    echo "$file: $(printf "$header" | head -n 1)" >&2
+    echo "$log" >&2
+    return 1
+  fi
+}
+
+if command -v glslangValidator > /dev/null; then
+  for file in "$@"; do
+    case $file in
+      *.v.glsl) stage=vert; keywords=$VERT_KEYWORDS ;;
+      *.f.glsl) stage=frag; keywords=$FRAG_KEYWORDS ;;
+      *) echo "$file: cannot tell the shader stage from the name" >&2; exit 1 ;;
+    esac
+    validate $file $stage "$GLSL120" || exit 1
+    validate $file $stage "$GLSL140$keywords" || exit 1
+    validate $file $stage "$GLSL430$keywords" || exit 1
+    if [ $stage = vert ]; then
+      validate $file $stage "$GLSL120#define INSTANCED\n" || exit 1
+    fi
+  done
+elif [ "$SKIP_SHADER_VALIDATION" = 1 ]; then
+  echo "embed_shaders.sh: SKIP_SHADER_VALIDATION=1, shaders are not validated" >&2
+else
+  echo "embed_shaders.sh: glslangValidator not found, install it or set SKIP_SHADER_VALIDATION=1" >&2
+  exit 1
+fi
+
+echo "// generated by embed_shaders.sh from $*, do not edit"
+echo "#include \"shader_utils.h\""
+echo
+echo "static constexpr EmbeddedShader embedded_shaders[] ="
+echo "{"
+for file in "$@"; do
+  # $(cat) drops trailing newlines, the x keeps them so the bytes and hash match the file's
+  source=$(cat "$file"; printf x)
+  printf '  { "%s", R"glsl(%s)glsl" },\n' "$(basename "$file")" "${source%x}"
+done
+echo "};"
@@ -0,0 +1,347 @@
+#include "entities.h"
+#include "parallel.h"
+#include "gl_common.h"
+#include "gl_state.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// rows per parallel_for chunk, big enough that the chunk overhead disappears
+static const int GRAIN = 4096;
+
+void entities_init(EntityWorld &world)
+{
+  world.archetypes.clear();
+  world.entity_archetype.clear();
+  world.entity_row.clear();
+  world.free_ids.clear();
+  world.materials.clear();
+}
+
+int entities_add_material(EntityWorld &world, GLuint program, GLuint texture_id,
+  GLint uniform_texture, GLint uniform_mvp, bool transparent)
+{
+  Material material;
+  material.program = program;
+  material.texture_id = texture_id;
+  material.uniform_texture = uniform_texture;
+  material.uniform_mvp = uniform_mvp;
+  material.transparent = transparent;
+  world.materials.push_back(material);
+  return world.materials.size() - 1;
+}
+
+static int find_archetype(EntityWorld &world, unsigned components)
+{
+  for (size_t i = 0; i < world.archetypes.size(); i++)
+    if (world.archetypes[i].components == components)
+      return i;
+
+  Archetype archetype;
+  archetype.components = components;
+  archetype.count = 0;
+  bounds_resize(archetype.bounds, 0);
+  world.archetypes.push_back(archetype);
+  return world.archetypes.size() - 1;
+}
+
+int entity_create(EntityWorld &world, unsigned components)
+{
+  int entity;
+  if (!world.free_ids.empty())
+  {
+    entity = world.free_ids.back();
+    world.free_ids.pop_back();
+  }
+  else
+  {
+    entity = world.entity_archetype.size();
+    world.entity_archetype.push_back(-1);
+    world.entity_row.push_back(-1);
+  }
+
+  int index = find_archetype(world, components);
+  Archetype &archetype = world.archetypes[index];
+  int row = archetype.count++;
+  archetype.entities.push_back(entity);
+  archetype.visible.push_back(1);
+  if (components & COMPONENT_TRANSFORM)
+    archetype.transforms.push_back(glm::mat4(1.0f));
+  if (components & COMPONENT_MESH)
+    archetype.meshes.push_back(-1);
+  if (components & COMPONENT_MATERIAL)
+    archetype.materials.push_back(-1);
+  if (components & COMPONENT_BOUNDS)
+  {
+    bounds_resize(archetype.bounds, archetype.count);
+    bounds_set(archetype.bounds, row, glm::vec3(0.0f), 0.0f);
+  }
+  if (components & COMPONENT_SPIN)
+    archetype.spins.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
+
+  world.entity_archetype[entity] = index;
+  world.entity_row[entity] = row;
+  return entity;
+}
+
+void entity_destroy(EntityWorld &world, int entity)
+{
+  Archetype &archetype = world.archetypes[world.entity_archetype[entity]];
+  int row = world.entity_row[entity];
+  int last = archetype.count - 1;
+  unsigned components = archetype.components;
+
+  // swap-remove, so the arrays stay packed
+  archetype.entities[row] = archetype.entities[last];
+  archetype.visible[row] = archetype.visible[last];
+  if (components & COMPONENT_TRANSFORM)
+    archetype.transforms[row] = archetype.transforms[last];
+  if (components & COMPONENT_MESH)
+    archetype.meshes[row] = archetype.meshes[last];
+  if (components & COMPONENT_MATERIAL)
+    archetype.materials[row] = archetype.materials[last];
+  if (components & COMPONENT_BOUNDS)
+    bounds_set(archetype.bounds, row, glm::vec3(archetype.bounds.x[last], archetype.bounds.y[last],
+      archetype.bounds.z[last]), archetype.bounds.radius[last]);
+  if (components & COMPONENT_SPIN)
+    archetype.spins[row] = archetype.spins[last];
+  world.entity_row[archetype.entities[row]] = row;
+
+  archetype.count--;
+  archetype.entities.pop_back();
+  archetype.visible.pop_back();
+  if (components & COMPONENT_TRANSFORM)
+    archetype.transforms.pop_back();
+  if (components & COMPONENT_MESH)
+    archetype.meshes.pop_back();
+  if (components & COMPONENT_MATERIAL)
+    archetype.materials.pop_back();
+  if (components & COMPONENT_BOUNDS)
+    bounds_resize(archetype.bounds, archetype.count);
+  if (components & COMPONENT_SPIN)
+    archetype.spins.pop_back();
+
+  world.entity_archetype[entity] = -1;
+  world.entity_row[entity] = -1;
+  world.free_ids.push_back(entity);
+}
+
+glm::mat4 &entity_transform(EntityWorld &world, int entity)
+{
+  return world.archetypes[world.entity_archetype[entity]].transforms[world.entity_row[entity]];
+}
+
+void entity_set_mesh(EntityWorld &world, int entity, int mesh)
+{
+  world.archetypes[world.entity_archetype[entity]].meshes[world.entity_row[entity]] = mesh;
+}
+
+void entity_set_material(EntityWorld &world, int entity, int material)
+{
+  world.archetypes[world.entity_archetype[entity]].materials[world.entity_row[entity]] = material;
+}
+
+void entity_set_radius(EntityWorld &world, int entity, float radius)
+{
+  world.archetypes[world.entity_archetype[entity]].bounds.radius[world.entity_row[entity]] = radius;
+}
+
+void entity_set_spin(EntityWorld &world, int entity, const glm::vec3 &axis, float radians_per_second)
+{
+  world.archetypes[world.entity_archetype[entity]].spins[world.entity_row[entity]] = glm::vec4(axis, radians_per_second);
+}
+
+bool entity_visible(const EntityWorld &world, int entity)
+{
+  return world.archetypes[world.entity_archetype[entity]].visible[world.entity_row[entity]];
+}
+
+// ----- SYSTEMS -----
+
+static bool has(const Archetype &archetype, unsigned components)
+{
+  return (archetype.components & components) == components && archetype.count > 0;
+}
+
+void entities_animate(EntityWorld &world, float seconds)
+{
+  for (size_t a = 0; a < world.archetypes.size(); a++)
+  {
+    Archetype &archetype = world.archetypes[a];
+    if (!has(archetype, COMPONENT_TRANSFORM | COMPONENT_SPIN)) continue;
+    parallel_for(archetype.count, GRAIN, [&](int begin, int end) {
+      for (int i = begin; i < end; i++)
+      {
+        const glm::vec4 &spin = archetype.spins[i];
+        archetype.transforms[i] = glm::rotate(archetype.transforms[i], spin.w * seconds, glm::vec3(spin));
+      }
+    });
+  }
+}
+
+void entities_update_bounds(EntityWorld &world)
+{
+  for (size_t a = 0; a < world.archetypes.size(); a++)
+  {
+    Archetype &archetype = world.archetypes[a];
+    if (!has(archetype, COMPONENT_TRANSFORM | COMPONENT_BOUNDS)) continue;
+    parallel_for(archetype.count, GRAIN, [&](int begin, int end) {
+      for (int i = begin; i < end; i++)
+      {
+        const glm::vec4 &origin = archetype.transforms[i][3];
+        archetype.bounds.x[i] = origin.x;
+        archetype.bounds.y[i] = origin.y;
+        archetype.bounds.z[i] = origin.z;
+      }
+    });
+  }
+}
+
+int entities_cull(EntityWorld &world, const Frustum &frustum)
+{
+  int visible = 0;
+  for (size_t a = 0; a < world.archetypes.size(); a++)
+  {
+    Archetype &archetype = world.archetypes[a];
+    if (!has(archetype, COMPONENT_BOUNDS)) continue;
+    visible += cull_spheres_parallel(frustum, archetype.bounds, &archetype.visible[0]);
+  }
+  return visible;
+}
+
+int entities_draw_batch(EntityWorld &world, Batch &batch)
+{
+  int draws = 0;
+  for (size_t a = 0; a < world.archetypes.size(); a++)
+  {
+    Archetype &archetype = world.archetypes[a];
+    if (!has(archetype, COMPONENT_TRANSFORM | COMPONENT_MESH)) continue;
+
+    // count the visible rows of every chunk, then each chunk writes its own range
+    int chunks = (archetype.count + GRAIN - 1) / GRAIN;
+    vector<int> first(chunks + 1, 0);
+    parallel_for(archetype.count, GRAIN, [&](int begin, int end) {
+      int visible = 0;
+      for (int i = begin; i < end; i++)
+        visible += archetype.visible[i];
+      first[begin / GRAIN + 1] = visible;
+    });
+    for (int chunk = 0; chunk < chunks; chunk++)
+      first[chunk + 1] += first[chunk];
+
+    int base = batch_reserve(batch, first[chunks]);
+    if (base < 0) return -1;
+    parallel_for(archetype.count, GRAIN, [&](int begin, int end) {
+      int draw = base + first[begin / GRAIN];
+      for (int i = begin; i < end; i++)
+        if (archetype.visible[i])
+          batch_write(batch, draw++, archetype.meshes[i], archetype.transforms[i]);
+    });
+    draws += first[chunks];
+  }
+  return draws;
+}
+
+// ----- BENCHMARK -----
+
+void entities_benchmark(int count, GLuint texture_id, AssetManager &assets)
+{
+  if (!batch_supported())
+  {
+    cerr << "Error: the entity benchmark draws through a batch, which needs OpenGL 3.2" << endl;
+    return;
+  }
+  const int FRAMES = 60;
+
+  vector<Vertex> cube_vertices, suzanne_vertices;
+  vector<GLushort> cube_elements;
+  cube_geometry(cube_vertices, cube_elements);
+  AssetHandle suzanne = assets_acquire_obj(assets, "suzanne.obj");
+  if (suzanne < 0) return;
+  obj_geometry(assets_get(assets, suzanne).vertices, suzanne_vertices);
+  vector<GLushort> suzanne_elements = assets_get(assets, suzanne).elements;
+  assets_release(assets, suzanne);
+
+  Batch batch;
+  if (!batch_init(batch, batch_multi_draw_supported(), count)) return;
+  int mesh_ids[2];
+  mesh_ids[0] = batch_add_mesh(batch, cube_vertices, cube_elements);
+  mesh_ids[1] = batch_add_mesh(batch, suzanne_vertices, suzanne_elements);
+  batch_upload(batch);
+
+  // every other entity spins, so there are two archetypes
+  EntityWorld world;
+  entities_init(world);
+  int material = entities_add_material(world, batch.program, texture_id);
+  unsigned components = COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_MATERIAL | COMPONENT_BOUNDS;
+  int side = (int)ceil(sqrt((double)count));
+  float extent = 3.0f * side;
+  for (int n = 0; n < count; n++)
+  {
+    int entity = entity_create(world, n % 2 ? components | COMPONENT_SPIN : components);
+    glm::vec3 position(3.0f * (n % side - side / 2), 0.0f, 3.0f * (n / side - side / 2));
+    entity_transform(world, entity) = glm::translate(glm::mat4(1.0f), position);
+    entity_set_mesh(world, entity, mesh_ids[n % 2]);
+    entity_set_material(world, entity, material);
+    entity_set_radius(world, entity, 1.75f);
+    if (n % 2)
+      entity_set_spin(world, entity, glm::vec3(0.0, 1.0, 0.0), 3.0f);
+  }
+
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0, extent * 0.25f, extent * 0.5f), glm::vec3(0.0, 0.0, 0.0),
+    glm::vec3(0.0, 1.0, 0.0));
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 2.0f * extent);
+  Frustum frustum;
+  frustum_from_matrix(projection * view, frustum);
+
+  gl_state_enable(GL_DEPTH_TEST, true);
+  double animate_seconds = 0.0, bounds_seconds = 0.0, cull_seconds = 0.0, draw_seconds = 0.0;
+  long visible = 0;
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    gl_state_clear_color(1.0, 1.0, 1.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+
+    Clock::time_point start = Clock::now();
+    entities_animate(world, 1.0f / 60.0f);
+    animate_seconds += seconds_since(start);
+
+    start = Clock::now();
+    entities_update_bounds(world);
+    bounds_seconds += seconds_since(start);
+
+    start = Clock::now();
+    visible += entities_cull(world, frustum);
+    cull_seconds += seconds_since(start);
+
+    start = Clock::now();
+    batch_begin(batch);
+    entities_draw_batch(world, batch);
+    draw_seconds += seconds_since(start);
+
+    batch_submit(batch, projection * view, world.materials[material].texture_id);
+  }
+  glFinish();
+
+  printf("%d entities in %d archetypes, %d threads, %ld visible/frame\n", count,
+    (int)world.archetypes.size(), parallel_threads(), visible / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "animate", animate_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "bounds", bounds_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "cull", cull_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "draw list", draw_seconds * 1000.0 / FRAMES);
+  batch_free(batch);
+}
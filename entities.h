@@ -0,0 +1,92 @@
+#ifndef _ENTITIES_H
+#define _ENTITIES_H
+
+#include <stdint.h>
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "batch.h"
+#include "culling.h"
+
+// component bits, an entity's set of them is its archetype
+enum
+{
+  COMPONENT_TRANSFORM = 1,
+  COMPONENT_MESH = 2,      // a handle into the caller's meshes, a Mesh or a batch mesh id
+  COMPONENT_MATERIAL = 4,  // an index in EntityWorld::materials
+  COMPONENT_BOUNDS = 8,    // a sphere around the transform's origin
+  COMPONENT_SPIN = 16,     // constant rotation, for the animation system
+};
+
+struct Material
+{
+  GLuint program;
+  GLuint texture_id;
+  GLint uniform_texture, uniform_mvp;  // locations in program, -1 for none
+  bool transparent;  // blended back to front after the opaque draws
+};
+
+// All entities with the same components, each component packed in its own
+// array indexed by row. Arrays of components the archetype lacks stay empty.
+struct Archetype
+{
+  unsigned components;
+  int count;
+  std::vector<int> entities;        // entity id per row
+  std::vector<glm::mat4> transforms;
+  std::vector<int> meshes;
+  std::vector<int> materials;
+  SphereBounds bounds;              // world space, centers follow the transforms
+  std::vector<glm::vec4> spins;     // axis, radians per second
+  std::vector<uint8_t> visible;     // set by entities_cull, always 1 without bounds
+};
+
+struct EntityWorld
+{
+  std::vector<Archetype> archetypes;
+  // per entity id, archetype -1 for destroyed ids waiting in free_ids
+  std::vector<int> entity_archetype, entity_row;
+  std::vector<int> free_ids;
+  std::vector<Material> materials;
+};
+
+void entities_init(EntityWorld &world);
+int entities_add_material(EntityWorld &world, GLuint program, GLuint texture_id,
+  GLint uniform_texture = -1, GLint uniform_mvp = -1, bool transparent = false);
+
+// returns the entity id; the components start as identity, -1 handles,
+// radius 0 and no spin
+int entity_create(EntityWorld &world, unsigned components);
+// the last entity of the archetype moves into the freed row
+void entity_destroy(EntityWorld &world, int entity);
+
+// the entity must have the component
+glm::mat4 &entity_transform(EntityWorld &world, int entity);
+void entity_set_mesh(EntityWorld &world, int entity, int mesh);
+void entity_set_material(EntityWorld &world, int entity, int material);
+void entity_set_radius(EntityWorld &world, int entity, float radius);
+void entity_set_spin(EntityWorld &world, int entity, const glm::vec3 &axis, float radians_per_second);
+bool entity_visible(const EntityWorld &world, int entity);
+
+// ----- SYSTEMS -----
+// each walks the matching archetypes linearly, in parallel_for chunks
+
+// rotate every spinning transform by its spin over seconds
+void entities_animate(EntityWorld &world, float seconds);
+// move the bounding spheres to their transforms
+void entities_update_bounds(EntityWorld &world);
+// set the visible flags, returns how many entities with bounds are visible
+int entities_cull(EntityWorld &world, const Frustum &frustum);
+// Record a draw per visible entity with a transform and a mesh, the mesh
+// being a batch mesh id. Returns the draws, or -1 when the batch is full.
+int entities_draw_batch(EntityWorld &world, Batch &batch);
+
+// Animate, cull and draw count entities through a batch, printing the
+// time of every system per frame.
+void entities_benchmark(int count, GLuint texture_id, AssetManager &assets);
+
+#endif
@@ -0,0 +1,146 @@
+#include "frame_scheduler.h"
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <chrono>
+
+using namespace std;
+
+// the simulation never catches up more than this at once, after a stall
+static const double MAX_FRAME_TIME = 0.25;
+// timers have millisecond resolution, a frame this close to its time is due
+static const double DUE_TIME = 0.0005;
+
+double scheduler_now()
+{
+  static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+    + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// package energy in microjoules, -1 when RAPL is missing or not readable
+static long long package_energy()
+{
+  FILE* file = fopen("/sys/class/powercap/intel-rapl:0/energy_uj", "r");
+  if (NULL == file) return -1;
+  long long energy = -1;
+  if (1 != fscanf(file, "%lld", &energy))
+    energy = -1;
+  fclose(file);
+  return energy;
+}
+
+void scheduler_init(FrameScheduler &scheduler, double step, double max_fps, bool on_demand)
+{
+  scheduler.step = step;
+  scheduler.min_frame = max_fps > 0.0 ? 1.0 / max_fps : 0.0;
+  scheduler.on_demand = on_demand;
+  scheduler.animating = true;
+  scheduler.redraw = true;
+  scheduler.scheduled = false;
+  scheduler.last_time = scheduler.next_frame = scheduler_now();
+  scheduler.accumulator = 0.0;
+
+  scheduler.frames = scheduler.steps = 0;
+  scheduler.stats_time = scheduler.last_time;
+  scheduler.stats_cpu = cpu_seconds();
+  scheduler.stats_energy = package_energy();
+}
+
+void scheduler_set_animating(FrameScheduler &scheduler, bool animating)
+{
+  // resuming must not replay the paused time
+  if (animating && !scheduler.animating)
+    scheduler.last_time = scheduler_now();
+  scheduler.animating = animating;
+  scheduler.redraw = true;
+}
+
+void scheduler_request_redraw(FrameScheduler &scheduler)
+{
+  scheduler.redraw = true;
+}
+
+int scheduler_begin_frame(FrameScheduler &scheduler)
+{
+  double now = scheduler_now();
+  double elapsed = now - scheduler.last_time;
+  scheduler.last_time = now;
+  scheduler.redraw = false;
+  if (!scheduler.animating)
+    return 0;
+
+  scheduler.accumulator += elapsed < MAX_FRAME_TIME ? elapsed : MAX_FRAME_TIME;
+  int steps = (int)(scheduler.accumulator / scheduler.step);
+  scheduler.accumulator -= steps * scheduler.step;
+  scheduler.steps += steps;
+  return steps;
+}
+
+float scheduler_alpha(const FrameScheduler &scheduler)
+{
+  return (float)(scheduler.accumulator / scheduler.step);
+}
+
+int scheduler_end_frame(FrameScheduler &scheduler, int &sleep_ms)
+{
+  scheduler.frames++;
+  sleep_ms = 0;
+  if (scheduler.scheduled)
+    return 0;
+  // a request made while drawing still gets its frame
+  if (scheduler.on_demand && !scheduler.animating && !scheduler.redraw)
+    return 0;
+
+  // keep the cadence, unless the frame ran late
+  double now = scheduler_now();
+  scheduler.next_frame += scheduler.min_frame;
+  if (scheduler.next_frame < now)
+    scheduler.next_frame = now;
+
+  // timers only have millisecond resolution, scheduler_frame_due checks the rest
+  sleep_ms = (int)((scheduler.next_frame - now) * 1000.0);
+  scheduler.scheduled = true;
+  return 1;
+}
+
+int scheduler_frame_due(FrameScheduler &scheduler, int &sleep_ms)
+{
+  double remaining = scheduler.next_frame - scheduler_now();
+  if (remaining > DUE_TIME)
+  {
+    // rounded to the nearest millisecond, timers firing early come back here
+    sleep_ms = (int)(remaining * 1000.0 + 0.5);
+    return 0;
+  }
+  sleep_ms = 0;
+  scheduler.scheduled = false;
+  return 1;
+}
+
+void scheduler_print_stats(FrameScheduler &scheduler)
+{
+  double now = scheduler_now(), cpu = cpu_seconds();
+  long long energy = package_energy();
+  double seconds = now - scheduler.stats_time;
+  if (seconds <= 0.0) return;
+
+  printf("%6.1f fps %6.1f steps/s %6.1f%% CPU", scheduler.frames / seconds, scheduler.steps / seconds,
+    100.0 * (cpu - scheduler.stats_cpu) / seconds);
+  // the counter wraps, a negative difference is dropped
+  if (energy >= 0 && scheduler.stats_energy >= 0 && energy >= scheduler.stats_energy)
+    printf(" %8.2f W package", (energy - scheduler.stats_energy) / 1e6 / seconds);
+  printf("\n");
+
+  scheduler.frames = scheduler.steps = 0;
+  scheduler.stats_time = now;
+  scheduler.stats_cpu = cpu;
+  scheduler.stats_energy = energy;
+}
@@ -0,0 +1,50 @@
+#ifndef _FRAME_SCHEDULER_H
+#define _FRAME_SCHEDULER_H
+
+// Decides when frames are drawn. The simulation advances in fixed steps
+// and drawing interpolates between the last two; frames are capped to a
+// maximum rate, sleeping in between instead of spinning, and in on-demand
+// mode nothing is drawn unless input asked for it or animation is running.
+struct FrameScheduler
+{
+  double step;        // simulation step in seconds
+  double min_frame;   // seconds between frames from the FPS cap, 0 when uncapped
+  bool on_demand;
+  bool animating;
+  bool redraw;        // a frame was asked for since the last one began
+  bool scheduled;     // the next frame's timer is pending
+  double last_time, accumulator, next_frame;
+
+  // for scheduler_print_stats, since its last call
+  int frames, steps;
+  double stats_time, stats_cpu;
+  long long stats_energy;
+};
+
+// seconds on a monotonic high-resolution clock
+double scheduler_now();
+
+// max_fps 0 leaves the frame rate to the swap interval
+void scheduler_init(FrameScheduler &scheduler, double step, double max_fps, bool on_demand);
+void scheduler_set_animating(FrameScheduler &scheduler, bool animating);
+void scheduler_request_redraw(FrameScheduler &scheduler);
+
+// call at the start of a frame, returns the fixed steps to simulate
+int scheduler_begin_frame(FrameScheduler &scheduler);
+// how far to interpolate from the previous simulation step to the last one
+float scheduler_alpha(const FrameScheduler &scheduler);
+
+// Call once the frame is submitted. Returns 1 when another frame is due,
+// with the milliseconds to wait before calling scheduler_frame_due; 0 when
+// nothing needs drawing until the next scheduler_request_redraw.
+int scheduler_end_frame(FrameScheduler &scheduler, int &sleep_ms);
+// Returns 1 when the scheduled frame's time has come, within half a
+// millisecond. Otherwise 0 with the milliseconds left, to wait in the
+// event loop with another timer; it never blocks.
+int scheduler_frame_due(FrameScheduler &scheduler, int &sleep_ms);
+
+// frames, simulation steps, CPU use of the process and, when the kernel
+// exposes RAPL counters, package power since the last call
+void scheduler_print_stats(FrameScheduler &scheduler);
+
+#endif
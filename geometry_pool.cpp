@@ -0,0 +1,514 @@
+#include "geometry_pool.h"
+#include "gl_common.h"
+#include "shader_utils.h"
+#include "program_info.h"
+#include "gl_state.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// ----- RANGES -----
+
+static void range_add_free(RangeAllocator &ranges, GLuint offset, GLuint size)
+{
+  ranges.by_offset[offset] = size;
+  ranges.by_size.insert(make_pair(size, offset));
+}
+
+static void range_init(RangeAllocator &ranges, GLuint capacity)
+{
+  ranges.capacity = capacity;
+  ranges.by_offset.clear();
+  ranges.by_size.clear();
+  range_add_free(ranges, 0, capacity);
+}
+
+// the smallest free range of at least size, returns 0 when none is
+static int range_alloc(RangeAllocator &ranges, GLuint size, GLuint &offset)
+{
+  set<pair<GLuint, GLuint> >::iterator fit = ranges.by_size.lower_bound(make_pair(size, 0u));
+  if (fit == ranges.by_size.end())
+    return 0;
+  GLuint free_size = fit->first;
+  offset = fit->second;
+  ranges.by_size.erase(fit);
+  ranges.by_offset.erase(offset);
+  if (free_size > size)
+    range_add_free(ranges, offset + size, free_size - size);
+  return 1;
+}
+
+static void range_release(RangeAllocator &ranges, GLuint offset, GLuint size)
+{
+  map<GLuint, GLuint>::iterator next = ranges.by_offset.lower_bound(offset);
+  if (next != ranges.by_offset.begin())
+  {
+    map<GLuint, GLuint>::iterator previous = prev(next);
+    if (previous->first + previous->second == offset)
+    {
+      offset = previous->first;
+      size += previous->second;
+      ranges.by_size.erase(make_pair(previous->second, previous->first));
+      next = ranges.by_offset.erase(previous);
+    }
+  }
+  if (next != ranges.by_offset.end() && next->first == offset + size)
+  {
+    size += next->second;
+    ranges.by_size.erase(make_pair(next->second, next->first));
+    ranges.by_offset.erase(next);
+  }
+  range_add_free(ranges, offset, size);
+}
+
+// the gaps between the used ranges, which are sorted by offset
+static void range_rebuild(RangeAllocator &ranges, const vector<pair<GLuint, GLuint> > &used)
+{
+  ranges.by_offset.clear();
+  ranges.by_size.clear();
+  GLuint end = 0;
+  for (size_t i = 0; i < used.size(); i++)
+  {
+    if (used[i].first > end)
+      range_add_free(ranges, end, used[i].first - end);
+    end = used[i].first + used[i].second;
+  }
+  if (ranges.capacity > end)
+    range_add_free(ranges, end, ranges.capacity - end);
+}
+
+// ----- POOL -----
+
+int geometry_pool_supported()
+{
+  return GLEW_VERSION_3_2 ? 1 : 0;
+}
+
+int geometry_pool_init(GeometryPool &pool, GLuint max_vertices, GLuint max_indices,
+  GLuint coord_location, GLuint texcoord_location)
+{
+  pool.vao = pool.vbo = pool.ibo = pool.copy_buffer = 0;
+  if (0 == max_vertices || 0 == max_indices)
+  {
+    cerr << "geometry_pool_init: room for " << max_vertices << " vertices and "
+      << max_indices << " indices" << endl;
+    return 0;
+  }
+
+  glGenVertexArrays(1, &pool.vao);
+  gl_state_bind_vertex_array(pool.vao);
+
+  glGenBuffers(1, &pool.vbo);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, pool.vbo);
+  glBufferData(GL_ARRAY_BUFFER, max_vertices * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(coord_location);
+  glVertexAttribPointer(coord_location, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    (const GLvoid*)offsetof(Vertex, position));
+  glEnableVertexAttribArray(texcoord_location);
+  glVertexAttribPointer(texcoord_location, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    (const GLvoid*)offsetof(Vertex, texcoord));
+
+  glGenBuffers(1, &pool.ibo);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, pool.ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, max_indices * sizeof(GLushort), NULL, GL_STATIC_DRAW);
+
+  // unbind the VAO first, otherwise it would forget its index buffer
+  gl_state_bind_vertex_array(0);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &pool.copy_buffer);
+  pool.copy_size = 0;
+  range_init(pool.vertices, max_vertices);
+  range_init(pool.indices, max_indices);
+  pool.meshes.clear();
+  pool.free_ids.clear();
+  pool.live_count = 0;
+  pool.moves = 0;
+  return 1;
+}
+
+void geometry_pool_free(GeometryPool &pool, GpuResources* resources)
+{
+  gpu_delete(resources, GPU_VERTEX_ARRAY, pool.vao);
+  gpu_delete(resources, GPU_BUFFER, pool.vbo);
+  gpu_delete(resources, GPU_BUFFER, pool.ibo);
+  gpu_delete(resources, GPU_BUFFER, pool.copy_buffer);
+  if (NULL == resources)
+    gl_state_invalidate();
+  pool.vao = pool.vbo = pool.ibo = pool.copy_buffer = 0;
+  pool.meshes.clear();
+  pool.free_ids.clear();
+  pool.live_count = 0;
+}
+
+int geometry_pool_add(GeometryPool &pool, const vector<Vertex> &vertices, const vector<GLushort> &elements)
+{
+  if (vertices.empty() || elements.empty())
+  {
+    cerr << "geometry_pool_add: empty mesh" << endl;
+    return -1;
+  }
+
+  GeometryRange range;
+  range.live = true;
+  range.vertex_count = vertices.size();
+  range.index_count = elements.size();
+  if (!range_alloc(pool.vertices, range.vertex_count, range.first_vertex))
+    return -1;
+  if (!range_alloc(pool.indices, range.index_count, range.first_index))
+  {
+    range_release(pool.vertices, range.first_vertex, range.vertex_count);
+    return -1;
+  }
+
+  // through the copy target, the VAO's element buffer binding stays as it is
+  glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vbo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, range.first_vertex * sizeof(Vertex),
+    range.vertex_count * sizeof(Vertex), &vertices[0]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, pool.ibo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, range.first_index * sizeof(GLushort),
+    range.index_count * sizeof(GLushort), &elements[0]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  int id;
+  if (pool.free_ids.empty())
+  {
+    id = pool.meshes.size();
+    pool.meshes.push_back(range);
+  }
+  else
+  {
+    id = pool.free_ids.back();
+    pool.free_ids.pop_back();
+    pool.meshes[id] = range;
+  }
+  pool.live_count++;
+  return id;
+}
+
+void geometry_pool_remove(GeometryPool &pool, int id)
+{
+  if (id < 0 || id >= (int)pool.meshes.size() || !pool.meshes[id].live)
+  {
+    cerr << "geometry_pool_remove: no mesh " << id << endl;
+    return;
+  }
+  GeometryRange &range = pool.meshes[id];
+  range_release(pool.vertices, range.first_vertex, range.vertex_count);
+  range_release(pool.indices, range.first_index, range.index_count);
+  range.live = false;
+  pool.free_ids.push_back(id);
+  pool.live_count--;
+}
+
+void geometry_pool_bind(const GeometryPool &pool)
+{
+  gl_state_bind_vertex_array(pool.vao);
+}
+
+void geometry_pool_draw(const GeometryPool &pool, int id)
+{
+  const GeometryRange &range = pool.meshes[id];
+  glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_SHORT,
+    (const GLvoid*)(range.first_index * sizeof(GLushort)), range.first_vertex);
+}
+
+// Copy size bytes of buffer from source down to destination. Overlapping
+// ranges of the same buffer are an error for glCopyBufferSubData, those go
+// through the copy buffer.
+static void move_bytes(GeometryPool &pool, GLuint buffer, GLintptr source, GLintptr destination, GLsizeiptr size)
+{
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  if (destination + size <= source)
+  {
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER, source, destination, size);
+    return;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, pool.copy_buffer);
+  if (pool.copy_size < size)
+  {
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_COPY);
+    pool.copy_size = size;
+  }
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, 0, size);
+  glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, destination, size);
+}
+
+// one buffer's live ranges, in offset order, moved down over the holes
+static int compact(GeometryPool &pool, RangeAllocator &ranges, GLuint buffer, GLsizeiptr element_size,
+  GLuint GeometryRange::*first, GLuint GeometryRange::*count, int max_moves)
+{
+  vector<pair<GLuint, int> > order;
+  order.reserve(pool.live_count);
+  for (size_t id = 0; id < pool.meshes.size(); id++)
+    if (pool.meshes[id].live)
+      order.push_back(make_pair(pool.meshes[id].*first, (int)id));
+  sort(order.begin(), order.end());
+
+  vector<pair<GLuint, GLuint> > used;
+  used.reserve(order.size());
+  GLuint end = 0;
+  int moves = 0;
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    GeometryRange &range = pool.meshes[order[i].second];
+    if (range.*first > end && moves < max_moves)
+    {
+      move_bytes(pool, buffer, range.*first * element_size, end * element_size, range.*count * element_size);
+      range.*first = end;
+      moves++;
+    }
+    used.push_back(make_pair(range.*first, range.*count));
+    end = range.*first + range.*count;
+  }
+  range_rebuild(ranges, used);
+  return moves;
+}
+
+int geometry_pool_defragment(GeometryPool &pool, int max_moves)
+{
+  int moves = compact(pool, pool.vertices, pool.vbo, sizeof(Vertex),
+    &GeometryRange::first_vertex, &GeometryRange::vertex_count, max_moves);
+  moves += compact(pool, pool.indices, pool.ibo, sizeof(GLushort),
+    &GeometryRange::first_index, &GeometryRange::index_count, max_moves - moves);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  pool.moves += moves;
+  return moves;
+}
+
+// a free range that is not the buffer's tail
+static bool has_holes(const RangeAllocator &ranges)
+{
+  if (ranges.by_offset.size() != 1)
+    return ranges.by_offset.size() > 1;
+  map<GLuint, GLuint>::const_iterator only = ranges.by_offset.begin();
+  return only->first + only->second < ranges.capacity;
+}
+
+bool geometry_pool_fragmented(const GeometryPool &pool)
+{
+  return has_holes(pool.vertices) || has_holes(pool.indices);
+}
+
+int geometry_pool_defragment_for(GeometryPool &pool, double seconds)
+{
+  // each call sorts the live ranges, so moves go in batches
+  const int BATCH_MOVES = 16;
+  Clock::time_point start = Clock::now();
+  int moves = 0;
+  while (geometry_pool_fragmented(pool) && seconds_since(start) < seconds)
+  {
+    int moved = geometry_pool_defragment(pool, BATCH_MOVES);
+    if (0 == moved) break;
+    moves += moved;
+  }
+  return moves;
+}
+
+static void print_ranges(const RangeAllocator &ranges, const char* name)
+{
+  GLuint free_total = 0;
+  for (map<GLuint, GLuint>::const_iterator it = ranges.by_offset.begin(); it != ranges.by_offset.end(); ++it)
+    free_total += it->second;
+  GLuint largest = ranges.by_size.empty() ? 0 : ranges.by_size.rbegin()->first;
+  printf("    %-9s %10u/%-10u used %8zu holes, the largest %5.1f%% of the free space\n", name,
+    ranges.capacity - free_total, ranges.capacity, ranges.by_offset.size(),
+    free_total > 0 ? 100.0 * largest / free_total : 100.0);
+}
+
+void geometry_pool_print_stats(const GeometryPool &pool, const char* name)
+{
+  printf("%s: %d meshes, %ld ranges moved\n", name, pool.live_count, pool.moves);
+  print_ranges(pool.vertices, "vertices");
+  print_ranges(pool.indices, "indices");
+}
+
+// ----- BENCHMARK -----
+
+enum { POOL_COORD3D, POOL_TEXCOORD, POOL_ATTRIBUTE_COUNT };
+
+static GLuint create_pool_program(ProgramInfo &info)
+{
+  const char* const attribute_names[] = { "coord3d", "texcoord" };
+
+  GLuint vs = create_shader("cube.v.glsl", GL_VERTEX_SHADER, 120);
+  if (0 == vs) return 0;
+  GLuint fs = create_shader("cube.f.glsl", GL_FRAGMENT_SHADER, 120);
+  if (0 == fs) return 0;
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vs);
+  glAttachShader(program, fs);
+  program_bind_attributes(program, attribute_names, POOL_ATTRIBUTE_COUNT);
+  glLinkProgram(program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  if (!program_reflect(program, info))
+  {
+    cerr << "glLinkProgram:";
+    print_log(program);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+// add the mesh until it no longer fits, returns how many times it did
+static int add_until_full(GeometryPool &pool, const vector<Vertex> &vertices, const vector<GLushort> &elements)
+{
+  int added = 0;
+  while (geometry_pool_add(pool, vertices, elements) >= 0)
+    added++;
+  return added;
+}
+
+void geometry_pool_benchmark(int count, GLuint texture_id, AssetManager &assets)
+{
+  if (!geometry_pool_supported())
+  {
+    cerr << "Error: the geometry pool needs OpenGL 3.2" << endl;
+    return;
+  }
+
+  ProgramInfo info;
+  GLuint program = create_pool_program(info);
+  if (0 == program) return;
+  const ProgramVarName expected[] = {
+    { "mvp", VAR_UNIFORM },
+    { "mytexture", VAR_UNIFORM },
+  };
+  GLint uniforms[2];
+  if (!program_require(info, expected, 2, uniforms))
+  {
+    glDeleteProgram(program);
+    return;
+  }
+
+  vector<Vertex> cube_vertices, suzanne_vertices;
+  vector<GLushort> cube_elements;
+  cube_geometry(cube_vertices, cube_elements);
+  AssetHandle suzanne = assets_acquire_obj(assets, "suzanne.obj");
+  if (suzanne < 0)
+  {
+    glDeleteProgram(program);
+    return;
+  }
+  obj_geometry(assets_get(assets, suzanne).vertices, suzanne_vertices);
+  vector<GLushort> suzanne_elements = assets_get(assets, suzanne).elements;
+  assets_release(assets, suzanne);
+
+  // a grid of cubes seen from above
+  int side = (int)ceil(sqrt((double)count));
+  float extent = 3.0f * side;
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0, extent, extent), glm::vec3(0.0, 0.0, 0.0),
+    glm::vec3(0.0, 1.0, 0.0));
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 4.0f * extent);
+  vector<glm::mat4> mvps(count);
+  for (int n = 0; n < count; n++)
+  {
+    glm::vec3 position(3.0f * (n % side - side / 2), 0.0f, 3.0f * (n / side - side / 2));
+    mvps[n] = projection * view * glm::translate(glm::mat4(1.0f), position);
+  }
+
+  gl_state_enable(GL_DEPTH_TEST, true);
+  const int FRAMES = 60;
+  printf("%d cubes\n", count);
+  for (int pooled = 0; pooled < 2; pooled++)
+  {
+    vector<Mesh> meshes;
+    GeometryPool pool;
+    vector<int> ids(count);
+    if (pooled)
+    {
+      // room for twice the cubes, so half of it is free to churn
+      if (!geometry_pool_init(pool, 2 * count * cube_vertices.size(), 2 * count * cube_elements.size(),
+        POOL_COORD3D, POOL_TEXCOORD)) break;
+      for (int n = 0; n < count; n++)
+        ids[n] = geometry_pool_add(pool, cube_vertices, cube_elements);
+    }
+    else
+    {
+      meshes.resize(count);
+      int created = 0;
+      while (created < count && mesh_create_cube(meshes[created], POOL_COORD3D, POOL_TEXCOORD))
+        created++;
+      if (created < count)
+      {
+        for (int n = 0; n < created; n++)
+          mesh_free(meshes[n]);
+        break;
+      }
+    }
+
+    double frame_seconds = 0.0;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+      Clock::time_point start = Clock::now();
+      gl_state_clear_color(1.0, 1.0, 1.0, 1.0);
+      glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+      gl_state_use_program(program);
+      gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture_id);
+      gl_state_uniform_1i(uniforms[1], 0);
+      if (pooled)
+        geometry_pool_bind(pool);
+      for (int n = 0; n < count; n++)
+      {
+        gl_state_uniform_matrix_4fv(uniforms[0], glm::value_ptr(mvps[n]));
+        if (pooled)
+          geometry_pool_draw(pool, ids[n]);
+        else
+          mesh_draw(meshes[n]);
+      }
+      // wait for the GPU, so the frame time covers the actual rendering
+      glFinish();
+      frame_seconds += seconds_since(start);
+    }
+    printf("  %-20s %10.3f ms/frame\n", pooled ? "one pool" : "buffers per mesh",
+      frame_seconds * 1000.0 / FRAMES);
+
+    if (!pooled)
+    {
+      for (int n = 0; n < count; n++)
+        mesh_free(meshes[n]);
+      continue;
+    }
+
+    // holes the size of a cube, too small for anything larger
+    for (int n = 0; n < count; n += 2)
+      geometry_pool_remove(pool, ids[n]);
+    int added = add_until_full(pool, suzanne_vertices, suzanne_elements);
+    printf("  every other cube removed, %d suzannes fit\n", added);
+    geometry_pool_print_stats(pool, "  pool");
+
+    Clock::time_point start = Clock::now();
+    int moves = geometry_pool_defragment(pool, INT_MAX);
+    glFinish();
+    double defragment_seconds = seconds_since(start);
+    added = add_until_full(pool, suzanne_vertices, suzanne_elements);
+    printf("  defragmented in %.3f ms, %d ranges moved, %d more suzannes fit\n",
+      defragment_seconds * 1000.0, moves, added);
+    geometry_pool_print_stats(pool, "  pool");
+    geometry_pool_free(pool);
+  }
+  glDeleteProgram(program);
+  gl_state_invalidate();
+}
@@ -0,0 +1,87 @@
+#ifndef _GEOMETRY_POOL_H
+#define _GEOMETRY_POOL_H
+
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+
+#include "mesh.h"
+#include "assets.h"
+
+// Free ranges of a buffer, counted in vertices or indices. Allocation takes
+// the smallest free range that fits, through the ranges ordered by size;
+// released ranges merge with their free neighbours, through the ranges
+// ordered by offset.
+struct RangeAllocator
+{
+  GLuint capacity;
+  std::map<GLuint, GLuint> by_offset;             // offset -> size
+  std::set<std::pair<GLuint, GLuint> > by_size;   // (size, offset)
+};
+
+// where a mesh lives in the pool's buffers
+struct GeometryRange
+{
+  bool live;
+  GLuint first_vertex, vertex_count;
+  GLuint first_index, index_count;
+};
+
+// Many meshes sub-allocated out of one vertex and one index buffer of fixed
+// capacity, all of the same interleaved Vertex format. A single VAO covers
+// every mesh, so drawing any of them is glDrawElementsBaseVertex with its
+// offsets, and switching meshes binds nothing. Removing meshes leaves holes,
+// geometry_pool_defragment moves the live ranges down over them when idle.
+struct GeometryPool
+{
+  GLuint vao, vbo, ibo;
+  GLuint copy_buffer;   // staging for moves whose source and destination overlap
+  GLsizeiptr copy_size;
+  RangeAllocator vertices, indices;
+  std::vector<GeometryRange> meshes;  // by id, ids of removed meshes are reused
+  std::vector<int> free_ids;
+  int live_count;
+  long moves;  // ranges moved by defragmentation
+};
+
+// base vertex draws need GL 3.2, which also has glCopyBufferSubData
+int geometry_pool_supported();
+
+// returns 1 when all is ok, 0 with a displayed error
+int geometry_pool_init(GeometryPool &pool, GLuint max_vertices, GLuint max_indices,
+  GLuint coord_location, GLuint texcoord_location);
+// with resources, the buffers and the VAO go through its deletion queue
+void geometry_pool_free(GeometryPool &pool, GpuResources* resources = NULL);
+
+// Copy a mesh in and return its id, or -1 when either buffer has no free
+// range large enough; defragmenting may then make room. Indices are
+// relative to the mesh's first vertex.
+int geometry_pool_add(GeometryPool &pool, const std::vector<Vertex> &vertices,
+  const std::vector<GLushort> &elements);
+void geometry_pool_remove(GeometryPool &pool, int id);
+
+// bind once, then draw any of the meshes with whatever program is in use
+void geometry_pool_bind(const GeometryPool &pool);
+void geometry_pool_draw(const GeometryPool &pool, int id);
+
+// Move up to max_moves live ranges of each buffer down to close the holes
+// before them, with glCopyBufferSubData, and return the moves made. The
+// copies are queued after the draws already issued, ids stay valid.
+int geometry_pool_defragment(GeometryPool &pool, int max_moves);
+// holes below the end of either buffer, which defragmenting would close
+bool geometry_pool_fragmented(const GeometryPool &pool);
+// Defragment a few ranges at a time until the pool is compact or seconds
+// have passed, returns the moves made. For idle time between frames.
+int geometry_pool_defragment_for(GeometryPool &pool, double seconds);
+
+// use of both buffers, and how much of their free space the largest hole is
+void geometry_pool_print_stats(const GeometryPool &pool, const char* name);
+
+// Draw count cubes with a vertex and index buffer each, then out of a pool.
+// Then remove every other cube and add suzannes until they no longer fit,
+// before and after defragmenting. Prints times per frame and pool stats.
+void geometry_pool_benchmark(int count, GLuint texture_id, AssetManager &assets);
+
+#endif
@@ -0,0 +1,240 @@
+#include "gl_state.h"
+
+#include <string.h>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// every cached call, in report order
+#define STATE_CALLS(X) \
+  X(UseProgram) X(BindVertexArray) X(BindBuffer) X(ActiveTexture) X(BindTexture) \
+  X(Enable) X(DepthMask) X(BlendFunc) X(ClearColor) X(Uniform1i) X(UniformMatrix4fv)
+
+#define STATE_ENUM(name) STATE_##name,
+enum { STATE_CALLS(STATE_ENUM) STATE_CALL_COUNT };
+#define STATE_NAME(name) "gl" #name,
+static const char* const STATE_NAMES[STATE_CALL_COUNT] = { STATE_CALLS(STATE_NAME) };
+
+static const int MAX_UNITS = 32;
+enum { BUFFER_ARRAY, BUFFER_ELEMENT_ARRAY, BUFFER_TARGET_COUNT };
+enum { CAP_BLEND, CAP_CULL_FACE, CAP_DEPTH_TEST, CAP_COUNT };
+
+// unknown until the first call through the layer sets it
+static const long long UNKNOWN = -1;
+
+// a uniform's last value, as raw bytes
+struct UniformValue
+{
+  bool known;
+  GLfloat data[16];
+};
+
+struct GLState
+{
+  long long program, vertex_array, active_texture;
+  long long buffers[BUFFER_TARGET_COUNT];
+  long long textures[MAX_UNITS];
+  long long caps[CAP_COUNT];
+  long long depth_mask, blend_source, blend_destination;
+  GLfloat clear_color[4];
+  bool clear_color_known;
+  map<GLuint, vector<UniformValue> > uniforms;  // per program, by location
+
+  int frames;  // since the last report
+  long long calls[STATE_CALL_COUNT], skipped[STATE_CALL_COUNT];
+};
+static GLState state;
+
+static int buffer_slot(GLenum target)
+{
+  switch (target)
+  {
+  case GL_ARRAY_BUFFER: return BUFFER_ARRAY;
+  case GL_ELEMENT_ARRAY_BUFFER: return BUFFER_ELEMENT_ARRAY;
+  }
+  return -1;
+}
+
+static int cap_slot(GLenum cap)
+{
+  switch (cap)
+  {
+  case GL_BLEND: return CAP_BLEND;
+  case GL_CULL_FACE: return CAP_CULL_FACE;
+  case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+  }
+  return -1;
+}
+
+// true when the call must go to GL, current then holds value
+static bool change(int call, long long &current, long long value)
+{
+  state.calls[call]++;
+  if (current == value)
+  {
+    state.skipped[call]++;
+    return false;
+  }
+  current = value;
+  return true;
+}
+
+void gl_state_use_program(GLuint program)
+{
+  if (change(STATE_UseProgram, state.program, program))
+    glUseProgram(program);
+}
+
+void gl_state_bind_vertex_array(GLuint vao)
+{
+  if (!change(STATE_BindVertexArray, state.vertex_array, vao)) return;
+  glBindVertexArray(vao);
+  // the element buffer binding came with the VAO
+  state.buffers[BUFFER_ELEMENT_ARRAY] = UNKNOWN;
+}
+
+void gl_state_bind_buffer(GLenum target, GLuint buffer)
+{
+  int slot = buffer_slot(target);
+  long long untracked = UNKNOWN;
+  if (change(STATE_BindBuffer, slot >= 0 ? state.buffers[slot] : untracked, buffer))
+    glBindBuffer(target, buffer);
+}
+
+static void active_texture(GLenum unit)
+{
+  if (change(STATE_ActiveTexture, state.active_texture, unit))
+    glActiveTexture(unit);
+}
+
+void gl_state_bind_texture(GLenum unit, GLenum target, GLuint texture_id)
+{
+  // the unit is left active even when the binding is already there, for
+  // the texture calls that follow
+  active_texture(unit);
+  int slot = unit - GL_TEXTURE0;
+  long long untracked = UNKNOWN;
+  long long &current = (GL_TEXTURE_2D == target && slot >= 0 && slot < MAX_UNITS) ? state.textures[slot] : untracked;
+  if (change(STATE_BindTexture, current, texture_id))
+    glBindTexture(target, texture_id);
+}
+
+void gl_state_enable(GLenum cap, bool enabled)
+{
+  int slot = cap_slot(cap);
+  long long untracked = UNKNOWN;
+  if (!change(STATE_Enable, slot >= 0 ? state.caps[slot] : untracked, enabled)) return;
+  if (enabled)
+    glEnable(cap);
+  else
+    glDisable(cap);
+}
+
+void gl_state_depth_mask(bool enabled)
+{
+  if (change(STATE_DepthMask, state.depth_mask, enabled))
+    glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void gl_state_blend_func(GLenum source, GLenum destination)
+{
+  state.calls[STATE_BlendFunc]++;
+  if (state.blend_source == source && state.blend_destination == destination)
+  {
+    state.skipped[STATE_BlendFunc]++;
+    return;
+  }
+  state.blend_source = source;
+  state.blend_destination = destination;
+  glBlendFunc(source, destination);
+}
+
+void gl_state_clear_color(float r, float g, float b, float a)
+{
+  const GLfloat color[4] = { r, g, b, a };
+  state.calls[STATE_ClearColor]++;
+  if (state.clear_color_known && 0 == memcmp(color, state.clear_color, sizeof(color)))
+  {
+    state.skipped[STATE_ClearColor]++;
+    return;
+  }
+  memcpy(state.clear_color, color, sizeof(color));
+  state.clear_color_known = true;
+  glClearColor(r, g, b, a);
+}
+
+// the program in use's record of a location, NULL when the program is unknown
+static UniformValue* uniform(GLint location)
+{
+  if (UNKNOWN == state.program || location < 0) return NULL;
+  vector<UniformValue> &values = state.uniforms[(GLuint)state.program];
+  if ((size_t)location >= values.size())
+  {
+    UniformValue unknown;
+    unknown.known = false;
+    values.resize(location + 1, unknown);
+  }
+  return &values[location];
+}
+
+// true when the call must go to GL
+static bool set_uniform(int call, GLint location, const void* data, size_t size)
+{
+  state.calls[call]++;
+  UniformValue* value = uniform(location);
+  if (NULL == value) return true;
+  if (value->known && 0 == memcmp(value->data, data, size))
+  {
+    state.skipped[call]++;
+    return false;
+  }
+  memcpy(value->data, data, size);
+  value->known = true;
+  return true;
+}
+
+void gl_state_uniform_1i(GLint location, GLint value)
+{
+  if (set_uniform(STATE_Uniform1i, location, &value, sizeof(value)))
+    glUniform1i(location, value);
+}
+
+void gl_state_uniform_matrix_4fv(GLint location, const GLfloat* value)
+{
+  if (set_uniform(STATE_UniformMatrix4fv, location, value, 16 * sizeof(GLfloat)))
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+void gl_state_invalidate()
+{
+  state.program = state.vertex_array = state.active_texture = UNKNOWN;
+  for (int i = 0; i < BUFFER_TARGET_COUNT; i++)
+    state.buffers[i] = UNKNOWN;
+  for (int i = 0; i < MAX_UNITS; i++)
+    state.textures[i] = UNKNOWN;
+  for (int i = 0; i < CAP_COUNT; i++)
+    state.caps[i] = UNKNOWN;
+  state.depth_mask = state.blend_source = state.blend_destination = UNKNOWN;
+  state.clear_color_known = false;
+  state.uniforms.clear();
+}
+
+void gl_state_frame_end()
+{
+  state.frames++;
+}
+
+void gl_state_report(FILE* out)
+{
+  if (0 == state.frames) return;
+  fprintf(out, "%-20s %12s %12s\n", "state call", "calls/frame", "skipped");
+  for (int i = 0; i < STATE_CALL_COUNT; i++)
+  {
+    if (0 == state.calls[i]) continue;
+    fprintf(out, "%-20s %12.1f %11.0f%%\n", STATE_NAMES[i], (double)state.calls[i] / state.frames,
+      100.0 * state.skipped[i] / state.calls[i]);
+    state.calls[i] = state.skipped[i] = 0;
+  }
+  state.frames = 0;
+}
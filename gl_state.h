@@ -0,0 +1,39 @@
+#ifndef _GL_STATE_H
+#define _GL_STATE_H
+
+#include <stdio.h>
+#include <GL/glew.h>
+
+// Shadows of the context's bindings, enable flags and the uniform values of
+// every program, so calls that would set what is already set are dropped.
+// Call gl_state_invalidate once the context is current, so everything
+// starts unknown and the first call of each kind always goes to GL.
+// Code that changes the same state with plain GL calls must call
+// gl_state_invalidate afterwards, and so must code deleting objects, whose
+// names GL may hand out again.
+
+void gl_state_use_program(GLuint program);
+void gl_state_bind_vertex_array(GLuint vao);
+// GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER (a part of the VAO), other
+// targets pass through: glBindBufferBase and glBindBufferRange move them too
+void gl_state_bind_buffer(GLenum target, GLuint buffer);
+// GL_TEXTURE_2D, on the first 32 units; unit is active afterwards
+void gl_state_bind_texture(GLenum unit, GLenum target, GLuint texture_id);
+// GL_BLEND, GL_CULL_FACE and GL_DEPTH_TEST, others pass through
+void gl_state_enable(GLenum cap, bool enabled);
+void gl_state_depth_mask(bool enabled);
+void gl_state_blend_func(GLenum source, GLenum destination);
+void gl_state_clear_color(float r, float g, float b, float a);
+// uniforms of the program in use, compared with what it was last given
+void gl_state_uniform_1i(GLint location, GLint value);
+void gl_state_uniform_matrix_4fv(GLint location, const GLfloat* value);
+
+// forget everything, for after GL calls made around this layer
+void gl_state_invalidate();
+
+// counts calls and skipped calls per frame
+void gl_state_frame_end();
+// calls and skipped calls per frame since the last report, then resets them
+void gl_state_report(FILE* out);
+
+#endif
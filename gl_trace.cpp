@@ -0,0 +1,402 @@
+#include "gl_trace.h"
+
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <GL/glew.h>
+
+using namespace std;
+
+// every hooked entry point, in report order
+#define TRACE_FUNCTIONS(X) \
+  X(UseProgram) X(BindProgramPipeline) X(BindVertexArray) X(BindBuffer) \
+  X(BindBufferBase) X(BindBufferRange) X(ActiveTexture) \
+  X(Uniform1i) X(UniformMatrix4fv) X(BufferData) X(BufferSubData) \
+  X(VertexAttribPointer) X(EnableVertexAttribArray) X(DisableVertexAttribArray) X(VertexAttribDivisor) \
+  X(DrawElementsBaseVertex) X(DrawElementsInstanced) X(MultiDrawElementsIndirect) \
+  X(LinkProgram) X(DeleteProgram) X(DeleteBuffers) X(DeleteVertexArrays)
+
+#define TRACE_ENUM(name) TRACE_##name,
+enum { TRACE_FUNCTIONS(TRACE_ENUM) TRACE_COUNT };
+#define TRACE_NAME(name) "gl" #name,
+static const char* const TRACE_NAMES[TRACE_COUNT] = { TRACE_FUNCTIONS(TRACE_NAME) };
+
+// GLEW's pointers from before gl_trace_install
+#define TRACE_REAL(name) static decltype(__glew##name) real_##name;
+TRACE_FUNCTIONS(TRACE_REAL)
+
+// unknown until the first call through the layer sets it
+static const long long UNKNOWN = -1;
+
+struct GLTrace
+{
+  bool installed;
+  int frames;
+  long long calls[TRACE_COUNT], redundant[TRACE_COUNT], bytes[TRACE_COUNT];
+  bool flagged[TRACE_COUNT];  // the first redundant call of each is printed
+
+  // what the layer last set
+  long long program, pipeline, vertex_array, active_texture;
+  unordered_map<GLenum, GLuint> buffers;
+  map<pair<GLenum, GLuint>, vector<GLintptr> > indexed_buffers;  // buffer, offset, size
+  map<pair<GLuint, GLint>, vector<char> > uniforms;              // per program and location
+};
+static GLTrace trace;
+
+static void count(int function, long long bytes = 0)
+{
+  trace.calls[function]++;
+  trace.bytes[function] += bytes;
+}
+
+static void redundant(int function, const string &call)
+{
+  trace.redundant[function]++;
+  if (trace.flagged[function]) return;
+  trace.flagged[function] = true;
+  cerr << "gl_trace: redundant " << call << ", further ones are only counted" << endl;
+}
+
+static string call_string(int function, long long a, long long b = UNKNOWN)
+{
+  ostringstream out;
+  out << TRACE_NAMES[function] << "(" << a;
+  if (b != UNKNOWN) out << ", " << b;
+  out << ")";
+  return out.str();
+}
+
+// a binding that is already current is flagged, otherwise remembered
+static void bind(int function, long long &current, long long value)
+{
+  count(function);
+  if (current == value)
+    redundant(function, call_string(function, value));
+  current = value;
+}
+
+static void set_uniform(int function, GLint location, const void* data, size_t size)
+{
+  count(function, size);
+  if (UNKNOWN == trace.program || location < 0) return;
+
+  vector<char> &last = trace.uniforms[make_pair((GLuint)trace.program, location)];
+  if (last.size() == size && 0 == memcmp(&last[0], data, size))
+  {
+    ostringstream call;
+    call << TRACE_NAMES[function] << " to location " << location << " of program " << trace.program
+      << ", which already holds the value";
+    redundant(function, call.str());
+  }
+  last.assign((const char*)data, (const char*)data + size);
+}
+
+// ----- WRAPPERS -----
+
+static void GLAPIENTRY trace_UseProgram(GLuint program)
+{
+  bind(TRACE_UseProgram, trace.program, program);
+  real_UseProgram(program);
+}
+
+static void GLAPIENTRY trace_BindProgramPipeline(GLuint pipeline)
+{
+  bind(TRACE_BindProgramPipeline, trace.pipeline, pipeline);
+  real_BindProgramPipeline(pipeline);
+}
+
+static void GLAPIENTRY trace_BindVertexArray(GLuint vertex_array)
+{
+  bind(TRACE_BindVertexArray, trace.vertex_array, vertex_array);
+  // the element buffer binding belongs to the vertex array
+  trace.buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+  real_BindVertexArray(vertex_array);
+}
+
+static void GLAPIENTRY trace_BindBuffer(GLenum target, GLuint buffer)
+{
+  count(TRACE_BindBuffer);
+  unordered_map<GLenum, GLuint>::iterator bound = trace.buffers.find(target);
+  if (bound != trace.buffers.end() && bound->second == buffer)
+    redundant(TRACE_BindBuffer, call_string(TRACE_BindBuffer, target, buffer));
+  trace.buffers[target] = buffer;
+  real_BindBuffer(target, buffer);
+}
+
+static void bind_indexed(int function, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  count(function);
+  vector<GLintptr> binding = { (GLintptr)buffer, offset, (GLintptr)size };
+  vector<GLintptr> &last = trace.indexed_buffers[make_pair(target, index)];
+  if (last == binding)
+    redundant(function, call_string(function, target, index));
+  last = binding;
+  // binding a range also binds the generic target
+  trace.buffers[target] = buffer;
+}
+
+static void GLAPIENTRY trace_BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+  bind_indexed(TRACE_BindBufferBase, target, index, buffer, 0, 0);
+  real_BindBufferBase(target, index, buffer);
+}
+
+static void GLAPIENTRY trace_BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  bind_indexed(TRACE_BindBufferRange, target, index, buffer, offset, size);
+  real_BindBufferRange(target, index, buffer, offset, size);
+}
+
+static void GLAPIENTRY trace_ActiveTexture(GLenum texture)
+{
+  bind(TRACE_ActiveTexture, trace.active_texture, texture);
+  real_ActiveTexture(texture);
+}
+
+static void GLAPIENTRY trace_Uniform1i(GLint location, GLint value)
+{
+  set_uniform(TRACE_Uniform1i, location, &value, sizeof(value));
+  real_Uniform1i(location, value);
+}
+
+static void GLAPIENTRY trace_UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+  set_uniform(TRACE_UniformMatrix4fv, location, value, count * 16 * sizeof(GLfloat));
+  real_UniformMatrix4fv(location, count, transpose, value);
+}
+
+static void GLAPIENTRY trace_BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+  count(TRACE_BufferData, data ? size : 0);
+  real_BufferData(target, size, data, usage);
+}
+
+static void GLAPIENTRY trace_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+  count(TRACE_BufferSubData, size);
+  real_BufferSubData(target, offset, size, data);
+}
+
+static void GLAPIENTRY trace_VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+  GLsizei stride, const void* pointer)
+{
+  count(TRACE_VertexAttribPointer);
+  real_VertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+static void GLAPIENTRY trace_EnableVertexAttribArray(GLuint index)
+{
+  count(TRACE_EnableVertexAttribArray);
+  real_EnableVertexAttribArray(index);
+}
+
+static void GLAPIENTRY trace_DisableVertexAttribArray(GLuint index)
+{
+  count(TRACE_DisableVertexAttribArray);
+  real_DisableVertexAttribArray(index);
+}
+
+static void GLAPIENTRY trace_VertexAttribDivisor(GLuint index, GLuint divisor)
+{
+  count(TRACE_VertexAttribDivisor);
+  real_VertexAttribDivisor(index, divisor);
+}
+
+static void GLAPIENTRY trace_DrawElementsBaseVertex(GLenum mode, GLsizei elements, GLenum type, const void* indices,
+  GLint base_vertex)
+{
+  count(TRACE_DrawElementsBaseVertex);
+  real_DrawElementsBaseVertex(mode, elements, type, indices, base_vertex);
+}
+
+static void GLAPIENTRY trace_DrawElementsInstanced(GLenum mode, GLsizei elements, GLenum type, const void* indices,
+  GLsizei instances)
+{
+  count(TRACE_DrawElementsInstanced);
+  real_DrawElementsInstanced(mode, elements, type, indices, instances);
+}
+
+static void GLAPIENTRY trace_MultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect,
+  GLsizei draws, GLsizei stride)
+{
+  count(TRACE_MultiDrawElementsIndirect);
+  real_MultiDrawElementsIndirect(mode, type, indirect, draws, stride);
+}
+
+static void GLAPIENTRY trace_LinkProgram(GLuint program)
+{
+  count(TRACE_LinkProgram);
+  // relinking resets the uniforms
+  map<pair<GLuint, GLint>, vector<char> >::iterator i = trace.uniforms.lower_bound(make_pair(program, -1));
+  while (i != trace.uniforms.end() && i->first.first == program)
+    trace.uniforms.erase(i++);
+  real_LinkProgram(program);
+}
+
+static void GLAPIENTRY trace_DeleteProgram(GLuint program)
+{
+  count(TRACE_DeleteProgram);
+  map<pair<GLuint, GLint>, vector<char> >::iterator i = trace.uniforms.lower_bound(make_pair(program, -1));
+  while (i != trace.uniforms.end() && i->first.first == program)
+    trace.uniforms.erase(i++);
+  real_DeleteProgram(program);
+}
+
+static void GLAPIENTRY trace_DeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+  count(TRACE_DeleteBuffers);
+  // deleting a bound buffer unbinds it
+  for (GLsizei b = 0; b < n; b++)
+  {
+    for (unordered_map<GLenum, GLuint>::iterator i = trace.buffers.begin(); i != trace.buffers.end(); ++i)
+      if (i->second == buffers[b])
+        i->second = 0;
+    for (map<pair<GLenum, GLuint>, vector<GLintptr> >::iterator i = trace.indexed_buffers.begin();
+      i != trace.indexed_buffers.end(); ++i)
+      if (i->second[0] == (GLintptr)buffers[b])
+        i->second.clear();
+  }
+  real_DeleteBuffers(n, buffers);
+}
+
+static void GLAPIENTRY trace_DeleteVertexArrays(GLsizei n, const GLuint* arrays)
+{
+  count(TRACE_DeleteVertexArrays);
+  for (GLsizei a = 0; a < n; a++)
+    if (trace.vertex_array == arrays[a])
+      trace.vertex_array = 0;
+  real_DeleteVertexArrays(n, arrays);
+}
+
+// ----- INSTALL -----
+
+void gl_trace_install()
+{
+  if (trace.installed) return;
+
+  // entry points the driver lacks stay NULL
+#define TRACE_INSTALL(name) \
+  real_##name = __glew##name; \
+  if (real_##name) __glew##name = trace_##name;
+  TRACE_FUNCTIONS(TRACE_INSTALL)
+
+  trace.installed = true;
+  gl_trace_reset();
+  trace.program = trace.pipeline = trace.vertex_array = trace.active_texture = UNKNOWN;
+  trace.buffers.clear();
+  trace.indexed_buffers.clear();
+  trace.uniforms.clear();
+}
+
+void gl_trace_reset()
+{
+  trace.frames = 0;
+  for (int i = 0; i < TRACE_COUNT; i++)
+  {
+    trace.calls[i] = trace.redundant[i] = trace.bytes[i] = 0;
+    trace.flagged[i] = false;
+  }
+}
+
+void gl_trace_uninstall()
+{
+  if (!trace.installed) return;
+#define TRACE_UNINSTALL(name) \
+  if (real_##name) __glew##name = real_##name;
+  TRACE_FUNCTIONS(TRACE_UNINSTALL)
+  trace.installed = false;
+}
+
+void gl_trace_frame_end()
+{
+  if (trace.installed)
+    trace.frames++;
+}
+
+int gl_trace_frames()
+{
+  return trace.frames;
+}
+
+// ----- REPORTS -----
+
+void gl_trace_report(FILE* out)
+{
+  int frames = trace.frames > 0 ? trace.frames : 1;
+  fprintf(out, "%d frames\n%-30s %12s %12s %14s\n", trace.frames, "function", "calls/frame",
+    "redundant", "bytes/frame");
+  for (int i = 0; i < TRACE_COUNT; i++)
+  {
+    if (0 == trace.calls[i]) continue;
+    fprintf(out, "%-30s %12.2f %12.2f %14.1f\n", TRACE_NAMES[i], (double)trace.calls[i] / frames,
+      (double)trace.redundant[i] / frames, (double)trace.bytes[i] / frames);
+  }
+}
+
+int gl_trace_save(const string &filename)
+{
+  FILE* out = fopen(filename.c_str(), "w");
+  if (NULL == out)
+  {
+    cerr << "gl_trace_save: could not write " << filename << endl;
+    return 0;
+  }
+  int frames = trace.frames > 0 ? trace.frames : 1;
+  for (int i = 0; i < TRACE_COUNT; i++)
+  {
+    if (0 == trace.calls[i]) continue;
+    fprintf(out, "%s %.3f %.3f %.1f\n", TRACE_NAMES[i], (double)trace.calls[i] / frames,
+      (double)trace.redundant[i] / frames, (double)trace.bytes[i] / frames);
+  }
+  fclose(out);
+  return 1;
+}
+
+// per function: calls, redundant calls and bytes per frame
+typedef map<string, vector<double> > TraceReport;
+
+static int read_report(const string &filename, TraceReport &report)
+{
+  ifstream in(filename.c_str());
+  if (!in)
+  {
+    cerr << "gl_trace_diff: could not read " << filename << endl;
+    return 0;
+  }
+  string name;
+  vector<double> values(3);
+  while (in >> name >> values[0] >> values[1] >> values[2])
+    report[name] = values;
+  return 1;
+}
+
+int gl_trace_diff(const string &before, const string &after)
+{
+  TraceReport a, b;
+  if (!read_report(before, a) || !read_report(after, b)) return -1;
+  for (TraceReport::iterator i = a.begin(); i != a.end(); ++i)
+    b.insert(make_pair(i->first, vector<double>(3, 0.0)));
+
+  const char* const COLUMNS[3] = { "calls", "redundant", "bytes" };
+  int regressions = 0;
+  for (TraceReport::iterator i = b.begin(); i != b.end(); ++i)
+  {
+    vector<double> old_values = a.count(i->first) ? a[i->first] : vector<double>(3, 0.0);
+    for (int c = 0; c < 3; c++)
+    {
+      double delta = i->second[c] - old_values[c];
+      // half a call a frame, or a byte, is noise from frames that differ
+      if (delta > -0.5 && delta < 0.5) continue;
+      printf("%-30s %-10s %12.2f -> %12.2f per frame%s\n", i->first.c_str(), COLUMNS[c], old_values[c],
+        i->second[c], delta > 0.0 ? "  (more)" : "");
+      if (delta > 0.0) regressions++;
+    }
+  }
+  if (0 == regressions)
+    printf("no function got more calls, redundant calls or bytes per frame\n");
+  return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _GL_TRACE_H
+#define _GL_TRACE_H
+
+#include <stdio.h>
+#include <string>
+
+// An optional layer over GLEW's function pointers: once installed, every
+// call through the hooked entry points is counted per function, state
+// changes that set what is already set are flagged as redundant, and the
+// bytes handed to buffer uploads and uniforms are added up. GL 1.1 entry
+// points (glDrawElements, glBindTexture, glClear...) are plain exports of
+// libGL rather than GLEW pointers, they are not seen.
+
+// call after glewInit
+void gl_trace_install();
+void gl_trace_uninstall();
+// Zero the counts, keeping the bindings seen so far. Call before the first
+// frame, so loading is not averaged into the per-frame numbers.
+void gl_trace_reset();
+// call after every frame's swap
+void gl_trace_frame_end();
+int gl_trace_frames();
+
+// calls, redundant calls and bytes per frame of every function called
+void gl_trace_report(FILE* out);
+// the same as text, for gl_trace_diff
+int gl_trace_save(const std::string &filename);
+
+// Compare two saved reports, say one per build, and print what changed.
+// Returns 1 when any function got more calls, redundant calls or bytes
+// per frame in after than in before, 0 otherwise, -1 on a read error.
+int gl_trace_diff(const std::string &before, const std::string &after);
+
+#endif
@@ -0,0 +1,202 @@
+#include "gpu_resources.h"
+#include "gl_state.h"
+
+#include <stdio.h>
+#include <iostream>
+
+using namespace std;
+
+static const uint32_t INDEX_MASK = (1u << GPU_HANDLE_INDEX_BITS) - 1;
+static const uint32_t GENERATION_MASK = (1u << (32 - GPU_HANDLE_INDEX_BITS)) - 1;
+
+static GpuHandle make_handle(uint32_t index, uint32_t generation)
+{
+  return (generation << GPU_HANDLE_INDEX_BITS) | index;
+}
+
+// the live slot a handle points at, NULL for stale or invalid handles
+static const GpuSlot* find_slot(const GpuResources &resources, GpuHandle handle)
+{
+  uint32_t index = handle & INDEX_MASK;
+  if (index >= resources.slots.size()) return NULL;
+  const GpuSlot &slot = resources.slots[index];
+  if (!slot.live || slot.generation != handle >> GPU_HANDLE_INDEX_BITS) return NULL;
+  return &slot;
+}
+
+static void delete_object(GpuResourceType type, GLuint name)
+{
+  switch (type)
+  {
+  case GPU_BUFFER: glDeleteBuffers(1, &name); break;
+  case GPU_TEXTURE: glDeleteTextures(1, &name); break;
+  case GPU_PROGRAM: glDeleteProgram(name); break;
+  case GPU_VERTEX_ARRAY: glDeleteVertexArrays(1, &name); break;
+  case GPU_SHADER: glDeleteShader(name); break;
+  case GPU_RESOURCE_TYPE_COUNT: break;
+  }
+}
+
+static void delete_objects(GpuResources &resources, const vector<GpuDeletion> &objects)
+{
+  for (size_t i = 0; i < objects.size(); i++)
+    delete_object(objects[i].type, objects[i].name);
+  resources.deleted_count += objects.size();
+  // the names are free to come back
+  if (!objects.empty())
+    gl_state_invalidate();
+}
+
+void gpu_resources_init(GpuResources &resources)
+{
+  resources.slots.clear();
+  resources.free_slots.clear();
+  resources.released.clear();
+  resources.pending.clear();
+  resources.frame = 0;
+  resources.use_fences = (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+  resources.live_count = 0;
+  resources.released_count = resources.deleted_count = 0;
+}
+
+void gpu_resources_free(GpuResources &resources)
+{
+  glFinish();
+  for (size_t i = 0; i < resources.pending.size(); i++)
+  {
+    if (resources.pending[i].fence)
+      glDeleteSync(resources.pending[i].fence);
+    delete_objects(resources, resources.pending[i].objects);
+  }
+  resources.pending.clear();
+  delete_objects(resources, resources.released);
+  resources.released.clear();
+
+  vector<GpuDeletion> live;
+  for (size_t i = 0; i < resources.slots.size(); i++)
+  {
+    if (!resources.slots[i].live) continue;
+    GpuDeletion object = { resources.slots[i].type, resources.slots[i].name };
+    live.push_back(object);
+  }
+  delete_objects(resources, live);
+  resources.slots.clear();
+  resources.free_slots.clear();
+  resources.live_count = 0;
+}
+
+GpuHandle gpu_register(GpuResources &resources, GpuResourceType type, GLuint name)
+{
+  uint32_t index;
+  if (!resources.free_slots.empty())
+  {
+    index = resources.free_slots.back();
+    resources.free_slots.pop_back();
+  }
+  else
+  {
+    if (resources.slots.size() > INDEX_MASK)
+    {
+      cerr << "gpu_register: more than " << INDEX_MASK + 1 << " objects" << endl;
+      return GPU_HANDLE_NONE;
+    }
+    index = resources.slots.size();
+    GpuSlot slot;
+    // generation 0 is left out, so no handle is ever 0
+    slot.generation = 1;
+    resources.slots.push_back(slot);
+  }
+
+  GpuSlot &slot = resources.slots[index];
+  slot.name = name;
+  slot.type = type;
+  slot.live = true;
+  resources.live_count++;
+  return make_handle(index, slot.generation);
+}
+
+GLuint gpu_name(const GpuResources &resources, GpuHandle handle)
+{
+  const GpuSlot* slot = find_slot(resources, handle);
+  return slot ? slot->name : 0;
+}
+
+void gpu_defer_delete(GpuResources &resources, GpuResourceType type, GLuint name)
+{
+  GpuDeletion object = { type, name };
+  resources.released.push_back(object);
+  resources.released_count++;
+}
+
+void gpu_delete(GpuResources* resources, GpuResourceType type, GLuint name)
+{
+  if (0 == name) return;
+  if (resources)
+    gpu_defer_delete(*resources, type, name);
+  else
+    delete_object(type, name);
+}
+
+void gpu_release(GpuResources &resources, GpuHandle handle)
+{
+  if (NULL == find_slot(resources, handle)) return;
+  uint32_t index = handle & INDEX_MASK;
+  GpuSlot &slot = resources.slots[index];
+  gpu_defer_delete(resources, slot.type, slot.name);
+
+  slot.live = false;
+  slot.name = 0;
+  slot.generation = (slot.generation + 1) & GENERATION_MASK;
+  if (0 == slot.generation)
+    slot.generation = 1;
+  resources.free_slots.push_back(index);
+  resources.live_count--;
+}
+
+void gpu_resources_end_frame(GpuResources &resources)
+{
+  resources.frame++;
+  if (!resources.released.empty())
+  {
+    GpuDeletionFrame released;
+    released.fence = resources.use_fences ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+    released.frame = resources.frame;
+    released.objects.swap(resources.released);
+    resources.pending.push_back(released);
+  }
+
+  // frames complete in order, the first one still running ends the scan
+  while (!resources.pending.empty())
+  {
+    GpuDeletionFrame &oldest = resources.pending.front();
+    if (oldest.fence)
+    {
+      GLenum status = glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+      if (GL_TIMEOUT_EXPIRED == status) break;
+      glDeleteSync(oldest.fence);
+      oldest.fence = 0;
+      if (GL_WAIT_FAILED == status)
+      {
+        // nothing is known of the GPU's progress, count frames from now on
+        cerr << "gpu_resources_end_frame: glClientWaitSync failed, deleting "
+          << oldest.objects.size() << " objects after " << GPU_DELETION_FRAMES << " frames" << endl;
+        oldest.frame = resources.frame;
+        continue;
+      }
+    }
+    else if (resources.frame - oldest.frame < GPU_DELETION_FRAMES)
+      break;
+    delete_objects(resources, oldest.objects);
+    resources.pending.pop_front();
+  }
+}
+
+void gpu_resources_print_stats(const GpuResources &resources)
+{
+  size_t waiting = 0;
+  for (size_t i = 0; i < resources.pending.size(); i++)
+    waiting += resources.pending[i].objects.size();
+  printf("gpu resources: %d live, %ld released, %ld deleted, %zu waiting on %zu frames\n",
+    resources.live_count, resources.released_count, resources.deleted_count, waiting,
+    resources.pending.size());
+}
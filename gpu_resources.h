@@ -0,0 +1,92 @@
+#ifndef _GPU_RESOURCES_H
+#define _GPU_RESOURCES_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <GL/glew.h>
+
+enum GpuResourceType
+{
+  GPU_BUFFER,
+  GPU_TEXTURE,
+  GPU_PROGRAM,
+  GPU_VERTEX_ARRAY,
+  GPU_SHADER,
+  GPU_RESOURCE_TYPE_COUNT
+};
+
+// A slot index in the low GPU_HANDLE_INDEX_BITS bits and the slot's
+// generation above them. Releasing an object bumps its slot's generation,
+// so handles still pointing at it stop resolving instead of reaching
+// whatever object takes the slot next. 0 is never a valid handle.
+typedef uint32_t GpuHandle;
+#define GPU_HANDLE_NONE 0
+#define GPU_HANDLE_INDEX_BITS 20
+
+// frames a released object is kept without fences, as with GL < 3.2
+#define GPU_DELETION_FRAMES 3
+
+struct GpuSlot
+{
+  GLuint name;
+  uint32_t generation;
+  GpuResourceType type;
+  bool live;
+};
+
+struct GpuDeletion
+{
+  GpuResourceType type;
+  GLuint name;
+};
+
+// the objects released during one frame, deleted once its fence signals
+struct GpuDeletionFrame
+{
+  GLsync fence;  // 0 without ARB_sync
+  int frame;
+  std::vector<GpuDeletion> objects;
+};
+
+// Generational handles for GL objects, plus the queue holding released
+// objects until the GPU is done with the frames that may still use them.
+struct GpuResources
+{
+  std::vector<GpuSlot> slots;
+  std::vector<uint32_t> free_slots;
+  std::vector<GpuDeletion> released;      // this frame's, not fenced yet
+  std::deque<GpuDeletionFrame> pending;   // oldest first
+  int frame;
+  bool use_fences;
+
+  int live_count;
+  long released_count, deleted_count;
+};
+
+// fences need GL 3.2 or ARB_sync, a current context
+void gpu_resources_init(GpuResources &resources);
+// deletes everything, released or not, after waiting for the GPU
+void gpu_resources_free(GpuResources &resources);
+
+// take ownership of a GL object, returns GPU_HANDLE_NONE when the slots run out
+GpuHandle gpu_register(GpuResources &resources, GpuResourceType type, GLuint name);
+// the object's name, 0 once it was released; O(1)
+GLuint gpu_name(const GpuResources &resources, GpuHandle handle);
+// The handle stops resolving now, the object is deleted when the frames
+// issued so far have completed. Stale handles are ignored.
+void gpu_release(GpuResources &resources, GpuHandle handle);
+// the same for an object that was never registered
+void gpu_defer_delete(GpuResources &resources, GpuResourceType type, GLuint name);
+// gpu_defer_delete, or delete right away when resources is NULL; 0 is ignored
+void gpu_delete(GpuResources* resources, GpuResourceType type, GLuint name);
+
+// Fence the frame's releases and delete the objects whose fences have
+// signaled, without waiting. Call after the frame's last draw. A fence
+// that fails to wait is displayed as an error, its objects then wait
+// GPU_DELETION_FRAMES frames as they would without fences.
+void gpu_resources_end_frame(GpuResources &resources);
+
+void gpu_resources_print_stats(const GpuResources &resources);
+
+#endif
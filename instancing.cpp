@@ -0,0 +1,198 @@
+#include "instancing.h"
+#include "gl_common.h"
+#include "shader_utils.h"
+#include "program_info.h"
+#include "mesh.h"
+#include "gl_state.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+int instancing_supported()
+{
+  return GLEW_VERSION_3_3 ? 1 : 0;
+}
+
+void instance_buffer_create(InstanceBuffer &instances, int capacity)
+{
+  instances.capacity = capacity;
+  instances.count = 0;
+  glGenBuffers(1, &instances.vbo);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, instances.vbo);
+  glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+void instance_buffer_update(InstanceBuffer &instances, const glm::mat4* models, int count)
+{
+  instances.count = count;
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, instances.vbo);
+  // orphan, last frame's draws may still be reading the old contents
+  glBufferData(GL_ARRAY_BUFFER, instances.capacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), models);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+void instance_buffer_free(InstanceBuffer &instances)
+{
+  glDeleteBuffers(1, &instances.vbo);
+  instances.vbo = 0;
+  gl_state_invalidate();
+  instances.capacity = instances.count = 0;
+}
+
+// ----- BENCHMARK -----
+
+enum { BENCH_COORD3D, BENCH_TEXCOORD, BENCH_INSTANCE_MODEL, BENCH_NORMAL = BENCH_INSTANCE_MODEL + 4 };
+
+static GLuint create_instanced_program(ProgramInfo &info)
+{
+  const char* const attribute_names[] = { "coord3d", "texcoord", "instance_model" };
+
+  GLuint vs = create_shader("cube.v.glsl", GL_VERTEX_SHADER, 120, "#define INSTANCED\n");
+  if (0 == vs) return 0;
+  GLuint fs = create_shader("cube.f.glsl", GL_FRAGMENT_SHADER, 120);
+  if (0 == fs) return 0;
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vs);
+  glAttachShader(program, fs);
+  program_bind_attributes(program, attribute_names, 3);
+  glLinkProgram(program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  if (!program_reflect(program, info))
+  {
+    cerr << "glLinkProgram:";
+    print_log(program);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+// instances on a square grid, each spinning about its own axis
+static void fill_models(vector<glm::mat4> &models, int first, int count, int side, float angle)
+{
+  for (int i = 0; i < count; i++)
+  {
+    int n = first + i;
+    glm::vec3 position(3.0f * (n % side - side / 2), 0.0f, 3.0f * (n / side - side / 2));
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    models[i] = glm::rotate(model, angle + n, glm::vec3(0.0, 1.0, 0.0));
+  }
+}
+
+void instancing_benchmark(int max_instances, GLuint texture_id, AssetManager &assets)
+{
+  if (!instancing_supported())
+  {
+    cerr << "Error: instancing needs OpenGL 3.3" << endl;
+    return;
+  }
+
+  ProgramInfo info;
+  GLuint program = create_instanced_program(info);
+  if (0 == program) return;
+
+  const ProgramVarName expected[] = {
+    { "mvp", VAR_UNIFORM },
+    { "mytexture", VAR_UNIFORM },
+  };
+  GLint uniforms[2];
+  if (!program_require(info, expected, 2, uniforms))
+  {
+    glDeleteProgram(program);
+    return;
+  }
+  AssetHandle suzanne = assets_acquire_obj(assets, "suzanne.obj");
+  if (suzanne < 0)
+  {
+    glDeleteProgram(program);
+    return;
+  }
+
+  Mesh meshes[2];
+  mesh_create_cube(meshes[0], BENCH_COORD3D, BENCH_TEXCOORD);
+  const Asset &obj = assets_get(assets, suzanne);
+  mesh_create_obj(meshes[1], obj.vertices, obj.normals, obj.elements, BENCH_COORD3D, BENCH_NORMAL);
+  assets_release(assets, suzanne);
+
+  // first half of the instances are cubes, second half suzannes
+  InstanceBuffer instances[2];
+  int capacity = (max_instances + 1) / 2;
+  vector<glm::mat4> models(capacity);
+  for (int m = 0; m < 2; m++)
+  {
+    instance_buffer_create(instances[m], capacity);
+    mesh_set_instance_buffer(meshes[m], instances[m].vbo, BENCH_INSTANCE_MODEL);
+  }
+
+  gl_state_enable(GL_DEPTH_TEST, true);
+  const int FRAMES = 60;
+  printf("%10s %14s %14s\n", "instances", "submit (ms)", "frame (ms)");
+
+  for (int count = 1; count <= max_instances; count *= 10)
+  {
+    int side = (int)ceil(sqrt((double)count));
+    float extent = 3.0f * side;
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0, extent, extent), glm::vec3(0.0, 0.0, 0.0),
+      glm::vec3(0.0, 1.0, 0.0));
+    glm::mat4 projection = glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 4.0f * extent);
+    glm::mat4 view_projection = projection * view;
+    int counts[2] = { (count + 1) / 2, count / 2 };
+
+    double submit_seconds = 0.0, frame_seconds = 0.0;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+      Clock::time_point start = Clock::now();
+
+      gl_state_clear_color(1.0, 1.0, 1.0, 1.0);
+      glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+      gl_state_use_program(program);
+      gl_state_uniform_matrix_4fv(uniforms[0], glm::value_ptr(view_projection));
+      gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture_id);
+      gl_state_uniform_1i(uniforms[1], 0);
+
+      for (int m = 0; m < 2; m++)
+      {
+        if (0 == counts[m]) continue;
+        fill_models(models, m * counts[0], counts[m], side, frame * 0.05f);
+        instance_buffer_update(instances[m], &models[0], counts[m]);
+        mesh_draw_instanced(meshes[m], counts[m]);
+      }
+      submit_seconds += seconds_since(start);
+
+      // wait for the GPU, so the frame time covers the actual rendering
+      glFinish();
+      frame_seconds += seconds_since(start);
+    }
+    printf("%10d %14.3f %14.3f\n", count, submit_seconds * 1000.0 / FRAMES,
+      frame_seconds * 1000.0 / FRAMES);
+  }
+
+  if (mesh_supports_vao())
+    gl_state_bind_vertex_array(0);
+  for (int m = 0; m < 2; m++)
+  {
+    mesh_free(meshes[m]);
+    instance_buffer_free(instances[m]);
+  }
+  glDeleteProgram(program);
+  gl_state_invalidate();
+}
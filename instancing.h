@@ -0,0 +1,32 @@
+#ifndef _INSTANCING_H
+#define _INSTANCING_H
+
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "assets.h"
+
+// per-instance model matrices for mesh_set_instance_buffer
+struct InstanceBuffer
+{
+  GLuint vbo;
+  int capacity;
+  int count;
+};
+
+// glDrawElementsInstanced and glVertexAttribDivisor, GL 3.3
+int instancing_supported();
+
+void instance_buffer_create(InstanceBuffer &instances, int capacity);
+// replace the contents with count matrices, count <= capacity
+void instance_buffer_update(InstanceBuffer &instances, const glm::mat4* models, int count);
+void instance_buffer_free(InstanceBuffer &instances);
+
+// Draw 1, 10, 100... up to max_instances cubes and suzannes with one
+// instanced draw per mesh, printing CPU submit time and frame time per step.
+void instancing_benchmark(int max_instances, GLuint texture_id, AssetManager &assets);
+
+#endif
@@ -0,0 +1,291 @@
+#include "mesh.h"
+#include "gl_state.h"
+
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+int mesh_supports_vao()
+{
+  return (GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object) ? 1 : 0;
+}
+
+// point an attribute at its stream; recorded in the VAO when one is bound
+static void set_stream_pointer(const Mesh &mesh, int i)
+{
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, mesh.vbo[i]);
+  glEnableVertexAttribArray(mesh.location[i]);
+  glVertexAttribPointer(
+    mesh.location[i],     // attribute
+    mesh.components[i],   // number of elements per vertex
+    GL_FLOAT,             // the type of each element
+    GL_FALSE,             // take our values as-is
+    0,                    // no extra data between each position
+    0                     // offset of first element
+  );
+}
+
+// the four columns of the instance matrix, advancing once per instance
+static void set_instance_pointer(const Mesh &mesh)
+{
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, mesh.instance_vbo);
+  for (int column = 0; column < 4; column++)
+  {
+    GLuint location = mesh.instance_location + column;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+      (const GLvoid*)(column * sizeof(glm::vec4)));
+    glVertexAttribDivisor(location, 1);
+  }
+}
+
+int mesh_create(Mesh &mesh, const MeshStream streams[], int stream_count,
+  const GLushort* elements, GLsizei index_count)
+{
+  if (stream_count > MESH_MAX_STREAMS)
+  {
+    cerr << "mesh_create: " << stream_count << " streams, at most " << MESH_MAX_STREAMS << endl;
+    return 0;
+  }
+
+  mesh.vao = 0;
+  mesh.instance_vbo = 0;
+  mesh.instance_location = 0;
+  if (mesh_supports_vao())
+  {
+    glGenVertexArrays(1, &mesh.vao);
+    gl_state_bind_vertex_array(mesh.vao);
+  }
+
+  mesh.stream_count = stream_count;
+  glGenBuffers(stream_count, mesh.vbo);
+  for (int i = 0; i < stream_count; i++)
+  {
+    mesh.location[i] = streams[i].location;
+    mesh.components[i] = streams[i].components;
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, mesh.vbo[i]);
+    glBufferData(GL_ARRAY_BUFFER, streams[i].size, streams[i].data, GL_STATIC_DRAW);
+    if (mesh.vao)
+      set_stream_pointer(mesh, i);
+  }
+
+  // the index count is kept here, so drawing never has to ask GL for the buffer size
+  mesh.index_count = index_count;
+  glGenBuffers(1, &mesh.ibo);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(GLushort), elements, GL_STATIC_DRAW);
+
+  // unbind the VAO first, otherwise it would forget its index buffer
+  if (mesh.vao)
+    gl_state_bind_vertex_array(0);
+  gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  return 1;
+}
+
+// ----- VERTICES -----
+static const GLfloat cube_vertices[] = {
+  // front
+  -1.0, -1.0,  1.0,
+   1.0, -1.0,  1.0,
+   1.0,  1.0,  1.0,
+  -1.0,  1.0,  1.0,
+  // top
+  -1.0,  1.0,  1.0,
+   1.0,  1.0,  1.0,
+   1.0,  1.0, -1.0,
+  -1.0,  1.0, -1.0,
+  // back
+   1.0, -1.0, -1.0,
+  -1.0, -1.0, -1.0,
+  -1.0,  1.0, -1.0,
+   1.0,  1.0, -1.0,
+  // bottom
+  -1.0, -1.0, -1.0,
+   1.0, -1.0, -1.0,
+   1.0, -1.0,  1.0,
+  -1.0, -1.0,  1.0,
+  // left
+  -1.0, -1.0, -1.0,
+  -1.0, -1.0,  1.0,
+  -1.0,  1.0,  1.0,
+  -1.0,  1.0, -1.0,
+  // right
+   1.0, -1.0,  1.0,
+   1.0, -1.0, -1.0,
+   1.0,  1.0, -1.0,
+   1.0,  1.0,  1.0,
+};
+
+// ----- TEXTURE COORDINATES -----
+static void cube_texcoords(GLfloat texcoords[2*4*6])
+{
+  static const GLfloat front[2*4] = {
+    0.0, 0.0,
+    1.0, 0.0,
+    1.0, 1.0,
+    0.0, 1.0,
+  };
+  // same texture coords for all cube faces, so go through and copy to all 6 faces
+  for (int i = 0; i < 6; i++)
+    memcpy(&texcoords[i*4*2], front, 2*4*sizeof(GLfloat));
+}
+
+// ----- CUBE ELEMENTS -----
+static const GLushort cube_elements[] = {
+  // front
+   0,  1,  2,
+   2,  3,  0,
+  // top
+   4,  5,  6,
+   6,  7,  4,
+  // back
+   8,  9, 10,
+  10, 11,  8,
+  // bottom
+  12, 13, 14,
+  14, 15, 12,
+  // left
+  16, 17, 18,
+  18, 19, 16,
+  // right
+  20, 21, 22,
+  22, 23, 20,
+};
+
+int mesh_create_cube(Mesh &mesh, GLuint coord_location, GLuint texcoord_location)
+{
+  GLfloat texcoords[2*4*6];
+  cube_texcoords(texcoords);
+
+  const MeshStream streams[] = {
+    { coord_location, 3, cube_vertices, sizeof(cube_vertices) },
+    { texcoord_location, 2, texcoords, sizeof(texcoords) },
+  };
+  return mesh_create(mesh, streams, 2, cube_elements, sizeof(cube_elements) / sizeof(GLushort));
+}
+
+void cube_geometry(vector<Vertex> &vertices, vector<GLushort> &elements)
+{
+  GLfloat texcoords[2*4*6];
+  cube_texcoords(texcoords);
+
+  vertices.resize(4*6);
+  for (int i = 0; i < 4*6; i++)
+  {
+    vertices[i].position = glm::vec3(cube_vertices[i*3], cube_vertices[i*3+1], cube_vertices[i*3+2]);
+    vertices[i].texcoord = glm::vec2(texcoords[i*2], texcoords[i*2+1]);
+  }
+  elements.assign(cube_elements, cube_elements + sizeof(cube_elements) / sizeof(GLushort));
+}
+
+void obj_geometry(const vector<glm::vec4> &obj_vertices, vector<Vertex> &vertices)
+{
+  vertices.resize(obj_vertices.size());
+  for (size_t i = 0; i < obj_vertices.size(); i++)
+  {
+    vertices[i].position = glm::vec3(obj_vertices[i]);
+    vertices[i].texcoord = glm::vec2(0.0, 0.0);
+  }
+}
+
+int mesh_create_obj(Mesh &mesh, const vector<glm::vec4> &vertices,
+  const vector<glm::vec3> &normals, const vector<GLushort> &elements,
+  GLuint coord_location, GLuint normal_location)
+{
+  if (vertices.empty() || elements.empty())
+  {
+    cerr << "mesh_create_obj: empty mesh" << endl;
+    return 0;
+  }
+
+  const MeshStream streams[] = {
+    { coord_location, 4, &vertices[0].x, (GLsizeiptr)(vertices.size() * sizeof(glm::vec4)) },
+    { normal_location, 3, &normals[0].x, (GLsizeiptr)(normals.size() * sizeof(glm::vec3)) },
+  };
+  return mesh_create(mesh, streams, 2, &elements[0], elements.size());
+}
+
+void mesh_bind(const Mesh &mesh)
+{
+  if (mesh.vao)
+  {
+    gl_state_bind_vertex_array(mesh.vao);
+    return;
+  }
+
+  // no VAOs: respecify the format
+  for (int i = 0; i < mesh.stream_count; i++)
+    set_stream_pointer(mesh, i);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+}
+
+void mesh_draw_bound(const Mesh &mesh)
+{
+  glDrawElements(GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_SHORT, 0);
+}
+
+void mesh_unbind(const Mesh &mesh)
+{
+  if (mesh.vao) return;
+  for (int i = 0; i < mesh.stream_count; i++)
+    glDisableVertexAttribArray(mesh.location[i]);
+}
+
+void mesh_draw(const Mesh &mesh)
+{
+  mesh_bind(mesh);
+  mesh_draw_bound(mesh);
+  mesh_unbind(mesh);
+}
+
+void mesh_set_instance_buffer(Mesh &mesh, GLuint vbo, GLuint location)
+{
+  mesh.instance_vbo = vbo;
+  mesh.instance_location = location;
+  if (mesh.vao)
+  {
+    gl_state_bind_vertex_array(mesh.vao);
+    set_instance_pointer(mesh);
+    gl_state_bind_vertex_array(0);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+  }
+}
+
+void mesh_draw_instanced(const Mesh &mesh, GLsizei instance_count)
+{
+  if (mesh.vao)
+  {
+    gl_state_bind_vertex_array(mesh.vao);
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_SHORT, 0, instance_count);
+    return;
+  }
+
+  for (int i = 0; i < mesh.stream_count; i++)
+    set_stream_pointer(mesh, i);
+  set_instance_pointer(mesh);
+  gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+  glDrawElementsInstanced(GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_SHORT, 0, instance_count);
+  for (int i = 0; i < mesh.stream_count; i++)
+    glDisableVertexAttribArray(mesh.location[i]);
+  for (int column = 0; column < 4; column++)
+  {
+    // the divisor is not part of the enable state, reset it for non-instanced draws
+    glVertexAttribDivisor(mesh.instance_location + column, 0);
+    glDisableVertexAttribArray(mesh.instance_location + column);
+  }
+}
+
+void mesh_free(Mesh &mesh, GpuResources* resources)
+{
+  gpu_delete(resources, GPU_VERTEX_ARRAY, mesh.vao);
+  for (int i = 0; i < mesh.stream_count; i++)
+    gpu_delete(resources, GPU_BUFFER, mesh.vbo[i]);
+  gpu_delete(resources, GPU_BUFFER, mesh.ibo);
+  // the names are free to come back, and deleting a bound VAO unbinds it
+  if (NULL == resources)
+    gl_state_invalidate();
+  mesh.vao = mesh.ibo = 0;
+  mesh.stream_count = mesh.index_count = 0;
+}
@@ -0,0 +1,87 @@
+#ifndef _MESH_H
+#define _MESH_H
+
+#include <vector>
+#include <GL/glew.h>
+
+#include "gpu_resources.h"
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#define MESH_MAX_STREAMS 4
+
+// one attribute's data, tightly packed floats in a buffer of its own
+struct MeshStream
+{
+  GLuint location;  // attribute location in the programs drawing the mesh
+  GLint components;
+  const GLfloat* data;
+  GLsizeiptr size;  // in bytes
+};
+
+// interleaved vertex for meshes that share buffers with other meshes
+struct Vertex
+{
+  glm::vec3 position;
+  glm::vec2 texcoord;
+};
+
+// A mesh owns its vertex and index buffers. The vertex format is recorded
+// once in a VAO, so drawing is a single bind plus the draw call.
+struct Mesh
+{
+  GLuint vao;  // 0 when the context has no vertex array objects
+  GLuint vbo[MESH_MAX_STREAMS];
+  GLuint location[MESH_MAX_STREAMS];
+  GLint components[MESH_MAX_STREAMS];
+  int stream_count;
+  GLuint ibo;
+  GLsizei index_count;
+  GLuint instance_vbo;  // per-instance model matrices, 0 when not instanced
+  GLuint instance_location;
+};
+
+// GL 3.0 or ARB_vertex_array_object
+int mesh_supports_vao();
+
+// returns 1 when all is ok, 0 with a displayed error
+int mesh_create(Mesh &mesh, const MeshStream streams[], int stream_count,
+  const GLushort* elements, GLsizei index_count);
+
+// the textured cube, positions at coord_location and texcoords at texcoord_location
+int mesh_create_cube(Mesh &mesh, GLuint coord_location, GLuint texcoord_location);
+
+// load_obj output, positions at coord_location and normals at normal_location
+int mesh_create_obj(Mesh &mesh, const std::vector<glm::vec4> &vertices,
+  const std::vector<glm::vec3> &normals, const std::vector<GLushort> &elements,
+  GLuint coord_location, GLuint normal_location);
+
+// the same geometry on the CPU, as interleaved vertices
+void cube_geometry(std::vector<Vertex> &vertices, std::vector<GLushort> &elements);
+// load_obj has no texture coordinates, they are all (0, 0)
+void obj_geometry(const std::vector<glm::vec4> &obj_vertices, std::vector<Vertex> &vertices);
+
+// Draw with whatever program is in use. With VAOs the mesh's VAO is left
+// bound, so don't bind a GL_ELEMENT_ARRAY_BUFFER afterwards without
+// binding VAO 0 first.
+void mesh_draw(const Mesh &mesh);
+// mesh_draw in parts, so draws of the same mesh in a row bind it once
+void mesh_bind(const Mesh &mesh);
+void mesh_draw_bound(const Mesh &mesh);
+// before binding another mesh, a no-op with VAOs
+void mesh_unbind(const Mesh &mesh);
+
+// Read a mat4 per instance from vbo, at attribute locations
+// location..location+3 with a divisor of 1. Needs GL 3.3.
+void mesh_set_instance_buffer(Mesh &mesh, GLuint vbo, GLuint location);
+
+// one draw call for instance_count copies of the mesh
+void mesh_draw_instanced(const Mesh &mesh, GLsizei instance_count);
+
+// The mesh does not own the instance buffer, the caller frees it. With
+// resources, the objects go through its deletion queue.
+void mesh_free(Mesh &mesh, GpuResources* resources = NULL);
+
+#endif
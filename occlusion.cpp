@@ -0,0 +1,379 @@
+#include "occlusion.h"
+#include "parallel.h"
+#include "batch.h"
+#include "gl_common.h"
+#include "gl_state.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// clip space w below this is at or behind the eye, the projection is meaningless there
+static const float MIN_W = 1e-4f;
+
+void occlusion_clear(DepthPyramid &pyramid)
+{
+  if (pyramid.depth[0].empty())
+  {
+    int width = OCCLUSION_WIDTH, height = OCCLUSION_HEIGHT;
+    pyramid.levels = 0;
+    for (;;)
+    {
+      pyramid.width[pyramid.levels] = width;
+      pyramid.height[pyramid.levels] = height;
+      pyramid.depth[pyramid.levels].resize(width * height);
+      pyramid.levels++;
+      if ((1 == width && 1 == height) || OCCLUSION_MAX_LEVELS == pyramid.levels)
+        break;
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+  }
+  fill(pyramid.depth[0].begin(), pyramid.depth[0].end(), 1.0f);
+}
+
+// Half-space rasterizer: the three edge functions and z are linear in the
+// pixel position, so a row is stepped 4 pixels at a time.
+static void rasterize_triangle(DepthPyramid &pyramid, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+{
+  float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+  if (0.0f == area) return;
+  // both windings count, the nearest surface wins either way
+  if (area < 0.0f)
+  {
+    swap(v1, v2);
+    area = -area;
+  }
+
+  int width = pyramid.width[0], height = pyramid.height[0];
+  int x0 = max(0, (int)floorf(min(v0.x, min(v1.x, v2.x))));
+  int x1 = min(width - 1, (int)ceilf(max(v0.x, max(v1.x, v2.x))));
+  int y0 = max(0, (int)floorf(min(v0.y, min(v1.y, v2.y))));
+  int y1 = min(height - 1, (int)ceilf(max(v0.y, max(v1.y, v2.y))));
+  if (x0 > x1 || y0 > y1) return;
+  x0 &= ~3;  // whole groups of 4, width is a multiple of 4
+
+  // w_i = a_i * x + b_i * y + c_i, positive inside; w0 weighs v0 and so on
+  const glm::vec3* from[3] = { &v1, &v2, &v0 };
+  const glm::vec3* to[3] = { &v2, &v0, &v1 };
+  float a[3], b[3], c[3];
+  for (int i = 0; i < 3; i++)
+  {
+    a[i] = from[i]->y - to[i]->y;
+    b[i] = to[i]->x - from[i]->x;
+    c[i] = -a[i] * from[i]->x - b[i] * from[i]->y;
+  }
+  float za = (a[0] * v0.z + a[1] * v1.z + a[2] * v2.z) / area;
+  float zb = (b[0] * v0.z + b[1] * v1.z + b[2] * v2.z) / area;
+  float zc = (c[0] * v0.z + c[1] * v1.z + c[2] * v2.z) / area;
+
+  for (int y = y0; y <= y1; y++)
+  {
+    float py = y + 0.5f;
+    float* row = &pyramid.depth[0][y * width];
+#ifdef __SSE2__
+    __m128 wa[3], wrow[3];
+    for (int i = 0; i < 3; i++)
+    {
+      wa[i] = _mm_set1_ps(a[i]);
+      wrow[i] = _mm_set1_ps(b[i] * py + c[i]);
+    }
+    __m128 z_a = _mm_set1_ps(za), z_row = _mm_set1_ps(zb * py + zc);
+    __m128 zero = _mm_setzero_ps();
+    for (int x = x0; x <= x1; x += 4)
+    {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+      __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(wa[0], px), wrow[0]), zero);
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(wa[1], px), wrow[1]), zero));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(wa[2], px), wrow[2]), zero));
+      if (0 == _mm_movemask_ps(inside)) continue;
+
+      __m128 z = _mm_add_ps(_mm_mul_ps(z_a, px), z_row);
+      __m128 old = _mm_loadu_ps(row + x);
+      __m128 nearest = _mm_min_ps(old, z);
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+    }
+#else
+    for (int x = x0; x <= x1; x++)
+    {
+      float px = x + 0.5f;
+      if (a[0] * px + b[0] * py + c[0] < 0.0f || a[1] * px + b[1] * py + c[1] < 0.0f
+        || a[2] * px + b[2] * py + c[2] < 0.0f)
+        continue;
+      row[x] = min(row[x], za * px + zb * py + zc);
+    }
+#endif
+  }
+}
+
+// x, y in level 0 pixels and window z, false when clip w is too small to divide by
+static bool project(const glm::mat4 &mvp, const glm::vec3 &position, glm::vec3 &window)
+{
+  glm::vec4 clip = mvp * glm::vec4(position, 1.0f);
+  if (clip.w < MIN_W) return false;
+  window.x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+  window.y = (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+  window.z = clip.z / clip.w * 0.5f + 0.5f;
+  return true;
+}
+
+void occlusion_rasterize(DepthPyramid &pyramid, const glm::mat4 &mvp,
+  const vector<glm::vec3> &positions, const vector<GLushort> &elements)
+{
+  // one per worker thread, reused from occluder to occluder
+  thread_local vector<glm::vec3> window;
+  thread_local vector<uint8_t> valid;
+  window.resize(positions.size());
+  valid.resize(positions.size());
+  for (size_t i = 0; i < positions.size(); i++)
+    valid[i] = project(mvp, positions[i], window[i]);
+
+  for (size_t i = 0; i + 2 < elements.size(); i += 3)
+  {
+    GLushort i0 = elements[i], i1 = elements[i + 1], i2 = elements[i + 2];
+    if (valid[i0] && valid[i1] && valid[i2])
+      rasterize_triangle(pyramid, window[i0], window[i1], window[i2]);
+  }
+}
+
+void occlusion_build_pyramid(DepthPyramid &pyramid)
+{
+  for (int level = 1; level < pyramid.levels; level++)
+  {
+    const float* src = &pyramid.depth[level - 1][0];
+    int src_width = pyramid.width[level - 1], src_height = pyramid.height[level - 1];
+    float* dst = &pyramid.depth[level][0];
+    for (int y = 0; y < pyramid.height[level]; y++)
+    {
+      int sy0 = 2 * y, sy1 = min(2 * y + 1, src_height - 1);
+      for (int x = 0; x < pyramid.width[level]; x++)
+      {
+        int sx0 = 2 * x, sx1 = min(2 * x + 1, src_width - 1);
+        dst[y * pyramid.width[level] + x] = max(max(src[sy0 * src_width + sx0], src[sy0 * src_width + sx1]),
+          max(src[sy1 * src_width + sx0], src[sy1 * src_width + sx1]));
+      }
+    }
+  }
+}
+
+bool occlusion_test_box(const DepthPyramid &pyramid, const glm::mat4 &view_projection,
+  const glm::vec3 &box_min, const glm::vec3 &box_max)
+{
+  float lo[3] = { 1e30f, 1e30f, 1e30f }, hi[3] = { -1e30f, -1e30f, -1e30f };
+  for (int corner = 0; corner < 8; corner++)
+  {
+    glm::vec3 position(corner & 1 ? box_max.x : box_min.x, corner & 2 ? box_max.y : box_min.y,
+      corner & 4 ? box_max.z : box_min.z);
+    glm::vec3 window;
+    // a box reaching behind the eye is too close to judge
+    if (!project(view_projection, position, window)) return true;
+    for (int i = 0; i < 3; i++)
+    {
+      lo[i] = min(lo[i], window[i]);
+      hi[i] = max(hi[i], window[i]);
+    }
+  }
+
+  int width = pyramid.width[0], height = pyramid.height[0];
+  if (hi[0] < 0.0f || hi[1] < 0.0f || lo[0] >= width || lo[1] >= height) return false;
+  int x0 = max(0, (int)lo[0]), x1 = min(width - 1, (int)hi[0]);
+  int y0 = max(0, (int)lo[1]), y1 = min(height - 1, (int)hi[1]);
+
+  // the level where the rectangle spans at most 2x2 texels
+  int extent = max(x1 - x0, y1 - y0);
+  int level = 0;
+  while ((1 << level) < extent && level < pyramid.levels - 1)
+    level++;
+
+  const vector<float> &depth = pyramid.depth[level];
+  int level_width = pyramid.width[level], level_height = pyramid.height[level];
+  float farthest = 0.0f;
+  for (int y = y0 >> level; y <= min(y1 >> level, level_height - 1); y++)
+    for (int x = x0 >> level; x <= min(x1 >> level, level_width - 1); x++)
+      farthest = max(farthest, depth[y * level_width + x]);
+  return lo[2] <= farthest;
+}
+
+static void run_job(OcclusionJob &job)
+{
+  Clock::time_point start = Clock::now();
+  const OcclusionScene &scene = *job.scene;
+
+  occlusion_clear(job.pyramid);
+  for (size_t i = 0; i < scene.occluder_meshes.size(); i++)
+  {
+    const OccluderMesh &mesh = scene.meshes[scene.occluder_meshes[i]];
+    occlusion_rasterize(job.pyramid, job.view_projection * scene.occluder_models[i], mesh.positions, mesh.elements);
+  }
+  occlusion_build_pyramid(job.pyramid);
+
+  int count = scene.box_min.size();
+  job.visible.resize(count);
+  atomic<int> visible_count(0);
+  parallel_for(count, 1024, [&](int begin, int end) {
+    int visible = 0;
+    for (int i = begin; i < end; i++)
+    {
+      job.visible[i] = occlusion_test_box(job.pyramid, job.view_projection, scene.box_min[i], scene.box_max[i]);
+      visible += job.visible[i];
+    }
+    visible_count += visible;
+  });
+  job.visible_count = visible_count;
+  job.seconds = seconds_since(start);
+}
+
+void occlusion_begin(OcclusionJob &job, const OcclusionScene &scene, const glm::mat4 &view_projection)
+{
+  job.scene = &scene;
+  job.view_projection = view_projection;
+  job.pending = async(launch::async, run_job, ref(job));
+}
+
+const uint8_t* occlusion_end(OcclusionJob &job)
+{
+  if (job.pending.valid())
+    job.pending.get();
+  return &job.visible[0];
+}
+
+// ----- BENCHMARK -----
+
+// the camera of a frame, flying sideways along the front row at eye height
+static glm::mat4 benchmark_camera(int frame, float extent)
+{
+  glm::vec3 eye(sinf(frame * 0.05f) * extent * 0.25f, 1.5f, extent * 0.5f + 3.0f);
+  glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.0, -0.1, -1.0), glm::vec3(0.0, 1.0, 0.0));
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 2.0f * extent);
+  return projection * view;
+}
+
+void occlusion_benchmark(int objects, GLuint texture_id, AssetManager &assets)
+{
+  if (!batch_supported())
+  {
+    cerr << "Error: the occlusion benchmark draws through a batch, which needs OpenGL 3.2" << endl;
+    return;
+  }
+  const int FRAMES = 60;
+  const int WALL_ROWS = 6;  // rows of objects between two walls
+
+  vector<Vertex> cube_vertices, suzanne_vertices;
+  vector<GLushort> cube_elements;
+  cube_geometry(cube_vertices, cube_elements);
+  AssetHandle suzanne = assets_acquire_obj(assets, "suzanne.obj");
+  if (suzanne < 0) return;
+  obj_geometry(assets_get(assets, suzanne).vertices, suzanne_vertices);
+  vector<GLushort> suzanne_elements = assets_get(assets, suzanne).elements;
+  assets_release(assets, suzanne);
+
+  // the walls are the occluders, the cube geometry stretched
+  OcclusionScene scene;
+  scene.meshes.resize(1);
+  for (size_t i = 0; i < cube_vertices.size(); i++)
+    scene.meshes[0].positions.push_back(cube_vertices[i].position);
+  scene.meshes[0].elements = cube_elements;
+
+  int side = (int)ceil(sqrt((double)objects));
+  float extent = 3.0f * side;
+  vector<glm::mat4> models(objects);
+  for (int n = 0; n < objects; n++)
+  {
+    glm::vec3 position(3.0f * (n % side - side / 2), 0.0f, 3.0f * (n / side - side / 2));
+    models[n] = glm::translate(glm::mat4(1.0f), position);
+    // spinning around y, suzanne's ears reach about 1.7 from the center
+    scene.box_min.push_back(position - glm::vec3(1.75, 1.25, 1.75));
+    scene.box_max.push_back(position + glm::vec3(1.75, 1.25, 1.75));
+  }
+  for (int row = WALL_ROWS; row < side; row += WALL_ROWS)
+  {
+    glm::vec3 center(-1.5f, 1.5f, 3.0f * (row - side / 2) - 1.5f);
+    scene.occluder_meshes.push_back(0);
+    scene.occluder_models.push_back(glm::scale(glm::translate(glm::mat4(1.0f), center),
+      glm::vec3(extent * 0.5f + 3.0f, 3.0f, 0.25f)));
+  }
+  int walls = scene.occluder_models.size();
+
+  Batch batch;
+  if (!batch_init(batch, batch_multi_draw_supported(), objects + walls)) return;
+  int mesh_ids[2];
+  mesh_ids[0] = batch_add_mesh(batch, cube_vertices, cube_elements);
+  mesh_ids[1] = batch_add_mesh(batch, suzanne_vertices, suzanne_elements);
+  batch_upload(batch);
+
+  gl_state_enable(GL_DEPTH_TEST, true);
+  printf("%d objects, %d walls, %dx%d depth buffer, %d threads\n", objects, walls,
+    OCCLUSION_WIDTH, OCCLUSION_HEIGHT, parallel_threads());
+
+  OcclusionJob jobs[2];
+  for (int occlusion = 0; occlusion < 2; occlusion++)
+  {
+    double submit_seconds = 0.0, wait_seconds = 0.0, cull_seconds = 0.0;
+    long drawn = 0;
+    if (occlusion)
+    {
+      occlusion_begin(jobs[0], scene, benchmark_camera(0, extent));
+      occlusion_end(jobs[0]);
+    }
+
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+      // cull the next frame while this one is submitted and rendered
+      OcclusionJob &current = jobs[frame % 2], &next = jobs[(frame + 1) % 2];
+      bool ahead = occlusion && frame + 1 < FRAMES;
+      if (ahead)
+        occlusion_begin(next, scene, benchmark_camera(frame + 1, extent));
+
+      gl_state_clear_color(1.0, 1.0, 1.0, 1.0);
+      glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+
+      Clock::time_point start = Clock::now();
+      batch_begin(batch);
+      for (int i = 0; i < walls; i++)
+        batch_draw(batch, mesh_ids[0], scene.occluder_models[i]);
+      for (int n = 0; n < objects; n++)
+      {
+        if (occlusion && !current.visible[n]) continue;
+        batch_draw(batch, mesh_ids[n % 2], glm::rotate(models[n], frame * 0.05f + n, glm::vec3(0.0, 1.0, 0.0)));
+      }
+      drawn += batch.draw_count - walls;
+      batch_submit(batch, benchmark_camera(frame, extent), texture_id);
+      submit_seconds += seconds_since(start);
+
+      if (occlusion)
+        cull_seconds += current.seconds;
+      if (ahead)
+      {
+        start = Clock::now();
+        occlusion_end(next);
+        wait_seconds += seconds_since(start);
+      }
+    }
+    glFinish();
+
+    printf("  %-18s %8.1f%% culled %10.3f ms submit/frame", occlusion ? "occlusion culling" : "no culling",
+      100.0 * (1.0 - (double)drawn / ((double)objects * FRAMES)), submit_seconds * 1000.0 / FRAMES);
+    if (occlusion)
+      printf(" %10.3f ms culling/frame %10.3f ms waiting/frame", cull_seconds * 1000.0 / FRAMES,
+        wait_seconds * 1000.0 / FRAMES);
+    printf("\n");
+  }
+  batch_free(batch);
+}
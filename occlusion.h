@@ -0,0 +1,82 @@
+#ifndef _OCCLUSION_H
+#define _OCCLUSION_H
+
+#include <stdint.h>
+#include <future>
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "assets.h"
+
+// the software depth buffer, small enough to rasterize in well under a millisecond
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_MAX_LEVELS 16
+
+// Level 0 holds the nearest occluder depth of every pixel, as window z in
+// [0, 1] with 1 where nothing was drawn. Every other level keeps the
+// farthest of the 2x2 texels below it, so a box whose nearest point is
+// behind a texel is behind everything that texel covers.
+struct DepthPyramid
+{
+  int levels;
+  int width[OCCLUSION_MAX_LEVELS], height[OCCLUSION_MAX_LEVELS];
+  std::vector<float> depth[OCCLUSION_MAX_LEVELS];
+};
+
+// occluder geometry, for example a low-poly box or load_obj output
+struct OccluderMesh
+{
+  std::vector<glm::vec3> positions;
+  std::vector<GLushort> elements;
+};
+
+// What a culling job reads. It runs on another thread, so the scene must
+// not change between occlusion_begin and occlusion_end.
+struct OcclusionScene
+{
+  std::vector<OccluderMesh> meshes;
+  std::vector<int> occluder_meshes;  // an index in meshes per occluder
+  std::vector<glm::mat4> occluder_models;
+  std::vector<glm::vec3> box_min, box_max;  // occludee AABBs in world space
+};
+
+// one frame's culling, running on a worker thread
+struct OcclusionJob
+{
+  DepthPyramid pyramid;
+  glm::mat4 view_projection;
+  const OcclusionScene* scene;
+  std::vector<uint8_t> visible;  // 1 per occludee box
+  std::future<void> pending;
+  int visible_count;
+  double seconds;  // worker time spent on the job
+};
+
+void occlusion_clear(DepthPyramid &pyramid);
+// rasterize the triangles of positions transformed by mvp into level 0;
+// triangles crossing the near plane are skipped, they would only hide less
+void occlusion_rasterize(DepthPyramid &pyramid, const glm::mat4 &mvp,
+  const std::vector<glm::vec3> &positions, const std::vector<GLushort> &elements);
+void occlusion_build_pyramid(DepthPyramid &pyramid);
+// false when the box is off screen or behind the occluders
+bool occlusion_test_box(const DepthPyramid &pyramid, const glm::mat4 &view_projection,
+  const glm::vec3 &box_min, const glm::vec3 &box_max);
+
+// Start culling the scene for view_projection on a worker thread: the
+// occluders are rasterized, the pyramid built and the boxes tested, split
+// across parallel_for threads. Render the previous frame meanwhile.
+void occlusion_begin(OcclusionJob &job, const OcclusionScene &scene, const glm::mat4 &view_projection);
+// wait for the job, returns its visible flags
+const uint8_t* occlusion_end(OcclusionJob &job);
+
+// Fly over a grid of objects split by walls, drawing through a batch with
+// and without occlusion culling one frame ahead. Prints the culled
+// percentage, the culling cost and the render thread's wait per frame.
+void occlusion_benchmark(int objects, GLuint texture_id, AssetManager &assets);
+
+#endif
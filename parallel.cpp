@@ -0,0 +1,113 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// the parallel_for being run; workers wake up when generation changes
+struct Pool
+{
+  mutex call;  // held by the running parallel_for, callers on other threads queue up
+  mutex lock;
+  condition_variable wake, done;
+  vector<thread> workers;
+  unsigned generation;
+  const function<void(int, int)>* body;
+  int count, grain, chunks;
+  int active;  // workers inside run_chunks
+  atomic<int> next_chunk;
+  atomic<int> finished_chunks;
+};
+// never destroyed: the detached workers still wait on it while the process exits
+static Pool &pool = *new Pool();
+
+static void run_chunks()
+{
+  int chunk;
+  while ((chunk = pool.next_chunk.fetch_add(1)) < pool.chunks)
+  {
+    int begin = chunk * pool.grain;
+    int end = begin + pool.grain < pool.count ? begin + pool.grain : pool.count;
+    (*pool.body)(begin, end);
+    if (pool.finished_chunks.fetch_add(1) + 1 == pool.chunks)
+    {
+      lock_guard<mutex> guard(pool.lock);
+      pool.done.notify_one();
+    }
+  }
+}
+
+static void worker()
+{
+  unsigned seen = 0;
+  for (;;)
+  {
+    {
+      unique_lock<mutex> guard(pool.lock);
+      pool.wake.wait(guard, [&] { return pool.generation != seen; });
+      seen = pool.generation;
+      pool.active++;
+    }
+    run_chunks();
+    {
+      lock_guard<mutex> guard(pool.lock);
+      pool.active--;
+      pool.done.notify_one();
+    }
+  }
+}
+
+int parallel_threads()
+{
+  static once_flag started;
+  call_once(started, [] {
+    int workers = (int)thread::hardware_concurrency() - 1;
+    pool.generation = 0;
+    pool.chunks = 0;
+    pool.active = 0;
+    for (int i = 0; i < workers; i++)
+    {
+      pool.workers.push_back(thread(worker));
+      // the pool lives as long as the process
+      pool.workers.back().detach();
+    }
+  });
+  return pool.workers.size() + 1;
+}
+
+void parallel_for(int count, int grain, const function<void(int, int)> &body)
+{
+  if (count <= 0) return;
+  if (grain < 1) grain = 1;
+
+  int chunks = (count + grain - 1) / grain;
+  if (1 == chunks || 1 == parallel_threads())
+  {
+    body(0, count);
+    return;
+  }
+
+  lock_guard<mutex> call(pool.call);
+  {
+    // a worker that woke up late for the previous call must be out of it first
+    unique_lock<mutex> guard(pool.lock);
+    pool.done.wait(guard, [] { return 0 == pool.active; });
+    pool.body = &body;
+    pool.count = count;
+    pool.grain = grain;
+    pool.chunks = chunks;
+    pool.next_chunk = 0;
+    pool.finished_chunks = 0;
+    pool.generation++;
+  }
+  pool.wake.notify_all();
+
+  // the calling thread takes chunks too, then waits for the stragglers
+  run_chunks();
+  unique_lock<mutex> guard(pool.lock);
+  pool.done.wait(guard, [] { return pool.finished_chunks == pool.chunks && 0 == pool.active; });
+}
@@ -0,0 +1,16 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <functional>
+
+// Threads running parallel_for: a pool of hardware_concurrency - 1 workers
+// started on first use, plus the calling thread.
+int parallel_threads();
+
+// Split [0, count) into chunks of at most grain items and run body(begin, end)
+// on every thread; returns once all chunks are done. Chunks run in any order,
+// so body must only touch the items it was given. Calls from different
+// threads take turns; calls must not nest.
+void parallel_for(int count, int grain, const std::function<void(int, int)> &body);
+
+#endif
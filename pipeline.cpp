@@ -0,0 +1,211 @@
+#include "pipeline.h"
+#include "shader_utils.h"
+#include "program_info.h"
+#include "gl_state.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+int pipelines_supported()
+{
+  return (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) ? 1 : 0;
+}
+
+void pipeline_cache_init(PipelineCache &cache)
+{
+  cache.separable = pipelines_supported();
+  cache.pipelines.clear();
+  cache.links = 0;
+  cache.link_seconds = 0.0;
+}
+
+void pipeline_cache_free(PipelineCache &cache)
+{
+  for (auto &entry : cache.pipelines)
+  {
+    if (entry.second.pipeline)
+      glDeleteProgramPipelines(1, &entry.second.pipeline);
+    if (entry.second.program)
+      glDeleteProgram(entry.second.program);
+  }
+  cache.pipelines.clear();
+  gl_state_invalidate();
+}
+
+// link with error handling, counting the link in the cache stats
+static int link_program(PipelineCache &cache, GLuint program)
+{
+  Clock::time_point start = Clock::now();
+  glLinkProgram(program);
+  GLint link_ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+  cache.link_seconds += seconds_since(start);
+  cache.links++;
+
+  if (!link_ok)
+  {
+    cerr << "glLinkProgram:";
+    print_log(program);
+    return 0;
+  }
+  return 1;
+}
+
+int create_stage_program(PipelineCache &cache, StageProgram &stage, const string filename,
+  GLenum type, int glsl_version, const string defines,
+  const char* const attribute_names[], int attribute_count)
+{
+  stage.type = type;
+  stage.program = 0;
+  stage.shader = create_shader(filename, type, glsl_version, defines);
+  if (0 == stage.shader) return 0;
+
+  if (!cache.separable) return 1;
+
+  stage.program = glCreateProgram();
+  glProgramParameteri(stage.program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+  if (GL_VERTEX_SHADER == type)
+    program_bind_attributes(stage.program, attribute_names, attribute_count);
+  glAttachShader(stage.program, stage.shader);
+  if (!link_program(cache, stage.program))
+  {
+    free_stage_program(stage);
+    return 0;
+  }
+  glDetachShader(stage.program, stage.shader);
+  return 1;
+}
+
+void free_stage_program(StageProgram &stage)
+{
+  glDeleteShader(stage.shader);
+  glDeleteProgram(stage.program);
+  stage.shader = stage.program = 0;
+  gl_state_invalidate();
+}
+
+const Pipeline* pipeline_get(PipelineCache &cache, const StageProgram &vs, const StageProgram &fs,
+  const char* const attribute_names[], int attribute_count)
+{
+  uint64_t key = ((uint64_t)vs.shader << 32) | fs.shader;
+  unordered_map<uint64_t, Pipeline>::iterator found = cache.pipelines.find(key);
+  if (found != cache.pipelines.end())
+    return &found->second;
+
+  Pipeline pipeline = { 0, 0 };
+  if (cache.separable)
+  {
+    // no link here, the stages were linked once when they were created
+    glGenProgramPipelines(1, &pipeline.pipeline);
+    glUseProgramStages(pipeline.pipeline, GL_VERTEX_SHADER_BIT, vs.program);
+    glUseProgramStages(pipeline.pipeline, GL_FRAGMENT_SHADER_BIT, fs.program);
+  }
+  else
+  {
+    pipeline.program = glCreateProgram();
+    glAttachShader(pipeline.program, vs.shader);
+    glAttachShader(pipeline.program, fs.shader);
+    program_bind_attributes(pipeline.program, attribute_names, attribute_count);
+    if (!link_program(cache, pipeline.program))
+    {
+      glDeleteProgram(pipeline.program);
+      return NULL;
+    }
+  }
+  return &(cache.pipelines[key] = pipeline);
+}
+
+void pipeline_bind(const Pipeline &pipeline)
+{
+  if (pipeline.pipeline)
+  {
+    // a bound program would take precedence over the pipeline
+    gl_state_use_program(0);
+    glBindProgramPipeline(pipeline.pipeline);
+  }
+  else
+    gl_state_use_program(pipeline.program);
+}
+
+GLuint pipeline_stage_program(const Pipeline &pipeline, const StageProgram &stage)
+{
+  return pipeline.pipeline ? stage.program : pipeline.program;
+}
+
+// Build every permutation with the given cache and set seconds to the time
+// taken. Returns 1 when all is ok, 0 with a displayed error.
+static int build_permutations(PipelineCache &cache, int vs_variants, int fs_variants, int glsl_version,
+  double &seconds)
+{
+  const char* attribute_names[] = { "coord3d", "texcoord" };
+  Clock::time_point start = Clock::now();
+
+  // zeroed, so a failed stage can be freed along with the others
+  vector<StageProgram> vertex(vs_variants), fragment(fs_variants);
+  char defines[64];
+  int ok = 1;
+  // a distinct define per variant, so the driver cannot share compiles between them
+  for (int i = 0; i < vs_variants && ok; i++)
+  {
+    snprintf(defines, sizeof(defines), "#define VARIANT %d\n", i);
+    ok = create_stage_program(cache, vertex[i], "cube.v.glsl", GL_VERTEX_SHADER, glsl_version,
+      defines, attribute_names, 2);
+  }
+  for (int i = 0; i < fs_variants && ok; i++)
+  {
+    snprintf(defines, sizeof(defines), "#define VARIANT %d\n", i);
+    ok = create_stage_program(cache, fragment[i], "cube.f.glsl", GL_FRAGMENT_SHADER, glsl_version,
+      defines, attribute_names, 2);
+  }
+  for (int v = 0; v < vs_variants && ok; v++)
+    for (int f = 0; f < fs_variants && ok; f++)
+      if (NULL == pipeline_get(cache, vertex[v], fragment[f], attribute_names, 2))
+        ok = 0;
+  glFinish();
+
+  seconds = seconds_since(start);
+  pipeline_cache_free(cache);
+  for (int i = 0; i < vs_variants; i++) free_stage_program(vertex[i]);
+  for (int i = 0; i < fs_variants; i++) free_stage_program(fragment[i]);
+  return ok;
+}
+
+int pipeline_benchmark(int vs_variants, int fs_variants, int glsl_version)
+{
+  PipelineCache monolithic, separable;
+  pipeline_cache_init(monolithic);
+  monolithic.separable = false;
+  double monolithic_seconds;
+  if (!build_permutations(monolithic, vs_variants, fs_variants, glsl_version, monolithic_seconds)) return 0;
+
+  cout << vs_variants << " x " << fs_variants << " permutations" << endl;
+  cout << "  monolithic programs: " << monolithic.links << " links, "
+       << monolithic.link_seconds * 1000.0 << " ms linking, "
+       << monolithic_seconds * 1000.0 << " ms total" << endl;
+
+  pipeline_cache_init(separable);
+  if (!separable.separable)
+  {
+    cout << "  separable pipelines: not supported by this context" << endl;
+    return 1;
+  }
+  double separable_seconds;
+  if (!build_permutations(separable, vs_variants, fs_variants, glsl_version, separable_seconds)) return 0;
+  cout << "  separable pipelines: " << separable.links << " links, "
+       << separable.link_seconds * 1000.0 << " ms linking, "
+       << separable_seconds * 1000.0 << " ms total" << endl;
+  cout << "  saved " << monolithic.links - separable.links << " links, "
+       << (monolithic_seconds - separable_seconds) * 1000.0 << " ms of startup" << endl;
+  return 1;
+}
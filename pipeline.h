@@ -0,0 +1,62 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <GL/glew.h>
+
+// One compiled shader stage. With separable programs it is also linked on its
+// own, so any vertex stage can be paired with any fragment stage at draw time.
+struct StageProgram
+{
+  GLenum type;
+  GLuint shader;
+  GLuint program;  // GL_PROGRAM_SEPARABLE program, 0 without separate shader objects
+};
+
+// a vertex/fragment pair ready to draw with
+struct Pipeline
+{
+  GLuint pipeline;  // program pipeline object, 0 on the fallback path
+  GLuint program;   // monolithic program on the fallback path, 0 otherwise
+};
+
+// Pipelines cached by stage-pair key. Without separate shader objects every
+// new pair is linked into a monolithic program instead, and cached the same way.
+struct PipelineCache
+{
+  bool separable;
+  std::unordered_map<uint64_t, Pipeline> pipelines;
+  int links;            // glLinkProgram calls made through the cache
+  double link_seconds;  // time spent in them
+};
+
+// GL 4.1 or ARB_separate_shader_objects
+int pipelines_supported();
+
+void pipeline_cache_init(PipelineCache &cache);
+void pipeline_cache_free(PipelineCache &cache);
+
+// Compile (and when separable, link) one stage. Vertex stages get
+// attribute_names bound to locations 0..attribute_count-1.
+// Returns 1 when all is ok, 0 with a displayed error.
+int create_stage_program(PipelineCache &cache, StageProgram &stage, const std::string filename,
+  GLenum type, int glsl_version, const std::string defines,
+  const char* const attribute_names[], int attribute_count);
+void free_stage_program(StageProgram &stage);
+
+// the pipeline for a stage pair, created on first use; NULL when linking fails
+const Pipeline* pipeline_get(PipelineCache &cache, const StageProgram &vs, const StageProgram &fs,
+  const char* const attribute_names[], int attribute_count);
+void pipeline_bind(const Pipeline &pipeline);
+
+// program to pass to glProgramUniform* for a stage of this pipeline
+GLuint pipeline_stage_program(const Pipeline &pipeline, const StageProgram &stage);
+
+// Build vs_variants x fs_variants permutations of the cube shaders both ways
+// and print the link counts and times. Returns 1 when all is ok, 0 with a
+// displayed error.
+int pipeline_benchmark(int vs_variants, int fs_variants, int glsl_version);
+
+#endif
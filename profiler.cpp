@@ -0,0 +1,212 @@
+#include "profiler.h"
+
+#ifdef PROFILER_ENABLED
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+using namespace std;
+
+struct ScopeStats
+{
+  string name;
+  int depth;  // nesting when first seen, for the report's indentation
+  // since the last report
+  int calls;
+  double cpu_seconds, gpu_seconds;
+};
+
+// a scope being timed
+struct OpenScope
+{
+  int scope;
+  double cpu_start;
+  int pair;  // its timestamp pair in the frame's queries, -1 without GPU timing
+};
+
+// the GPU timestamps recorded in one frame, begin and end per pair
+struct FrameQueries
+{
+  vector<GLuint> queries;
+  vector<int> scopes;
+  int used;
+};
+
+struct Profiler
+{
+  bool enabled, gpu;
+  int report_frames;
+  int frames, gpu_frames, dropped_frames;  // since the last report
+  vector<ScopeStats> scopes;
+  vector<OpenScope> open;
+  FrameQueries queries[PROFILE_LATENCY];
+  int frame;  // the slot in queries being recorded
+};
+static Profiler profiler;
+
+static double now()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profile_init(int report_frames)
+{
+  profiler.enabled = true;
+  profiler.gpu = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+  profiler.report_frames = report_frames > 0 ? report_frames : 1;
+  profiler.frames = profiler.gpu_frames = profiler.dropped_frames = 0;
+  profiler.frame = 0;
+  for (int i = 0; i < PROFILE_LATENCY; i++)
+    profiler.queries[i].used = 0;
+}
+
+void profile_free()
+{
+  for (int i = 0; i < PROFILE_LATENCY; i++)
+  {
+    FrameQueries &frame = profiler.queries[i];
+    if (!frame.queries.empty())
+      glDeleteQueries(frame.queries.size(), &frame.queries[0]);
+    frame.queries.clear();
+    frame.scopes.clear();
+    frame.used = 0;
+  }
+  profiler.enabled = false;
+}
+
+int profile_scope_id(const char* name)
+{
+  for (size_t i = 0; i < profiler.scopes.size(); i++)
+    if (profiler.scopes[i].name == name)
+      return i;
+  if (profiler.scopes.size() == PROFILE_MAX_SCOPES)
+  {
+    fprintf(stderr, "profile_scope_id: more than %d scopes, %s shares the last one\n", PROFILE_MAX_SCOPES, name);
+    return PROFILE_MAX_SCOPES - 1;
+  }
+
+  ScopeStats stats;
+  stats.name = name;
+  stats.depth = -1;
+  stats.calls = 0;
+  stats.cpu_seconds = stats.gpu_seconds = 0.0;
+  profiler.scopes.push_back(stats);
+  return profiler.scopes.size() - 1;
+}
+
+void profile_begin(int scope)
+{
+  if (!profiler.enabled) return;
+
+  OpenScope open;
+  open.scope = scope;
+  open.pair = -1;
+  if (profiler.scopes[scope].depth < 0)
+    profiler.scopes[scope].depth = profiler.open.size();
+
+  if (profiler.gpu)
+  {
+    FrameQueries &frame = profiler.queries[profiler.frame];
+    open.pair = frame.used++;
+    if ((int)frame.scopes.size() < frame.used)
+    {
+      GLuint pair[2];
+      glGenQueries(2, pair);
+      frame.queries.push_back(pair[0]);
+      frame.queries.push_back(pair[1]);
+      frame.scopes.push_back(scope);
+    }
+    frame.scopes[open.pair] = scope;
+    glQueryCounter(frame.queries[2 * open.pair], GL_TIMESTAMP);
+  }
+
+  open.cpu_start = now();
+  profiler.open.push_back(open);
+}
+
+void profile_end(int scope)
+{
+  if (!profiler.enabled || profiler.open.empty()) return;
+
+  OpenScope open = profiler.open.back();
+  profiler.open.pop_back();
+  // the scopes nest, a mismatch means a begin without its end
+  if (open.scope != scope)
+    fprintf(stderr, "profile_end: %s ends inside %s\n", profiler.scopes[scope].name.c_str(),
+      profiler.scopes[open.scope].name.c_str());
+  ScopeStats &stats = profiler.scopes[open.scope];
+  stats.cpu_seconds += now() - open.cpu_start;
+  stats.calls++;
+  if (open.pair >= 0)
+    glQueryCounter(profiler.queries[profiler.frame].queries[2 * open.pair + 1], GL_TIMESTAMP);
+}
+
+// add up a frame recorded PROFILE_LATENCY - 1 frames ago, unless the GPU is
+// even further behind, then the frame is dropped rather than waited for
+static void resolve(FrameQueries &frame)
+{
+  if (0 == frame.used) return;
+
+  GLint available = 0;
+  glGetQueryObjectiv(frame.queries[2 * frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available)
+  {
+    for (int pair = 0; pair < frame.used; pair++)
+    {
+      GLuint64 begin, end;
+      glGetQueryObjectui64v(frame.queries[2 * pair], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(frame.queries[2 * pair + 1], GL_QUERY_RESULT, &end);
+      profiler.scopes[frame.scopes[pair]].gpu_seconds += (end - begin) / 1e9;
+    }
+    profiler.gpu_frames++;
+  }
+  else
+    profiler.dropped_frames++;
+  frame.used = 0;
+}
+
+static void report()
+{
+  printf("%-28s %12s %12s", "scope", "calls/frame", "CPU ms");
+  if (profiler.gpu_frames > 0)
+    printf(" %12s", "GPU ms");
+  printf("\n");
+  for (size_t i = 0; i < profiler.scopes.size(); i++)
+  {
+    ScopeStats &stats = profiler.scopes[i];
+    if (stats.depth < 0) continue;
+
+    string name = string(2 * stats.depth, ' ') + stats.name;
+    printf("%-28s %12.1f %12.3f", name.c_str(), (double)stats.calls / profiler.frames,
+      stats.cpu_seconds * 1000.0 / profiler.frames);
+    if (profiler.gpu_frames > 0)
+      printf(" %12.3f", stats.gpu_seconds * 1000.0 / profiler.gpu_frames);
+    printf("\n");
+
+    stats.calls = 0;
+    stats.cpu_seconds = stats.gpu_seconds = 0.0;
+  }
+  if (profiler.dropped_frames > 0)
+    printf("(%d frames of GPU times dropped, the GPU ran more than %d frames behind)\n",
+      profiler.dropped_frames, PROFILE_LATENCY - 1);
+  profiler.frames = profiler.gpu_frames = profiler.dropped_frames = 0;
+}
+
+void profile_frame_end()
+{
+  if (!profiler.enabled) return;
+
+  profiler.frames++;
+  if (profiler.gpu)
+  {
+    profiler.frame = (profiler.frame + 1) % PROFILE_LATENCY;
+    resolve(profiler.queries[profiler.frame]);
+  }
+  if (profiler.frames == profiler.report_frames)
+    report();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+// Named CPU/GPU timing scopes, reported as a per-scope table on the console.
+// Release builds (-DNDEBUG, which make release sets) compile every PROFILE_
+// macro to nothing, unless PROFILER is defined as well.
+#if !defined(NDEBUG) || defined(PROFILER)
+#define PROFILER_ENABLED 1
+#endif
+
+#ifdef PROFILER_ENABLED
+
+#define PROFILE_MAX_SCOPES 64
+// frames between recording a GPU timestamp and reading it back, so the
+// read never waits for the GPU
+#define PROFILE_LATENCY 4
+
+// Start profiling, every report_frames frames the table is printed. GPU
+// times need GL 3.3 or ARB_timer_query, without them only the CPU is timed.
+void profile_init(int report_frames);
+void profile_free();
+// the scope's id, the same for every call with the same name
+int profile_scope_id(const char* name);
+void profile_begin(int scope);
+void profile_end(int scope);
+// after the frame's swap: reads back old timestamps and prints the report
+void profile_frame_end();
+
+// times the rest of the enclosing block
+struct ProfileScope
+{
+  int scope;
+  ProfileScope(int scope) : scope(scope) { profile_begin(scope); }
+  ~ProfileScope() { profile_end(scope); }
+};
+
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(name) \
+  static int PROFILE_JOIN(profile_id_, __LINE__) = profile_scope_id(name); \
+  ProfileScope PROFILE_JOIN(profile_scope_, __LINE__)(PROFILE_JOIN(profile_id_, __LINE__))
+#define PROFILE_INIT(report_frames) profile_init(report_frames)
+#define PROFILE_FREE() profile_free()
+#define PROFILE_FRAME_END() profile_frame_end()
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_INIT(report_frames)
+#define PROFILE_FREE()
+#define PROFILE_FRAME_END()
+
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+#include "program_info.h"
+
+#include <iostream>
+
+using namespace std;
+
+static const char* kind_names[] = { "attribute", "uniform", "uniform block" };
+
+void program_bind_attributes(GLuint program, const char* const names[], int count)
+{
+  for (int i = 0; i < count; i++)
+    glBindAttribLocation(program, i, names[i]);
+}
+
+// "lights[0]" is reported for arrays, but we want to look them up as "lights"
+static string strip_array_suffix(const char* name)
+{
+  string s(name);
+  size_t bracket = s.find('[');
+  if (bracket != string::npos)
+    s.erase(bracket);
+  return s;
+}
+
+static void add_var(ProgramInfo &info, ProgramVarKind kind, const string &name,
+  GLint location, GLenum type, GLint size)
+{
+  ProgramVar var;
+  var.hash = name_hash(name.c_str());
+  var.kind = kind;
+  var.location = location;
+  var.type = type;
+  var.size = size;
+  var.name = name;
+  info.vars.push_back(var);
+}
+
+// fill the hash table, kept at most half full so probe sequences stay short
+static void build_slots(ProgramInfo &info)
+{
+  size_t capacity = 8;
+  while (capacity < info.vars.size() * 2)
+    capacity *= 2;
+  info.slots.assign(capacity, -1);
+
+  size_t mask = capacity - 1;
+  for (size_t i = 0; i < info.vars.size(); i++)
+  {
+    size_t slot = info.vars[i].hash & mask;
+    while (info.slots[slot] != -1)
+      slot = (slot + 1) & mask;
+    info.slots[slot] = i;
+  }
+}
+
+int program_reflect(GLuint program, ProgramInfo &info)
+{
+  info.program = program;
+  info.vars.clear();
+  info.slots.clear();
+
+  GLint link_ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+  if (!link_ok)
+  {
+    cerr << "program_reflect: program " << program << " is not linked" << endl;
+    return 0;
+  }
+
+  GLint count = 0, max_length = 0;
+  GLint size;
+  GLenum type;
+
+  // ----- ATTRIBUTES -----
+  glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+  glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+  vector<GLchar> name(max_length + 1);
+  for (GLint i = 0; i < count; i++)
+  {
+    glGetActiveAttrib(program, i, name.size(), NULL, &size, &type, &name[0]);
+    GLint location = glGetAttribLocation(program, &name[0]);
+    // built-ins such as gl_Vertex have no location
+    if (-1 == location) continue;
+    add_var(info, VAR_ATTRIBUTE, strip_array_suffix(&name[0]), location, type, size);
+  }
+
+  // ----- UNIFORMS -----
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+  name.resize(max_length + 1);
+  for (GLint i = 0; i < count; i++)
+  {
+    glGetActiveUniform(program, i, name.size(), NULL, &size, &type, &name[0]);
+    GLint location = glGetUniformLocation(program, &name[0]);
+    // members of uniform blocks have no location, they are reached through the block
+    if (-1 == location) continue;
+    add_var(info, VAR_UNIFORM, strip_array_suffix(&name[0]), location, type, size);
+  }
+
+  // ----- UNIFORM BLOCKS -----
+  if (GLEW_VERSION_3_1 || GLEW_ARB_uniform_buffer_object)
+  {
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+    name.resize(max_length + 1);
+    for (GLint i = 0; i < count; i++)
+    {
+      glGetActiveUniformBlockName(program, i, name.size(), NULL, &name[0]);
+      glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+      add_var(info, VAR_BLOCK, strip_array_suffix(&name[0]), i, 0, size);
+    }
+  }
+
+  build_slots(info);
+  return 1;
+}
+
+const ProgramVar* program_find(const ProgramInfo &info, uint32_t hash, ProgramVarKind kind)
+{
+  if (info.slots.empty())
+    return NULL;
+
+  size_t mask = info.slots.size() - 1;
+  for (size_t slot = hash & mask; info.slots[slot] != -1; slot = (slot + 1) & mask)
+  {
+    const ProgramVar &var = info.vars[info.slots[slot]];
+    if (var.hash == hash && var.kind == kind)
+      return &var;
+  }
+  return NULL;
+}
+
+GLint program_location(const ProgramInfo &info, uint32_t hash, ProgramVarKind kind)
+{
+  const ProgramVar* var = program_find(info, hash, kind);
+  return var ? var->location : -1;
+}
+
+int program_require(const ProgramInfo &info, const ProgramVarName names[], int count, GLint locations[])
+{
+  int ok = 1;
+  for (int i = 0; i < count; i++)
+  {
+    const ProgramVar* var = program_find(info, name_hash(names[i].name), names[i].kind);
+    if (NULL == var || var->name != names[i].name)
+    {
+      cerr << "Could not bind " << kind_names[names[i].kind] << " " << names[i].name << endl;
+      locations[i] = -1;
+      ok = 0;
+      continue;
+    }
+    locations[i] = var->location;
+  }
+  return ok;
+}
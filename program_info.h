@@ -0,0 +1,63 @@
+#ifndef _PROGRAM_INFO_H
+#define _PROGRAM_INFO_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// FNV-1a hash of a shader variable name. It is constexpr so draw code can
+// look locations up with a hash computed at compile time, no strings involved.
+constexpr uint32_t name_hash(const char* s, uint32_t h = 2166136261u)
+{
+  return *s ? name_hash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+enum ProgramVarKind { VAR_ATTRIBUTE, VAR_UNIFORM, VAR_BLOCK };
+
+// one active attribute, uniform or uniform block of a linked program
+struct ProgramVar
+{
+  uint32_t hash;
+  ProgramVarKind kind;
+  GLint location;  // attribute/uniform location, or block index
+  GLenum type;     // 0 for blocks
+  GLint size;      // array length, or block data size in bytes
+  std::string name;
+};
+
+// a name the application expects the program to expose
+struct ProgramVarName
+{
+  const char* name;
+  ProgramVarKind kind;
+};
+
+// Reflection data stored with a program: every active variable in a flat
+// array, plus an open-addressed hash table of indices into it.
+struct ProgramInfo
+{
+  GLuint program;
+  std::vector<ProgramVar> vars;
+  std::vector<int> slots;  // power of two sized, -1 = empty
+};
+
+// Give attributes explicit locations (names[i] -> i) before glLinkProgram,
+// so attribute locations are known without any lookup.
+void program_bind_attributes(GLuint program, const char* const names[], int count);
+
+// Enumerate all active attributes, uniforms and uniform blocks of a linked
+// program. Returns 1 when all is ok, 0 when the program is not linked.
+int program_reflect(GLuint program, ProgramInfo &info);
+
+// O(1) lookup, returns NULL when the program has no such variable
+const ProgramVar* program_find(const ProgramInfo &info, uint32_t hash, ProgramVarKind kind);
+
+// location (or block index) of a variable, -1 when it is not active
+GLint program_location(const ProgramInfo &info, uint32_t hash, ProgramVarKind kind);
+
+// Resolve every expected name into locations[i], reporting each missing
+// variable once. Returns 1 when all names were found, 0 otherwise.
+int program_require(const ProgramInfo &info, const ProgramVarName names[], int count, GLint locations[]);
+
+#endif
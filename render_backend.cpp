@@ -0,0 +1,445 @@
+#include "render_backend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "culling.h"
+#include "entities.h"
+#include "gl_state.h"
+#include "parallel.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+void render_backend_init(RenderBackend &backend, RenderBackendType type,
+  const vector<Mesh>* meshes, UniformBuffers* ubo)
+{
+  backend.type = type;
+  backend.meshes = meshes;
+  backend.pool = NULL;
+  backend.ubo = ubo;
+  backend.bound_mesh = -1;
+  backend.recording = RENDER_BACKEND_RECORD == type;
+  backend.stream.clear();
+  for (int i = 0; i < RENDER_COMMAND_COUNT; i++)
+    backend.commands[i] = 0;
+}
+
+// count the command, true when the caller should make the GL calls
+static bool begin_command(RenderBackend &backend, RenderCommand command, const void* args, size_t size)
+{
+  backend.commands[command]++;
+  if (backend.recording)
+  {
+    size_t at = backend.stream.size();
+    backend.stream.resize(at + 1 + size);
+    backend.stream[at] = (uint8_t)command;
+    if (size > 0)
+      memcpy(&backend.stream[at + 1], args, size);
+  }
+  return RENDER_BACKEND_GL == backend.type;
+}
+
+void render_clear(RenderBackend &backend, const glm::vec4 &color)
+{
+  if (!begin_command(backend, RENDER_CLEAR, &color, sizeof(color))) return;
+  gl_state_clear_color(color.x, color.y, color.z, color.w);
+  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+}
+
+void render_use_program(RenderBackend &backend, GLuint program)
+{
+  if (!begin_command(backend, RENDER_USE_PROGRAM, &program, sizeof(program))) return;
+  gl_state_use_program(program);
+}
+
+void render_bind_texture(RenderBackend &backend, GLuint unit, GLuint texture_id)
+{
+  GLuint args[2] = { unit, texture_id };
+  if (!begin_command(backend, RENDER_BIND_TEXTURE, args, sizeof(args))) return;
+  gl_state_bind_texture(GL_TEXTURE0 + unit, GL_TEXTURE_2D, texture_id);
+}
+
+void render_uniform_int(RenderBackend &backend, GLint location, GLint value)
+{
+  GLint args[2] = { location, value };
+  if (!begin_command(backend, RENDER_UNIFORM_INT, args, sizeof(args))) return;
+  gl_state_uniform_1i(location, value);
+}
+
+void render_uniform_mat4(RenderBackend &backend, GLint location, const glm::mat4 &value)
+{
+  // the location goes after the matrix, so the recorded matrix stays 4-byte aligned
+  struct { glm::mat4 value; GLint location; } args = { value, location };
+  if (!begin_command(backend, RENDER_UNIFORM_MAT4, &args, sizeof(args))) return;
+  gl_state_uniform_matrix_4fv(location, glm::value_ptr(value));
+}
+
+void render_bind_object(RenderBackend &backend, int slot)
+{
+  if (!begin_command(backend, RENDER_BIND_OBJECT, &slot, sizeof(slot))) return;
+  ubo_bind_object(*backend.ubo, slot);
+}
+
+void render_frame_block(RenderBackend &backend, const PerFrameBlock &frame)
+{
+  if (!begin_command(backend, RENDER_FRAME_BLOCK, &frame, sizeof(frame))) return;
+  ubo_set_frame(*backend.ubo, frame);
+}
+
+void render_object_blocks(RenderBackend &backend, const PerObjectBlock* blocks, int count)
+{
+  bool gl = begin_command(backend, RENDER_OBJECT_BLOCKS, &count, sizeof(count));
+  if (backend.recording && count > 0)
+  {
+    size_t at = backend.stream.size();
+    backend.stream.resize(at + count * sizeof(PerObjectBlock));
+    memcpy(&backend.stream[at], blocks, count * sizeof(PerObjectBlock));
+  }
+  if (!gl) return;
+  ubo_begin_frame(*backend.ubo);
+  for (int i = 0; i < count; i++)
+    *ubo_object(*backend.ubo, i) = blocks[i];
+  ubo_upload_objects(*backend.ubo);
+}
+
+// GL only, the mesh render_bind_mesh left bound is unbound
+static void unbind_mesh(RenderBackend &backend)
+{
+  if (backend.bound_mesh < 0) return;
+  if (NULL == backend.pool)
+    mesh_unbind((*backend.meshes)[backend.bound_mesh]);
+  backend.bound_mesh = -1;
+}
+
+void render_draw_mesh(RenderBackend &backend, int mesh)
+{
+  if (!begin_command(backend, RENDER_DRAW_MESH, &mesh, sizeof(mesh))) return;
+  unbind_mesh(backend);
+  if (backend.pool)
+  {
+    geometry_pool_bind(*backend.pool);
+    geometry_pool_draw(*backend.pool, mesh);
+  }
+  else
+    mesh_draw((*backend.meshes)[mesh]);
+}
+
+void render_bind_mesh(RenderBackend &backend, int mesh)
+{
+  if (!begin_command(backend, RENDER_BIND_MESH, &mesh, sizeof(mesh))) return;
+  unbind_mesh(backend);
+  // the pool's VAO covers all of its meshes, binding it again is free
+  if (backend.pool)
+    geometry_pool_bind(*backend.pool);
+  else
+    mesh_bind((*backend.meshes)[mesh]);
+  backend.bound_mesh = mesh;
+}
+
+void render_draw_bound(RenderBackend &backend)
+{
+  if (!begin_command(backend, RENDER_DRAW_BOUND, NULL, 0)) return;
+  if (backend.bound_mesh < 0) return;
+  if (backend.pool)
+    geometry_pool_draw(*backend.pool, backend.bound_mesh);
+  else
+    mesh_draw_bound((*backend.meshes)[backend.bound_mesh]);
+}
+
+void render_set_pass(RenderBackend &backend, int pass)
+{
+  if (!begin_command(backend, RENDER_SET_PASS, &pass, sizeof(pass))) return;
+  if (RENDER_PASS_TRANSPARENT == pass)
+  {
+    gl_state_enable(GL_BLEND, true);
+    gl_state_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gl_state_depth_mask(false);
+    gl_state_enable(GL_CULL_FACE, false);
+  }
+  else
+  {
+    gl_state_enable(GL_BLEND, false);
+    gl_state_depth_mask(true);
+    gl_state_enable(GL_CULL_FACE, true);
+  }
+}
+
+void render_frame_end(RenderBackend &backend)
+{
+  if (!begin_command(backend, RENDER_FRAME_END, NULL, 0)) return;
+  unbind_mesh(backend);
+  if (backend.ubo)
+    ubo_end_frame(*backend.ubo);
+}
+
+// the bytes of arguments following each opcode, the count of
+// RENDER_OBJECT_BLOCKS only
+static size_t argument_size(int command)
+{
+  switch (command)
+  {
+  case RENDER_CLEAR: return sizeof(glm::vec4);
+  case RENDER_USE_PROGRAM: return sizeof(GLuint);
+  case RENDER_BIND_TEXTURE: return 2 * sizeof(GLuint);
+  case RENDER_UNIFORM_INT: return 2 * sizeof(GLint);
+  case RENDER_UNIFORM_MAT4: return sizeof(glm::mat4) + sizeof(GLint);
+  case RENDER_BIND_OBJECT: return sizeof(int);
+  case RENDER_FRAME_BLOCK: return sizeof(PerFrameBlock);
+  case RENDER_OBJECT_BLOCKS: return sizeof(int);
+  case RENDER_DRAW_MESH: return sizeof(int);
+  case RENDER_FRAME_END: return 0;
+  case RENDER_BIND_MESH: return sizeof(int);
+  case RENDER_DRAW_BOUND: return 0;
+  case RENDER_SET_PASS: return sizeof(int);
+  }
+  return 0;
+}
+
+// a recorded name in this context, table is indexed by the recorded name
+template <typename T>
+static T rename(const vector<T> &table, T name)
+{
+  return (size_t)name < table.size() ? table[name] : name;
+}
+
+long render_replay(const vector<uint8_t> &stream, RenderBackend &backend, const ReplayNames* names)
+{
+  static const ReplayNames no_names;
+  if (NULL == names)
+    names = &no_names;
+  static const vector<GLint> no_locations;
+  const vector<GLint>* locations = &no_locations;  // of the recorded program in use
+
+  vector<PerObjectBlock> blocks;
+  long replayed = 0;
+  size_t at = 0;
+  while (at < stream.size())
+  {
+    int command = stream[at];
+    size_t size = argument_size(command);
+    if (RENDER_OBJECT_BLOCKS == command && at + 1 + size <= stream.size())
+    {
+      int count;
+      memcpy(&count, &stream[at + 1], sizeof(count));
+      // a negative count fails the check below
+      size += count >= 0 ? count * sizeof(PerObjectBlock) : stream.size();
+    }
+    if (command >= RENDER_COMMAND_COUNT || at + 1 + size > stream.size())
+    {
+      cerr << "render_replay: corrupt command stream at byte " << at << endl;
+      return -1;
+    }
+    bool blocks_command = RENDER_BIND_OBJECT == command || RENDER_FRAME_BLOCK == command
+      || RENDER_OBJECT_BLOCKS == command;
+    if (blocks_command && RENDER_BACKEND_GL == backend.type && NULL == backend.ubo)
+    {
+      cerr << "render_replay: the stream uses uniform blocks, the backend has none" << endl;
+      return -1;
+    }
+    if ((RENDER_DRAW_MESH == command || RENDER_BIND_MESH == command) && RENDER_BACKEND_GL == backend.type)
+    {
+      int mesh;
+      memcpy(&mesh, &stream[at + 1], sizeof(mesh));
+      bool known = backend.pool
+        ? mesh >= 0 && (size_t)mesh < backend.pool->meshes.size() && backend.pool->meshes[mesh].live
+        : mesh >= 0 && (size_t)mesh < backend.meshes->size();
+      if (!known)
+      {
+        cerr << "render_replay: the stream draws mesh " << mesh << ", the backend has no such mesh" << endl;
+        return -1;
+      }
+    }
+    // arguments are copied out, the stream has no alignment
+    const uint8_t* args = &stream[at + 1];
+    GLint ints[2];
+    glm::vec4 color;
+    glm::mat4 matrix;
+    PerFrameBlock frame;
+    switch (command)
+    {
+    case RENDER_CLEAR:
+      memcpy(&color, args, sizeof(color));
+      render_clear(backend, color);
+      break;
+    case RENDER_USE_PROGRAM:
+      memcpy(ints, args, sizeof(GLuint));
+      locations = (size_t)ints[0] < names->locations.size() ? &names->locations[ints[0]] : &no_locations;
+      render_use_program(backend, rename(names->programs, (GLuint)ints[0]));
+      break;
+    case RENDER_BIND_TEXTURE:
+      memcpy(ints, args, 2 * sizeof(GLuint));
+      render_bind_texture(backend, (GLuint)ints[0], rename(names->textures, (GLuint)ints[1]));
+      break;
+    case RENDER_UNIFORM_INT:
+      memcpy(ints, args, 2 * sizeof(GLint));
+      render_uniform_int(backend, rename(*locations, ints[0]), ints[1]);
+      break;
+    case RENDER_UNIFORM_MAT4:
+      memcpy(&matrix, args, sizeof(matrix));
+      memcpy(ints, args + sizeof(matrix), sizeof(GLint));
+      render_uniform_mat4(backend, rename(*locations, ints[0]), matrix);
+      break;
+    case RENDER_BIND_OBJECT:
+      memcpy(ints, args, sizeof(int));
+      render_bind_object(backend, ints[0]);
+      break;
+    case RENDER_FRAME_BLOCK:
+      memcpy(&frame, args, sizeof(frame));
+      render_frame_block(backend, frame);
+      break;
+    case RENDER_OBJECT_BLOCKS:
+      memcpy(ints, args, sizeof(int));
+      blocks.resize(ints[0]);
+      if (!blocks.empty())
+        memcpy(&blocks[0], args + sizeof(int), blocks.size() * sizeof(PerObjectBlock));
+      render_object_blocks(backend, blocks.empty() ? NULL : &blocks[0], blocks.size());
+      break;
+    case RENDER_DRAW_MESH:
+      memcpy(ints, args, sizeof(int));
+      render_draw_mesh(backend, ints[0]);
+      break;
+    case RENDER_FRAME_END:
+      render_frame_end(backend);
+      break;
+    case RENDER_BIND_MESH:
+      memcpy(ints, args, sizeof(int));
+      render_bind_mesh(backend, ints[0]);
+      break;
+    case RENDER_DRAW_BOUND:
+      render_draw_bound(backend);
+      break;
+    case RENDER_SET_PASS:
+      memcpy(ints, args, sizeof(int));
+      render_set_pass(backend, ints[0]);
+      break;
+    }
+    at += 1 + size;
+    replayed++;
+  }
+  return replayed;
+}
+
+// the commands of one frame: a draw per visible entity, no state filtering
+static void build_frame(EntityWorld &world, RenderBackend &backend, const glm::mat4 &view_projection)
+{
+  const unsigned drawn = COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_MATERIAL;
+  render_clear(backend, glm::vec4(1.0, 1.0, 1.0, 1.0));
+  for (size_t a = 0; a < world.archetypes.size(); a++)
+  {
+    const Archetype &archetype = world.archetypes[a];
+    if ((archetype.components & drawn) != drawn) continue;
+    for (int row = 0; row < archetype.count; row++)
+    {
+      if (!archetype.visible[row]) continue;
+      const Material &material = world.materials[archetype.materials[row]];
+      render_use_program(backend, material.program);
+      render_bind_texture(backend, 0, material.texture_id);
+      render_uniform_mat4(backend, material.uniform_mvp, view_projection * archetype.transforms[row]);
+      render_draw_mesh(backend, archetype.meshes[row]);
+    }
+  }
+  render_frame_end(backend);
+}
+
+// FNV-1a, to compare streams between runs and builds
+static uint64_t hash_stream(uint64_t hash, const vector<uint8_t> &stream)
+{
+  for (size_t i = 0; i < stream.size(); i++)
+    hash = (hash ^ stream[i]) * 1099511628211ull;
+  return hash;
+}
+
+void render_backend_benchmark(int count)
+{
+  const int FRAMES = 60;
+
+  // object names and uniform locations are only recorded, never handed to GL
+  EntityWorld world;
+  entities_init(world);
+  int materials[2];
+  materials[0] = entities_add_material(world, 1, 1, 1, 0);
+  materials[1] = entities_add_material(world, 2, 1, 0, 1);
+  unsigned components = COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_MATERIAL | COMPONENT_BOUNDS;
+  int side = (int)ceil(sqrt((double)count));
+  float extent = 3.0f * side;
+  for (int n = 0; n < count; n++)
+  {
+    int entity = entity_create(world, n % 2 ? components | COMPONENT_SPIN : components);
+    glm::vec3 position(3.0f * (n % side - side / 2), 0.0f, 3.0f * (n / side - side / 2));
+    entity_transform(world, entity) = glm::translate(glm::mat4(1.0f), position);
+    entity_set_mesh(world, entity, n % 2);
+    entity_set_material(world, entity, materials[n / 3 % 2]);
+    entity_set_radius(world, entity, 1.75f);
+    if (n % 2)
+      entity_set_spin(world, entity, glm::vec3(0.0, 1.0, 0.0), 3.0f);
+  }
+
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0, extent * 0.25f, extent * 0.5f), glm::vec3(0.0, 0.0, 0.0),
+    glm::vec3(0.0, 1.0, 0.0));
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 2.0f * extent);
+  glm::mat4 view_projection = projection * view;
+  Frustum frustum;
+  frustum_from_matrix(view_projection, frustum);
+
+  RenderBackend null_backend, record_backend, replay_backend;
+  render_backend_init(null_backend, RENDER_BACKEND_NULL, NULL, NULL);
+  render_backend_init(record_backend, RENDER_BACKEND_RECORD, NULL, NULL);
+  render_backend_init(replay_backend, RENDER_BACKEND_NULL, NULL, NULL);
+
+  double animate_seconds = 0.0, cull_seconds = 0.0, null_seconds = 0.0;
+  double record_seconds = 0.0, replay_seconds = 0.0;
+  long visible = 0, bytes = 0;
+  uint64_t hash = 14695981039346656037ull;
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    Clock::time_point start = Clock::now();
+    entities_animate(world, 1.0f / 60.0f);
+    animate_seconds += seconds_since(start);
+
+    start = Clock::now();
+    entities_update_bounds(world);
+    visible += entities_cull(world, frustum);
+    cull_seconds += seconds_since(start);
+
+    start = Clock::now();
+    build_frame(world, null_backend, view_projection);
+    null_seconds += seconds_since(start);
+
+    // the stream keeps its capacity, after the first frame recording allocates nothing
+    record_backend.stream.clear();
+    start = Clock::now();
+    build_frame(world, record_backend, view_projection);
+    record_seconds += seconds_since(start);
+    bytes += record_backend.stream.size();
+    hash = hash_stream(hash, record_backend.stream);
+
+    start = Clock::now();
+    if (render_replay(record_backend.stream, replay_backend) < 0) return;
+    replay_seconds += seconds_since(start);
+  }
+
+  long commands = 0;
+  for (int i = 0; i < RENDER_COMMAND_COUNT; i++)
+    commands += null_backend.commands[i];
+  printf("%d entities, %d threads, %ld visible/frame, %ld commands/frame\n", count,
+    parallel_threads(), visible / FRAMES, commands / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "animate", animate_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "bounds + cull", cull_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "null backend", null_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame %10.1f KB/frame\n", "recording", record_seconds * 1000.0 / FRAMES,
+    bytes / 1024.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "replay", replay_seconds * 1000.0 / FRAMES);
+  printf("stream hash %016llx\n", (unsigned long long)hash);
+}
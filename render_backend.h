@@ -0,0 +1,116 @@
+#ifndef _RENDER_BACKEND_H
+#define _RENDER_BACKEND_H
+
+#include <stdint.h>
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "geometry_pool.h"
+#include "uniform_buffer.h"
+
+// the commands of the scene's draw path
+enum RenderCommand
+{
+  RENDER_CLEAR,
+  RENDER_USE_PROGRAM,
+  RENDER_BIND_TEXTURE,
+  RENDER_UNIFORM_INT,
+  RENDER_UNIFORM_MAT4,
+  RENDER_BIND_OBJECT,
+  RENDER_FRAME_BLOCK,
+  RENDER_OBJECT_BLOCKS,  // the only command of variable size, a count then the blocks
+  RENDER_DRAW_MESH,
+  RENDER_FRAME_END,
+  RENDER_BIND_MESH,
+  RENDER_DRAW_BOUND,
+  RENDER_SET_PASS,
+  RENDER_COMMAND_COUNT
+};
+
+// Opaque draws write depth and cull back faces, without blending; the
+// transparent ones blend over them, test depth without writing it, and
+// show their back faces.
+enum RenderPass
+{
+  RENDER_PASS_OPAQUE,
+  RENDER_PASS_TRANSPARENT,
+};
+
+enum RenderBackendType
+{
+  RENDER_BACKEND_GL,      // the GL calls themselves
+  RENDER_BACKEND_NULL,    // drops every command, only counts it
+  RENDER_BACKEND_RECORD,  // only records every command to stream
+};
+
+// Where the draw path's commands go. Only the GL backend needs a context,
+// so with the other two the CPU side of a frame (culling, building the
+// command list) runs and is timed on its own, anywhere. Meshes and object
+// blocks are named by their index in meshes and ubo, which keeps the
+// recorded stream free of pointers. With a pool set, meshes are its ids
+// instead.
+struct RenderBackend
+{
+  RenderBackendType type;
+  const std::vector<Mesh>* meshes;
+  const GeometryPool* pool;  // NULL unless set after render_backend_init
+  UniformBuffers* ubo;  // NULL without uniform blocks
+  int bound_mesh;       // by render_bind_mesh, -1 for none
+  // Set for the recording backend, and on the GL backend while a capture
+  // is made: every command is appended to stream, a byte opcode followed
+  // by the arguments as the CPU lays them out.
+  bool recording;
+  std::vector<uint8_t> stream;
+  long commands[RENDER_COMMAND_COUNT];  // since render_backend_init
+};
+
+void render_backend_init(RenderBackend &backend, RenderBackendType type,
+  const std::vector<Mesh>* meshes, UniformBuffers* ubo);
+
+void render_clear(RenderBackend &backend, const glm::vec4 &color);
+void render_use_program(RenderBackend &backend, GLuint program);
+// binds texture_id to texture unit unit
+void render_bind_texture(RenderBackend &backend, GLuint unit, GLuint texture_id);
+void render_uniform_int(RenderBackend &backend, GLint location, GLint value);
+void render_uniform_mat4(RenderBackend &backend, GLint location, const glm::mat4 &value);
+// ubo_bind_object of the backend's uniform buffers
+void render_bind_object(RenderBackend &backend, int slot);
+void render_frame_block(RenderBackend &backend, const PerFrameBlock &frame);
+// this frame's blocks of slots 0 to count - 1, before the frame's first draw
+void render_object_blocks(RenderBackend &backend, const PerObjectBlock* blocks, int count);
+void render_draw_mesh(RenderBackend &backend, int mesh);
+// render_draw_mesh in parts, for draws of the same mesh in a row
+void render_bind_mesh(RenderBackend &backend, int mesh);
+void render_draw_bound(RenderBackend &backend);
+// the blend, depth write and face culling state of a RenderPass
+void render_set_pass(RenderBackend &backend, int pass);
+// after the frame's last draw, ends the uniform buffers' frame; the swap is
+// left to the caller
+void render_frame_end(RenderBackend &backend);
+
+// A recording made in another context names its programs and textures, and
+// the uniforms of each program, differently than the one replaying it does.
+// Names missing from the tables are passed through unchanged.
+struct ReplayNames
+{
+  std::vector<GLuint> programs, textures;     // indexed by recorded name
+  std::vector<std::vector<GLint> > locations; // by recorded program, then location
+};
+
+// Issue a recorded stream again on another backend. Returns the commands
+// replayed, or -1 with a displayed error when the stream is corrupt.
+long render_replay(const std::vector<uint8_t> &stream, RenderBackend &backend,
+  const ReplayNames* names = NULL);
+
+// Animate, cull and build the draw commands of count entities against the
+// null and the recording backend, no GL context needed, printing the time
+// of every stage and a hash of the recorded stream; the same count always
+// records the same stream.
+void render_backend_benchmark(int count);
+
+#endif
@@ -0,0 +1,515 @@
+#include "render_queue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shader_utils.h"
+#include "program_info.h"
+#include "gl_state.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// 11-bit digits, 6 passes cover the key
+static const int RADIX_BITS = 11;
+static const int RADIX_BUCKETS = 1 << RADIX_BITS;
+static const int RADIX_PASSES = (64 + RADIX_BITS - 1) / RADIX_BITS;
+
+static uint64_t key_field(uint64_t value, int bits)
+{
+  return value & ((1ull << bits) - 1);
+}
+
+static const int LAYER_SHIFT = RENDER_KEY_PROGRAM_BITS + RENDER_KEY_TEXTURE_BITS + RENDER_KEY_MESH_BITS
+  + RENDER_KEY_DEPTH_BITS;
+
+uint64_t render_key(int layer, GLuint program, GLuint texture_id, int mesh, float depth)
+{
+  depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+  bool transparent = RENDER_PASS_TRANSPARENT == layer;
+  uint64_t quantized = (uint64_t)((transparent ? 1.0f - depth : depth) * (float)((1 << RENDER_KEY_DEPTH_BITS) - 1));
+  uint64_t key = key_field(layer, RENDER_KEY_LAYER_BITS);
+  if (transparent)
+    key = (key << RENDER_KEY_DEPTH_BITS) | quantized;
+  key = (key << RENDER_KEY_PROGRAM_BITS) | key_field(program, RENDER_KEY_PROGRAM_BITS);
+  key = (key << RENDER_KEY_TEXTURE_BITS) | key_field(texture_id, RENDER_KEY_TEXTURE_BITS);
+  key = (key << RENDER_KEY_MESH_BITS) | key_field(mesh, RENDER_KEY_MESH_BITS);
+  if (!transparent)
+    key = (key << RENDER_KEY_DEPTH_BITS) | quantized;
+  return key;
+}
+
+int render_key_layer(uint64_t key)
+{
+  return (int)(key >> LAYER_SHIFT);
+}
+
+static void reset_stats(RenderQueueStats &stats)
+{
+  stats.frames = stats.draws = stats.passes = 0;
+  stats.programs = stats.textures = stats.meshes = stats.objects = stats.uniforms = 0;
+}
+
+void render_queue_init(RenderQueue &queue)
+{
+  render_queue_begin(queue);
+  reset_stats(queue.stats);
+}
+
+void render_queue_begin(RenderQueue &queue)
+{
+  queue.entries.clear();
+  queue.draws.clear();
+}
+
+RenderDraw &render_queue_add(RenderQueue &queue, uint64_t key)
+{
+  RenderQueueEntry entry;
+  entry.key = key;
+  entry.index = queue.draws.size();
+  queue.entries.push_back(entry);
+  queue.draws.push_back(RenderDraw());
+  return queue.draws.back();
+}
+
+static uint64_t sort_key(uint64_t word)
+{
+  return word;
+}
+
+static uint64_t sort_key(const RenderQueueEntry &entry)
+{
+  return entry.key;
+}
+
+// LSD radix sort of items on bits low to high of their keys, a digit all
+// items share is skipped after counting.
+template <typename Item>
+static void radix_sort(vector<Item> &items, vector<Item> &scratch, int low, int high)
+{
+  size_t count = items.size();
+  scratch.resize(count);
+  int passes = (high - low + RADIX_BITS - 1) / RADIX_BITS;
+
+  uint32_t histograms[RADIX_PASSES][RADIX_BUCKETS];
+  memset(histograms, 0, passes * sizeof(histograms[0]));
+  for (size_t i = 0; i < count; i++)
+  {
+    uint64_t key = sort_key(items[i]) >> low;
+    for (int pass = 0; pass < passes; pass++)
+      histograms[pass][(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+  }
+
+  uint64_t first = sort_key(items[0]);
+  for (int pass = 0; pass < passes; pass++)
+  {
+    uint32_t* histogram = histograms[pass];
+    int shift = low + pass * RADIX_BITS;
+    if (histogram[(first >> shift) & (RADIX_BUCKETS - 1)] == count) continue;
+
+    // counts to the first slot of every bucket
+    uint32_t offset = 0;
+    for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+    {
+      uint32_t size = histogram[bucket];
+      histogram[bucket] = offset;
+      offset += size;
+    }
+
+    const Item* from = &items[0];
+    Item* to = &scratch[0];
+    for (size_t i = 0; i < count; i++)
+      to[histogram[(sort_key(from[i]) >> shift) & (RADIX_BUCKETS - 1)]++] = from[i];
+    items.swap(scratch);
+  }
+}
+
+// Only the bits that differ between keys are sorted, so fields no draw
+// uses, like the layer most frames, cost no pass. When those bits and the
+// index fit in 64 together the passes move single words, the bits every
+// key shares are put back after.
+void render_queue_sort(RenderQueue &queue)
+{
+  size_t count = queue.entries.size();
+  if (count < 2) return;
+
+  uint64_t first = queue.entries[0].key, differ = 0;
+  for (size_t i = 1; i < count; i++)
+    differ |= queue.entries[i].key ^ first;
+  if (0 == differ) return;
+  int low = 0, high = 64;
+  while (!(differ >> low & 1)) low++;
+  while (!(differ >> (high - 1) & 1)) high--;
+  int index_bits = 1;
+  while ((count - 1) >> index_bits) index_bits++;
+  if (high - low + index_bits > 64)
+  {
+    radix_sort(queue.entries, queue.scratch, low, high);
+    return;
+  }
+
+  queue.words.resize(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    const RenderQueueEntry &entry = queue.entries[i];
+    queue.words[i] = (entry.key >> low) << index_bits | entry.index;
+  }
+  radix_sort(queue.words, queue.scratch_words, index_bits, index_bits + high - low);
+  uint64_t shared = first & ~(((1ull << (high - low)) - 1) << low);
+  uint64_t index_mask = (1ull << index_bits) - 1;
+  for (size_t i = 0; i < count; i++)
+  {
+    uint64_t word = queue.words[i];
+    queue.entries[i].key = shared | (word >> index_bits) << low;
+    queue.entries[i].index = (uint32_t)(word & index_mask);
+  }
+}
+
+// the uniforms a program holds, they outlive switching to other programs
+struct ProgramUniforms
+{
+  GLuint program;
+  GLint sampler;  // location set to unit 0, -1 before
+  GLint mvp_location;
+  glm::mat4 mvp;
+};
+
+void render_queue_submit(RenderQueue &queue, RenderBackend &backend)
+{
+  RenderQueueStats &stats = queue.stats;
+  stats.frames++;
+  if (queue.entries.empty()) return;
+
+  // nothing is assumed about the state left by whatever ran before
+  vector<ProgramUniforms> programs;
+  ProgramUniforms* uniforms = NULL;
+  GLuint program = 0, texture_id = 0;
+  int mesh = -1, object = -1, pass = -1;
+  bool first = true;
+  for (size_t i = 0; i < queue.entries.size(); i++)
+  {
+    const RenderQueueEntry &entry = queue.entries[i];
+    const RenderDraw &draw = queue.draws[entry.index];
+    int layer = render_key_layer(entry.key);
+    if (layer != pass)
+    {
+      pass = layer;
+      render_set_pass(backend, pass);
+      stats.passes++;
+    }
+    if (first || draw.program != program)
+    {
+      program = draw.program;
+      render_use_program(backend, program);
+      stats.programs++;
+      uniforms = NULL;
+      for (size_t p = 0; p < programs.size(); p++)
+        if (programs[p].program == program)
+          uniforms = &programs[p];
+      if (NULL == uniforms)
+      {
+        ProgramUniforms added;
+        added.program = program;
+        added.sampler = added.mvp_location = -1;
+        programs.push_back(added);
+        uniforms = &programs.back();
+      }
+    }
+    if (draw.uniform_texture >= 0 && draw.uniform_texture != uniforms->sampler)
+    {
+      render_uniform_int(backend, draw.uniform_texture, /*GL_TEXTURE*/0);
+      uniforms->sampler = draw.uniform_texture;
+      stats.uniforms++;
+    }
+    if (first || draw.texture_id != texture_id)
+    {
+      texture_id = draw.texture_id;
+      render_bind_texture(backend, 0, texture_id);
+      stats.textures++;
+    }
+    if (draw.object >= 0 && draw.object != object)
+    {
+      object = draw.object;
+      render_bind_object(backend, object);
+      stats.objects++;
+    }
+    if (draw.uniform_mvp >= 0 && (draw.uniform_mvp != uniforms->mvp_location
+      || memcmp(&draw.mvp, &uniforms->mvp, sizeof(draw.mvp))))
+    {
+      render_uniform_mat4(backend, draw.uniform_mvp, draw.mvp);
+      uniforms->mvp_location = draw.uniform_mvp;
+      uniforms->mvp = draw.mvp;
+      stats.uniforms++;
+    }
+    if (draw.mesh != mesh)
+    {
+      mesh = draw.mesh;
+      render_bind_mesh(backend, mesh);
+      stats.meshes++;
+    }
+    render_draw_bound(backend);
+    stats.draws++;
+    first = false;
+  }
+  if (pass != RENDER_PASS_OPAQUE)
+    render_set_pass(backend, RENDER_PASS_OPAQUE);
+}
+
+void render_queue_print_stats(RenderQueue &queue)
+{
+  RenderQueueStats &stats = queue.stats;
+  if (stats.frames > 0)
+    printf("%8.1f draws %6.1f passes %6.1f programs %6.1f textures %6.1f meshes %6.1f objects %6.1f uniforms per frame\n",
+      (double)stats.draws / stats.frames, (double)stats.passes / stats.frames, (double)stats.programs / stats.frames,
+      (double)stats.textures / stats.frames, (double)stats.meshes / stats.frames,
+      (double)stats.objects / stats.frames, (double)stats.uniforms / stats.frames);
+  reset_stats(stats);
+}
+
+// stats of a single frame
+static void print_changes(const char* name, double ms, const RenderQueueStats &stats)
+{
+  printf("  %-14s %10.3f ms/frame %10ld programs %10ld textures %10ld meshes\n", name, ms,
+    stats.programs, stats.textures, stats.meshes);
+}
+
+void render_queue_benchmark(int count)
+{
+  const int FRAMES = 10;
+  const int PROGRAMS = 8, TEXTURES = 64, MESHES = 16;
+
+  RenderQueue queue;
+  render_queue_init(queue);
+  RenderBackend backend;
+  render_backend_init(backend, RENDER_BACKEND_NULL, NULL, NULL);
+
+  // the same draws every frame, as if nothing moved
+  srand(1);
+  vector<RenderDraw> draws(count);
+  vector<float> depths(count);
+  for (int i = 0; i < count; i++)
+  {
+    RenderDraw &draw = draws[i];
+    draw.program = 1 + rand() % PROGRAMS;
+    draw.texture_id = 1 + rand() % TEXTURES;
+    draw.uniform_texture = 0;
+    draw.mesh = rand() % MESHES;
+    draw.object = -1;
+    draw.uniform_mvp = 1;
+    draw.mvp = glm::mat4((float)i);
+    depths[i] = (float)rand() / RAND_MAX;
+  }
+
+  double build_seconds = 0.0, unsorted_seconds = 0.0, std_sort_seconds = 0.0;
+  double radix_seconds = 0.0, sorted_seconds = 0.0;
+  RenderQueueStats unsorted, sorted;
+  vector<pair<uint64_t, uint32_t> > pairs(count);
+  bool in_order = true;
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    Clock::time_point start = Clock::now();
+    render_queue_begin(queue);
+    for (int i = 0; i < count; i++)
+    {
+      const RenderDraw &draw = draws[i];
+      render_queue_add(queue, render_key(0, draw.program, draw.texture_id, draw.mesh, depths[i])) = draw;
+    }
+    build_seconds += seconds_since(start);
+
+    // in the order the draws were added
+    reset_stats(queue.stats);
+    start = Clock::now();
+    render_queue_submit(queue, backend);
+    unsorted_seconds += seconds_since(start);
+    unsorted = queue.stats;
+
+    for (int i = 0; i < count; i++)
+      pairs[i] = make_pair(queue.entries[i].key, queue.entries[i].index);
+    start = Clock::now();
+    sort(pairs.begin(), pairs.end());
+    std_sort_seconds += seconds_since(start);
+
+    start = Clock::now();
+    render_queue_sort(queue);
+    radix_seconds += seconds_since(start);
+    for (int i = 0; i < count && in_order; i++)
+      in_order = queue.entries[i].key == pairs[i].first && queue.entries[i].index == pairs[i].second;
+
+    reset_stats(queue.stats);
+    start = Clock::now();
+    render_queue_submit(queue, backend);
+    sorted_seconds += seconds_since(start);
+    sorted = queue.stats;
+  }
+
+  // stats were reset before each submission, they hold one frame
+  printf("%d draws of %d programs, %d textures, %d meshes%s\n", count, PROGRAMS, TEXTURES, MESHES,
+    in_order ? "" : ", RADIX SORT OUT OF ORDER");
+  printf("  %-14s %10.3f ms/frame\n", "build", build_seconds * 1000.0 / FRAMES);
+  print_changes("unsorted", unsorted_seconds * 1000.0 / FRAMES, unsorted);
+  printf("  %-14s %10.3f ms/frame\n", "std::sort", std_sort_seconds * 1000.0 / FRAMES);
+  printf("  %-14s %10.3f ms/frame\n", "radix sort", radix_seconds * 1000.0 / FRAMES);
+  print_changes("sorted", sorted_seconds * 1000.0 / FRAMES, sorted);
+}
+
+// ----- PASS BENCHMARK -----
+
+enum { BENCH_COORD3D, BENCH_TEXCOORD, BENCH_ATTRIBUTE_COUNT };
+
+static GLuint create_pass_program(ProgramInfo &info)
+{
+  const char* const attribute_names[] = { "coord3d", "texcoord" };
+
+  GLuint vs = create_shader("cube.v.glsl", GL_VERTEX_SHADER, 120);
+  if (0 == vs) return 0;
+  GLuint fs = create_shader("cube.f.glsl", GL_FRAGMENT_SHADER, 120);
+  if (0 == fs) return 0;
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vs);
+  glAttachShader(program, fs);
+  program_bind_attributes(program, attribute_names, BENCH_ATTRIBUTE_COUNT);
+  glLinkProgram(program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  if (!program_reflect(program, info))
+  {
+    cerr << "glLinkProgram:";
+    print_log(program);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void render_pass_benchmark(int count, GLuint texture_id)
+{
+  ProgramInfo info;
+  GLuint program = create_pass_program(info);
+  if (0 == program) return;
+
+  const ProgramVarName expected[] = {
+    { "mvp", VAR_UNIFORM },
+    { "mytexture", VAR_UNIFORM },
+  };
+  GLint uniforms[2];
+  if (!program_require(info, expected, 2, uniforms)) return;
+
+  vector<Mesh> meshes(1);
+  if (!mesh_create_cube(meshes[0], BENCH_COORD3D, BENCH_TEXCOORD)) return;
+  RenderBackend backend;
+  render_backend_init(backend, RENDER_BACKEND_GL, &meshes, NULL);
+  RenderQueue queue;
+  render_queue_init(queue);
+
+  // every cube is scaled with its distance, so they all cover the same
+  // pixels, and queued in a fixed random order
+  const float FAR = 4.0f + 2.5f * count;
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, FAR + 2.0f);
+  vector<glm::mat4> mvps(count);
+  vector<float> depths(count);
+  for (int i = 0; i < count; i++)
+  {
+    float distance = 4.0f + 2.5f * i;
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, 0.0, -distance));
+    model = glm::rotate(model, glm::radians(30.0f), glm::vec3(1.0, 1.0, 0.0));
+    mvps[i] = projection * glm::scale(model, glm::vec3(distance / 4.0f));
+    depths[i] = distance / FAR;
+  }
+  srand(1);
+  for (int i = count - 1; i > 0; i--)
+  {
+    int j = rand() % (i + 1);
+    swap(mvps[i], mvps[j]);
+    swap(depths[i], depths[j]);
+  }
+  // blending everything is only correct back to front
+  vector<int> back_to_front(count);
+  for (int i = 0; i < count; i++)
+    back_to_front[i] = i;
+  sort(back_to_front.begin(), back_to_front.end(), [&](int a, int b) { return depths[a] > depths[b]; });
+
+  GLuint query;
+  glGenQueries(1, &query);
+  gl_state_enable(GL_DEPTH_TEST, true);
+  const int FRAMES = 60;
+  const char* const names[2] = { "global blend", "opaque pass" };
+  printf("%d cubes on top of each other\n", count);
+  for (int mode = 0; mode < 2; mode++)
+  {
+    double frame_seconds = 0.0;
+    GLuint64 samples = 0;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+      Clock::time_point start = Clock::now();
+      render_set_pass(backend, RENDER_PASS_OPAQUE);
+      render_clear(backend, glm::vec4(1.0, 1.0, 1.0, 1.0));
+      glBeginQuery(GL_SAMPLES_PASSED, query);
+      if (0 == mode)
+      {
+        // what cube.cpp did before the passes: blend everything, cull nothing
+        gl_state_enable(GL_BLEND, true);
+        gl_state_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        gl_state_enable(GL_CULL_FACE, false);
+        render_use_program(backend, program);
+        render_bind_texture(backend, 0, texture_id);
+        render_uniform_int(backend, uniforms[1], 0);
+        render_bind_mesh(backend, 0);
+        for (int i = 0; i < count; i++)
+        {
+          render_uniform_mat4(backend, uniforms[0], mvps[back_to_front[i]]);
+          render_draw_bound(backend);
+        }
+      }
+      else
+      {
+        render_queue_begin(queue);
+        for (int i = 0; i < count; i++)
+        {
+          RenderDraw &draw = render_queue_add(queue, render_key(RENDER_PASS_OPAQUE, program, texture_id, 0, depths[i]));
+          draw.program = program;
+          draw.texture_id = texture_id;
+          draw.uniform_texture = uniforms[1];
+          draw.mesh = 0;
+          draw.object = -1;
+          draw.uniform_mvp = uniforms[0];
+          draw.mvp = mvps[i];
+        }
+        render_queue_sort(queue);
+        render_queue_submit(queue, backend);
+      }
+      glEndQuery(GL_SAMPLES_PASSED);
+      render_frame_end(backend);
+
+      // wait for the GPU, so the frame time covers the actual rendering
+      glFinish();
+      frame_seconds += seconds_since(start);
+      GLuint passed = 0;
+      glGetQueryObjectuiv(query, GL_QUERY_RESULT, &passed);
+      samples += passed;
+    }
+    printf("  %-14s %10.3f ms/frame %12.0f samples/frame\n", names[mode], frame_seconds * 1000.0 / FRAMES,
+      (double)samples / FRAMES);
+  }
+
+  render_set_pass(backend, RENDER_PASS_OPAQUE);
+  glDeleteQueries(1, &query);
+  if (mesh_supports_vao())
+    gl_state_bind_vertex_array(0);
+  mesh_free(meshes[0]);
+  glDeleteProgram(program);
+  gl_state_invalidate();
+}
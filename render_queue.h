@@ -0,0 +1,96 @@
+#ifndef _RENDER_QUEUE_H
+#define _RENDER_QUEUE_H
+
+#include <stdint.h>
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "render_backend.h"
+
+// Sort key fields, most significant first: draws are grouped by layer, then
+// program, texture and mesh, and ordered front to back within each group.
+// The layer is the RenderPass. Transparent draws must blend back to front
+// whatever their state, so in that layer the depth comes first and is
+// reversed. Names wider than their field alias other names, which only
+// costs state changes, the submitter compares the full names.
+#define RENDER_KEY_LAYER_BITS 4
+#define RENDER_KEY_PROGRAM_BITS 10
+#define RENDER_KEY_TEXTURE_BITS 12
+#define RENDER_KEY_MESH_BITS 12
+#define RENDER_KEY_DEPTH_BITS 16
+
+// everything a draw needs, the key only orders the draws
+struct RenderDraw
+{
+  GLuint program;
+  GLuint texture_id;
+  GLint uniform_texture;  // the sampler, set to unit 0; -1 when unused
+  int mesh;
+  int object;             // the uniform block slot, -1 without blocks
+  GLint uniform_mvp;      // -1 when the matrices come from the blocks
+  glm::mat4 mvp;
+};
+
+// state changes issued, summed over frames since the last reset
+struct RenderQueueStats
+{
+  long frames, draws;
+  long passes, programs, textures, meshes, objects, uniforms;
+};
+
+// a draw's key next to its index, so a radix pass moves both with one write
+struct RenderQueueEntry
+{
+  uint64_t key;
+  uint32_t index;  // into draws
+};
+
+// A frame's draws, each a 64-bit key plus the index of its RenderDraw.
+// render_queue_sort radix sorts the entries, render_queue_submit walks them
+// and only issues the commands that change something.
+struct RenderQueue
+{
+  std::vector<RenderQueueEntry> entries;  // in key order after sorting
+  std::vector<RenderDraw> draws;
+  // the other half of each radix pass
+  std::vector<RenderQueueEntry> scratch;
+  // keys' differing bits above the index, when they fit in a word
+  std::vector<uint64_t> words, scratch_words;
+  RenderQueueStats stats;
+};
+
+// depth is 0 at the near plane and 1 at the far plane, clamped
+uint64_t render_key(int layer, GLuint program, GLuint texture_id, int mesh, float depth);
+// a key's layer
+int render_key_layer(uint64_t key);
+
+void render_queue_init(RenderQueue &queue);
+// clears the previous frame's draws
+void render_queue_begin(RenderQueue &queue);
+// the draw's payload to fill in, valid until the next render_queue_add
+RenderDraw &render_queue_add(RenderQueue &queue, uint64_t key);
+void render_queue_sort(RenderQueue &queue);
+// Issue the draws in order, skipping state the previous draw already set,
+// and switching passes between layers. The opaque pass's state is left
+// set, as it is expected before.
+void render_queue_submit(RenderQueue &queue, RenderBackend &backend);
+
+// changes per frame since the last call, then resets the stats
+void render_queue_print_stats(RenderQueue &queue);
+
+// Sort and submit count draws of random keys against the null backend,
+// unsorted, with std::sort and with the radix sort, printing times and
+// state changes per frame.
+void render_queue_benchmark(int count);
+
+// Draw count cubes stacked behind each other on the screen, blending all of
+// them back to front as with a global GL_BLEND, then through the opaque
+// pass front to back. Prints GPU time and samples passing the depth test
+// per frame. Needs a current context, draws to its back buffer.
+void render_pass_benchmark(int count, GLuint texture_id);
+
+#endif
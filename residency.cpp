@@ -0,0 +1,521 @@
+#include "residency.h"
+#include "gl_state.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int format_components(GLenum format)
+{
+  switch (format)
+  {
+  case GL_RG: return 2;
+  case GL_RGB: case GL_BGR: return 3;
+  case GL_RGBA: case GL_BGRA: return 4;
+  }
+  return 1;
+}
+
+static size_t type_bytes(GLenum type)
+{
+  switch (type)
+  {
+  case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return 2;
+  case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+  }
+  return 1;
+}
+
+// rows padded to 4 bytes, the default GL_PACK_ALIGNMENT and GL_UNPACK_ALIGNMENT
+static size_t texture_bytes(GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+  size_t row = (width * format_components(format) * type_bytes(type) + 3) & ~(size_t)3;
+  return row * height;
+}
+
+// where an evicted object waits in $RESIDENCY_CACHE_DIR, "" without a disk cache
+static string cache_path(int id)
+{
+  const char* dir = getenv("RESIDENCY_CACHE_DIR");
+  if (dir == NULL || *dir == '\0')
+    return "";
+
+  char name[48];
+  snprintf(name, sizeof(name), "/resident_%d_%d.bin", (int)getpid(), id);
+  return string(dir) + name;
+}
+
+void residency_init(ResidencyManager &residency, size_t budget, GpuResources* deleter)
+{
+  residency.budget = budget;
+  residency.resident_bytes = 0;
+  residency.resources.clear();
+  residency.free_ids.clear();
+  residency.lru.clear();
+  residency.readbacks.clear();
+  residency.use_readback = GLEW_VERSION_3_2 || (GLEW_ARB_sync && GLEW_ARB_copy_buffer);
+  residency.frame = 0;
+  residency.over_frame = -1;
+  residency.deleter = deleter;
+  memset(&residency.stats, 0, sizeof(residency.stats));
+}
+
+// Create the GL object from contents, or from the readback buffer when it
+// has one, as the most recently used.
+static void upload(ResidencyManager &residency, int id, const void* contents)
+{
+  Resident &resident = residency.resources[id];
+  if (RESIDENT_TEXTURE == resident.type)
+  {
+    glGenTextures(1, &resident.name);
+    gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, resident.name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, resident.min_filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, resident.mag_filter);
+    if (resident.readback)
+    {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, resident.readback);
+      contents = NULL;  // an offset into the buffer
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, resident.internal_format, resident.width, resident.height, 0,
+      resident.format, resident.pixel_type, contents);
+    if (resident.readback)
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  else
+  {
+    // through the copy targets, no VAO's element buffer binding changes
+    glGenBuffers(1, &resident.name);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resident.name);
+    glBufferData(GL_COPY_WRITE_BUFFER, resident.bytes, resident.readback ? NULL : contents, resident.usage);
+    if (resident.readback)
+    {
+      glBindBuffer(GL_COPY_READ_BUFFER, resident.readback);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, resident.bytes);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  residency.lru.push_front(id);
+  resident.lru = residency.lru.begin();
+  residency.resident_bytes += resident.bytes;
+  residency.stats.uploads++;
+  residency.stats.upload_bytes += resident.bytes;
+}
+
+static void delete_name(ResidencyManager &residency, Resident &resident)
+{
+  GpuResourceType type = (RESIDENT_TEXTURE == resident.type) ? GPU_TEXTURE : GPU_BUFFER;
+  if (residency.deleter)
+    gpu_defer_delete(*residency.deleter, type, resident.name);
+  else
+  {
+    if (GPU_TEXTURE == type)
+      glDeleteTextures(1, &resident.name);
+    else
+      glDeleteBuffers(1, &resident.name);
+    gl_state_invalidate();
+  }
+  residency.lru.erase(resident.lru);
+  residency.resident_bytes -= resident.bytes;
+  resident.name = 0;
+}
+
+// the contents in data go to the disk cache, when there is one
+static void store(Resident &resident, int id)
+{
+  string path = cache_path(id);
+  if (path.empty()) return;
+  ofstream out(path.c_str(), ios::out | ios::binary);
+  out.write((const char*)&resident.data[0], resident.bytes);
+  // without room on the disk it stays in memory
+  if (out.good())
+  {
+    vector<uint8_t>().swap(resident.data);
+    resident.on_disk = true;
+  }
+}
+
+// the readback buffer and its fence, once nothing needs them
+static void drop_readback(ResidencyManager &residency, int id)
+{
+  Resident &resident = residency.resources[id];
+  glDeleteSync(resident.fence);
+  gpu_delete(residency.deleter, GPU_BUFFER, resident.readback);
+  resident.fence = 0;
+  resident.readback = 0;
+  for (size_t i = 0; i < residency.readbacks.size(); i++)
+    if (residency.readbacks[i] == id)
+    {
+      residency.readbacks[i] = residency.readbacks.back();
+      residency.readbacks.pop_back();
+      break;
+    }
+}
+
+// the copy is done, or mapping waits for it: move it into data
+static void finish_readback(ResidencyManager &residency, int id)
+{
+  Resident &resident = residency.resources[id];
+  resident.data.resize(resident.bytes);
+  glBindBuffer(GL_COPY_READ_BUFFER, resident.readback);
+  const void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, 0, resident.bytes, GL_MAP_READ_BIT);
+  if (mapped)
+  {
+    memcpy(&resident.data[0], mapped, resident.bytes);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+  }
+  else
+    cerr << "residency: cannot map the readback of resource " << id << endl;
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  drop_readback(residency, id);
+  store(resident, id);
+}
+
+// Copy the contents into a readback buffer on the GPU, then take the
+// object off it. Nothing waits here, the copy is queued after the draws.
+static void start_readback(ResidencyManager &residency, int id)
+{
+  Resident &resident = residency.resources[id];
+  glGenBuffers(1, &resident.readback);
+  if (RESIDENT_TEXTURE == resident.type)
+  {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, resident.readback);
+    glBufferData(GL_PIXEL_PACK_BUFFER, resident.bytes, NULL, GL_STREAM_READ);
+    gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, resident.name);
+    glGetTexImage(GL_TEXTURE_2D, 0, resident.format, resident.pixel_type, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  else
+  {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resident.readback);
+    glBufferData(GL_COPY_WRITE_BUFFER, resident.bytes, NULL, GL_STREAM_READ);
+    glBindBuffer(GL_COPY_READ_BUFFER, resident.name);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, resident.bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  resident.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  residency.readbacks.push_back(id);
+}
+
+// the contents off the GPU, then the object
+static void evict(ResidencyManager &residency, int id)
+{
+  Resident &resident = residency.resources[id];
+  if (residency.use_readback)
+    start_readback(residency, id);
+  else
+  {
+    resident.data.resize(resident.bytes);
+    if (RESIDENT_TEXTURE == resident.type)
+    {
+      gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, resident.name);
+      glGetTexImage(GL_TEXTURE_2D, 0, resident.format, resident.pixel_type, &resident.data[0]);
+    }
+    else
+    {
+      glBindBuffer(GL_COPY_READ_BUFFER, resident.name);
+      glGetBufferSubData(GL_COPY_READ_BUFFER, 0, resident.bytes, &resident.data[0]);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    store(resident, id);
+  }
+
+  delete_name(residency, resident);
+  residency.stats.evictions++;
+  residency.stats.eviction_bytes += resident.bytes;
+}
+
+// evict from the least recently used end until under the budget
+static void enforce_budget(ResidencyManager &residency)
+{
+  if (0 == residency.budget) return;
+  while (residency.resident_bytes > residency.budget && !residency.lru.empty())
+  {
+    int id = residency.lru.back();
+    // everything else was used this frame too
+    if (residency.resources[id].last_frame == residency.frame)
+    {
+      if (residency.over_frame != residency.frame)
+        residency.stats.over_budget_frames++;
+      residency.over_frame = residency.frame;
+      return;
+    }
+    evict(residency, id);
+  }
+}
+
+void residency_set_budget(ResidencyManager &residency, size_t budget)
+{
+  residency.budget = budget;
+  enforce_budget(residency);
+}
+
+static int add_resident(ResidencyManager &residency, const Resident &resident)
+{
+  int id;
+  if (residency.free_ids.empty())
+  {
+    id = residency.resources.size();
+    residency.resources.push_back(resident);
+  }
+  else
+  {
+    id = residency.free_ids.back();
+    residency.free_ids.pop_back();
+    residency.resources[id] = resident;
+  }
+  return id;
+}
+
+// the fields every resident starts with
+static Resident new_resident(ResidencyManager &residency, ResidentType type, size_t bytes)
+{
+  Resident resident;
+  resident.live = true;
+  resident.tracked = false;
+  resident.type = type;
+  resident.name = 0;
+  resident.bytes = bytes;
+  resident.last_frame = residency.frame;
+  resident.usage = 0;
+  resident.width = resident.height = 0;
+  resident.internal_format = resident.min_filter = resident.mag_filter = 0;
+  resident.format = resident.pixel_type = 0;
+  resident.readback = 0;
+  resident.fence = 0;
+  resident.on_disk = false;
+  return resident;
+}
+
+int residency_create_texture(ResidencyManager &residency, GLsizei width, GLsizei height,
+  GLint internal_format, GLenum format, GLenum type, const void* pixels,
+  GLint min_filter, GLint mag_filter)
+{
+  Resident resident = new_resident(residency, RESIDENT_TEXTURE, texture_bytes(width, height, format, type));
+  resident.width = width;
+  resident.height = height;
+  resident.internal_format = internal_format;
+  resident.format = format;
+  resident.pixel_type = type;
+  resident.min_filter = min_filter;
+  resident.mag_filter = mag_filter;
+  int id = add_resident(residency, resident);
+  upload(residency, id, pixels);
+  enforce_budget(residency);
+  return id;
+}
+
+int residency_create_buffer(ResidencyManager &residency, GLsizeiptr size, const void* data, GLenum usage)
+{
+  Resident resident = new_resident(residency, RESIDENT_BUFFER, size);
+  resident.usage = usage;
+  int id = add_resident(residency, resident);
+  upload(residency, id, data);
+  enforce_budget(residency);
+  return id;
+}
+
+int residency_track(ResidencyManager &residency, ResidentType type, GLuint name, size_t bytes)
+{
+  if (RESIDENT_BUFFER == type)
+  {
+    GLint size = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, name);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    bytes = size;
+  }
+  Resident resident = new_resident(residency, type, bytes);
+  resident.tracked = true;
+  resident.name = name;
+  residency.resident_bytes += bytes;
+  int id = add_resident(residency, resident);
+  enforce_budget(residency);
+  return id;
+}
+
+void residency_destroy(ResidencyManager &residency, int id)
+{
+  Resident &resident = residency.resources[id];
+  if (!resident.live) return;
+  if (resident.tracked)
+  {
+    residency.resident_bytes -= resident.bytes;
+    resident.live = false;
+    residency.free_ids.push_back(id);
+    return;
+  }
+  if (resident.readback)
+    drop_readback(residency, id);
+  if (resident.name)
+    delete_name(residency, resident);
+  if (resident.on_disk)
+    remove(cache_path(id).c_str());
+  vector<uint8_t>().swap(resident.data);
+  resident.live = false;
+  residency.free_ids.push_back(id);
+}
+
+GLuint residency_use(ResidencyManager &residency, int id)
+{
+  if (id < 0 || id >= (int)residency.resources.size() || !residency.resources[id].live)
+  {
+    cerr << "residency_use: no resource " << id << endl;
+    return 0;
+  }
+  Resident &resident = residency.resources[id];
+  resident.last_frame = residency.frame;
+  if (resident.tracked)
+    return resident.name;
+  if (resident.name)
+  {
+    residency.lru.splice(residency.lru.begin(), residency.lru, resident.lru);
+    return resident.name;
+  }
+  // still on the GPU, in the readback buffer
+  if (resident.readback)
+  {
+    upload(residency, id, NULL);
+    drop_readback(residency, id);
+    enforce_budget(residency);
+    return resident.name;
+  }
+
+  if (resident.on_disk)
+  {
+    string path = cache_path(id);
+    resident.data.resize(resident.bytes);
+    ifstream in(path.c_str(), ios::in | ios::binary);
+    in.read((char*)&resident.data[0], resident.bytes);
+    if (!in.good())
+      cerr << "residency_use: cannot read back " << path << endl;
+    in.close();
+    remove(path.c_str());
+    resident.on_disk = false;
+  }
+  upload(residency, id, &resident.data[0]);
+  vector<uint8_t>().swap(resident.data);
+  enforce_budget(residency);
+  return resident.name;
+}
+
+void residency_end_frame(ResidencyManager &residency)
+{
+  residency.frame++;
+  residency.stats.frames++;
+  // what the last frame created or used over the budget can go now
+  enforce_budget(residency);
+
+  // the copies of earlier frames' evictions that completed, backwards as finishing removes them
+  for (size_t i = residency.readbacks.size(); i-- > 0;)
+  {
+    int id = residency.readbacks[i];
+    GLenum status = glClientWaitSync(residency.resources[id].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (GL_TIMEOUT_EXPIRED == status) continue;
+    if (GL_WAIT_FAILED == status)
+      cerr << "residency_end_frame: glClientWaitSync failed, reading back resource " << id << " anyway" << endl;
+    finish_readback(residency, id);
+  }
+}
+
+void residency_report(ResidencyManager &residency, FILE* out)
+{
+  ResidencyStats &stats = residency.stats;
+  if (0 == stats.frames) return;
+  int resident = 0, evicted = 0;
+  for (size_t id = 0; id < residency.resources.size(); id++)
+  {
+    if (!residency.resources[id].live) continue;
+    if (residency.resources[id].name)
+      resident++;
+    else
+      evicted++;
+  }
+  double frames = stats.frames;
+  fprintf(out, "residency: %.1f MB", residency.resident_bytes / 1048576.0);
+  if (residency.budget)
+    fprintf(out, " of %.1f MB", residency.budget / 1048576.0);
+  fprintf(out, ", %d resident, %d evicted; per frame %.1f evictions %.1f KB, %.1f uploads %.1f KB; "
+    "%ld frames over budget\n", resident, evicted, stats.evictions / frames, stats.eviction_bytes / 1024.0 / frames,
+    stats.uploads / frames, stats.upload_bytes / 1024.0 / frames, stats.over_budget_frames);
+  memset(&stats, 0, sizeof(stats));
+}
+
+void residency_free(ResidencyManager &residency)
+{
+  for (size_t id = 0; id < residency.resources.size(); id++)
+    residency_destroy(residency, id);
+  residency.resources.clear();
+  residency.free_ids.clear();
+}
+
+// ----- BENCHMARK -----
+
+void residency_benchmark(int count, int working_set, size_t budget)
+{
+  const GLsizei SIZE = 256;
+  const int FRAMES = 60;
+  GpuResources resources;
+  gpu_resources_init(resources);
+  ResidencyManager residency;
+  residency_init(residency, budget, &resources);
+  printf("%d textures of %dx%d RGBA, %d used per frame, %.1f MB budget\n", count, SIZE, SIZE, working_set,
+    budget / 1048576.0);
+
+  // every texture filled with its own index, to check them afterwards
+  vector<uint8_t> pixels(SIZE * SIZE * 4);
+  vector<int> ids(count);
+  for (int i = 0; i < count; i++)
+  {
+    memset(&pixels[0], i & 0xff, pixels.size());
+    ids[i] = residency_create_texture(residency, SIZE, SIZE, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+  }
+  residency_end_frame(residency);
+  printf("  created: ");
+  residency_report(residency, stdout);
+
+  // the working set slides forward by a quarter every frame
+  Clock::time_point start = Clock::now();
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    for (int k = 0; k < working_set; k++)
+    {
+      GLuint name = residency_use(residency, ids[(frame * (working_set / 4 + 1) + k) % count]);
+      gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, name);
+    }
+    glFinish();
+    residency_end_frame(residency);
+    gpu_resources_end_frame(resources);
+  }
+  printf("  %.3f ms/frame: ", seconds_since(start) * 1000.0 / FRAMES);
+  residency_report(residency, stdout);
+
+  // whatever went off the GPU must have come back the same
+  int damaged = 0;
+  for (int i = 0; i < count; i++)
+  {
+    gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, residency_use(residency, ids[i]));
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    if (pixels[0] != (i & 0xff) || pixels.back() != (i & 0xff))
+      damaged++;
+    residency_end_frame(residency);
+  }
+  printf("  %d of %d textures read back intact\n", count - damaged, count);
+
+  residency_free(residency);
+  gpu_resources_free(resources);
+}
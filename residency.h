@@ -0,0 +1,107 @@
+#ifndef _RESIDENCY_H
+#define _RESIDENCY_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <GL/glew.h>
+
+#include "gpu_resources.h"
+
+enum ResidentType { RESIDENT_BUFFER, RESIDENT_TEXTURE };
+
+// A buffer or a 2D texture the manager may take off the GPU. Its contents
+// then wait in data, or in a file of the disk cache, until the next use
+// uploads them again, usually under another name. Tracked objects belong
+// to someone else and only count against the budget.
+struct Resident
+{
+  bool live;
+  bool tracked;       // by residency_track, never evicted
+  ResidentType type;
+  GLuint name;        // 0 while evicted
+  size_t bytes;
+  int last_frame;     // the frame of the last residency_use
+  std::list<int>::iterator lru;  // valid while resident and not tracked
+
+  // while the contents travel back from the GPU after an eviction
+  GLuint readback;    // a buffer holding them, 0 once they are in data
+  GLsync fence;
+
+  GLenum usage;                    // buffers
+  GLsizei width, height;           // textures, level 0 only
+  GLint internal_format, min_filter, mag_filter;
+  GLenum format, pixel_type;
+
+  std::vector<uint8_t> data;  // the contents while evicted to memory
+  bool on_disk;               // or in the disk cache
+};
+
+// The per-frame report, counted since the last one.
+struct ResidencyStats
+{
+  int frames;
+  long evictions, uploads;
+  size_t eviction_bytes, upload_bytes;
+  long over_budget_frames;  // frames whose own resources did not fit
+};
+
+// Sizes of the buffers and textures created through it, kept under a
+// budget by evicting the ones least recently used. Objects used during
+// the current frame are never evicted, a frame needing more than the
+// budget goes over it. Evicted contents are copied into a buffer on the
+// GPU, and moved into memory, or into $RESIDENCY_CACHE_DIR when that is
+// set, once a later frame finds the copy's fence signaled; used before
+// then, they are uploaded again from that buffer. Without GL 3.2 the
+// eviction reads them back right away.
+struct ResidencyManager
+{
+  size_t budget;  // bytes, 0 for no limit
+  size_t resident_bytes;
+  std::vector<Resident> resources;
+  std::vector<int> free_ids;
+  std::list<int> lru;  // resident ids, the most recently used first
+  std::vector<int> readbacks;  // ids whose contents are still in a readback buffer
+  bool use_readback;
+  int frame;
+  int over_frame;  // the last frame counted in over_budget_frames
+  GpuResources* deleter;  // evicted names go through its queue, NULL to delete them right away
+  ResidencyStats stats;
+};
+
+void residency_init(ResidencyManager &residency, size_t budget, GpuResources* deleter);
+// deletes everything, on the GPU and off it
+void residency_free(ResidencyManager &residency);
+void residency_set_budget(ResidencyManager &residency, size_t budget);
+
+// Create and fill a texture or buffer, returns its id. Pixel rows are
+// 4-byte aligned, as with the default pack and unpack alignment.
+int residency_create_texture(ResidencyManager &residency, GLsizei width, GLsizei height,
+  GLint internal_format, GLenum format, GLenum type, const void* pixels,
+  GLint min_filter = GL_LINEAR, GLint mag_filter = GL_LINEAR);
+int residency_create_buffer(ResidencyManager &residency, GLsizeiptr size, const void* data,
+  GLenum usage = GL_STATIC_DRAW);
+// Account for a buffer or texture created elsewhere, whose name VAOs,
+// mappings or their owner hold on to, so it is never evicted. Buffers are
+// measured with GL_BUFFER_SIZE, textures take bytes. Destroying the id
+// only drops it from the accounting, the owner deletes the object.
+int residency_track(ResidencyManager &residency, ResidentType type, GLuint name, size_t bytes = 0);
+void residency_destroy(ResidencyManager &residency, int id);
+
+// The object's current name, uploading it again when it was evicted. Call
+// it every frame the object is drawn with, never keep the name longer.
+GLuint residency_use(ResidencyManager &residency, int id);
+
+// evicts down to the budget what the frame kept over it, and moves the
+// readbacks whose fences signaled into memory
+void residency_end_frame(ResidencyManager &residency);
+// residency, then evictions and uploads per frame since the last report
+void residency_report(ResidencyManager &residency, FILE* out);
+
+// Cycle through count textures of 256x256 RGBA, using working_set of them
+// per frame under the budget, and print the reports.
+void residency_benchmark(int count, int working_set, size_t budget);
+
+#endif
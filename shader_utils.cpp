@@ -1,4 +1,9 @@
 #include "shader_utils.h"
+#include "embedded_shaders.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
 
 using namespace std;
 
@@ -45,7 +50,7 @@ string file_read(const string filename)
 
   if (!filestream.is_open())
   {
-    return NULL;
+    return "";
   }
 
   // read contents of file into string
@@ -59,40 +64,163 @@ string file_read(const string filename)
   return contents;
 }
 
+int shader_source(const string filename, string &source, uint64_t &hash)
+{
+  const char* dir = getenv("SHADER_DIR");
+  if (dir != NULL && *dir != '\0')
+  {
+    source = file_read(string(dir) + "/" + filename);
+    hash = source_hash(source);
+    return source.empty() ? 0 : 1;
+  }
+
+  for (const EmbeddedShader &shader : embedded_shaders)
+  {
+    if (shader.name == filename)
+    {
+      source.assign(shader.source);
+      hash = shader.hash;
+      return 1;
+    }
+  }
+  return 0;
+}
+
 // Compile the shader from file 'filename', with error handling.
 // returns 0 on failure, non 0 on success
-GLuint create_shader(string filename, GLenum type)
+GLuint create_shader(string filename, GLenum type, int glsl_version, const string defines)
 {
-  string contents = file_read(filename);
-  const GLchar* source = contents.c_str();
-  if (source == NULL) 
+  string contents;
+  uint64_t hash;
+  if (!shader_source(filename, contents, hash))
   {
     cerr << "Error opening " << filename << endl;
     return 0;
   }
+  return create_shader_source(filename, contents, type, glsl_version, defines);
+}
+
+GLuint create_shader_source(const string name, const string &contents, GLenum type, int glsl_version,
+  const string defines)
+{
+  const GLchar* source = contents.c_str();
   GLuint res = glCreateShader(type);
-  const GLchar* sources[2] = 
-  {
+  const GLchar* version;
+  const GLchar* keywords = "";
 #ifdef GL_ES_VERSION_2_0
+  version =
   "#version 100\n"
-  "#define GLES2\n",
+  "#define GLES2\n";
 #else
-  "#version 120\n",
+  if (glsl_version >= 430)
+    version =
+      "#version 430 compatibility\n"
+      "#define HAVE_UBO\n"
+      "#define HAVE_SSBO\n";
+  else if (glsl_version >= 140)
+    version =
+      "#version 140\n"
+      "#define HAVE_UBO\n";
+  else
+    version = "#version 120\n";
+
+  // attribute, varying and texture2D are gone from 1.40 on, map them to the new keywords
+  if (glsl_version >= 140)
+    keywords = (GL_VERTEX_SHADER == type) ?
+      "#define attribute in\n"
+      "#define varying out\n"
+      :
+      "#define varying in\n"
+      "#define texture2D texture\n";
 #endif
+  const GLchar* sources[4] = 
+  {
+  version,
+  keywords,
+  defines.c_str(),
   source
   };
-  glShaderSource(res, 2, sources, NULL);
+  glShaderSource(res, 4, sources, NULL);
 
   glCompileShader(res);
   GLint compile_ok = GL_FALSE;
   glGetShaderiv(res, GL_COMPILE_STATUS, &compile_ok);
   if (GL_FALSE == compile_ok) 
   {
-    cerr << filename << endl;
+    cerr << name << endl;
     print_log(res);
     glDeleteShader(res);
     return 0;
   }
 
   return res;
+}
+
+uint64_t program_cache_key(uint64_t vs_hash, uint64_t fs_hash, int glsl_version)
+{
+  uint64_t parts[3] = { vs_hash, fs_hash, (uint64_t)glsl_version };
+  return source_hash(string_view((const char*)parts, sizeof(parts)));
+}
+
+static string program_binary_path(uint64_t key)
+{
+  const char* dir = getenv("SHADER_CACHE_DIR");
+  if (dir == NULL || *dir == '\0')
+    return "";
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+  return string(dir) + name;
+}
+
+GLuint load_program_binary(uint64_t key)
+{
+  if (!GLEW_ARB_get_program_binary) return 0;
+
+  string path = program_binary_path(key);
+  if (path.empty()) return 0;
+
+  string contents = file_read(path);
+  if (contents.size() <= sizeof(GLenum)) return 0;
+
+  GLenum format;
+  memcpy(&format, contents.data(), sizeof(format));
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, format, contents.data() + sizeof(format), contents.size() - sizeof(format));
+
+  // a driver update invalidates old binaries, the caller then links from source
+  GLint link_ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+  if (!link_ok)
+  {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void save_program_binary(GLuint program, uint64_t key)
+{
+  if (!GLEW_ARB_get_program_binary) return;
+
+  string path = program_binary_path(key);
+  if (path.empty()) return;
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+
+  vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+
+  ofstream out(path.c_str(), ios::out | ios::binary);
+  if (!out)
+  {
+    cerr << "Cannot write " << path << endl;
+    return;
+  }
+  out.write((const char*)&format, sizeof(format));
+  out.write(&binary[0], length);
 }
\ No newline at end of file
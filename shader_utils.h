@@ -2,13 +2,56 @@
 #define _CREATE_SHADER_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <GL/glew.h>
 
+// 64-bit FNV-1a, constexpr so embedded sources are hashed by the compiler
+constexpr uint64_t source_hash(std::string_view text)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (char c : text)
+    h = (h ^ (uint8_t)c) * 1099511628211ull;
+  return h;
+}
+
+// a shader compiled into the executable by embed_shaders.sh
+struct EmbeddedShader
+{
+  std::string_view name;
+  std::string_view source;
+  uint64_t hash;
+
+  constexpr EmbeddedShader(const char* name, const char* source)
+    : name(name), source(source), hash(source_hash(source)) {}
+};
+
 std::string file_read(const std::string filename);
 void print_log(GLuint object);
-GLuint create_shader(const std::string filename, GLenum type);
+
+// Text of a shader by file name: the copy embedded at build time, or the file
+// in $SHADER_DIR when that is set, so shaders can be edited without a rebuild.
+// Returns 1 when all is ok, 0 when there is no such shader.
+int shader_source(const std::string filename, std::string &source, uint64_t &hash);
+
+// glsl_version 120 is the default desktop path; 140 adds HAVE_UBO, 430 also
+// HAVE_SSBO, and both map attribute/varying/texture2D onto the newer keywords
+// so one source serves every version.
+// defines ("#define FOO 1\n"...) go between the version header and the source.
+GLuint create_shader(const std::string filename, GLenum type, int glsl_version = 120,
+  const std::string defines = "");
+// the same for source text from elsewhere, name is only for the error log
+GLuint create_shader_source(const std::string name, const std::string &source, GLenum type,
+  int glsl_version = 120, const std::string defines = "");
+
+// Program binaries are cached in $SHADER_CACHE_DIR (no caching when unset),
+// under a key built from the stage hashes.
+uint64_t program_cache_key(uint64_t vs_hash, uint64_t fs_hash, int glsl_version);
+// returns a linked program, or 0 when there is no usable binary for the key
+GLuint load_program_binary(uint64_t key);
+void save_program_binary(GLuint program, uint64_t key);
 
 #endif
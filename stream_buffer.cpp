@@ -0,0 +1,143 @@
+#include "stream_buffer.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+int stream_buffer_supported()
+{
+  return (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) ? 1 : 0;
+}
+
+int stream_buffer_create(StreamBuffer &stream, GLsizeiptr region_size)
+{
+  stream.region_size = region_size;
+  stream.region = 0;
+  stream.offset = 0;
+  stream.mapped = NULL;
+  stream.frames = stream.fence_waits = 0;
+  stream.wait_seconds = 0.0;
+  for (int i = 0; i < STREAM_REGIONS; i++)
+    stream.fences[i] = 0;
+
+  GLsizeiptr size = region_size * STREAM_REGIONS;
+  glGenBuffers(1, &stream.buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+
+  if (stream_buffer_supported())
+  {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+    stream.mapped = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+    if (NULL == stream.mapped)
+    {
+      cerr << "stream_buffer_create: could not map " << size << " bytes" << endl;
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+      return 0;
+    }
+  }
+  else
+  {
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+    stream.staging.resize(region_size);
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return 1;
+}
+
+void stream_buffer_free(StreamBuffer &stream, GpuResources* resources)
+{
+  for (int i = 0; i < STREAM_REGIONS; i++)
+  {
+    if (stream.fences[i])
+      glDeleteSync(stream.fences[i]);
+    stream.fences[i] = 0;
+  }
+  if (stream.mapped)
+  {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  gpu_delete(resources, GPU_BUFFER, stream.buffer);
+  stream.buffer = 0;
+  stream.mapped = NULL;
+  stream.staging.clear();
+}
+
+void stream_buffer_begin_frame(StreamBuffer &stream)
+{
+  stream.region = (stream.region + 1) % STREAM_REGIONS;
+  stream.offset = 0;
+  stream.frames++;
+
+  GLsync fence = stream.fences[stream.region];
+  if (fence)
+  {
+    // poll first, only a fence that has not signaled counts as a wait
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (GL_TIMEOUT_EXPIRED == status)
+    {
+      Clock::time_point start = Clock::now();
+      stream.fence_waits++;
+      do
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+      while (GL_TIMEOUT_EXPIRED == status);
+      stream.wait_seconds += chrono::duration<double>(Clock::now() - start).count();
+    }
+    if (GL_WAIT_FAILED == status)
+    {
+      // the fence says nothing, the region is only safe to write once the GPU is idle
+      cerr << "stream_buffer_begin_frame: glClientWaitSync failed, finishing before reusing region "
+        << stream.region << endl;
+      glFinish();
+    }
+    glDeleteSync(fence);
+    stream.fences[stream.region] = 0;
+  }
+}
+
+void* stream_buffer_alloc(StreamBuffer &stream, GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset)
+{
+  // align the offset in the buffer, regions need not start at a multiple of alignment
+  GLintptr base = stream.region * stream.region_size;
+  GLintptr start = (base + stream.offset + alignment - 1) / alignment * alignment - base;
+  if (start + size > stream.region_size)
+    return NULL;
+  stream.offset = start + size;
+
+  offset = base + start;
+  if (stream.mapped)
+    return stream.mapped + offset;
+  return &stream.staging[start];
+}
+
+void stream_buffer_flush(StreamBuffer &stream)
+{
+  if (stream.mapped || 0 == stream.offset) return;
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, stream.region * stream.region_size, stream.offset, &stream.staging[0]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void stream_buffer_end_frame(StreamBuffer &stream)
+{
+  if (!stream.mapped) return;
+  // ending the same region twice replaces its fence, the newer one covers both
+  if (stream.fences[stream.region])
+    glDeleteSync(stream.fences[stream.region]);
+  stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void stream_buffer_print_stats(const StreamBuffer &stream, const char* name)
+{
+  printf("%s: %d regions of %ld bytes, %d fence waits in %d frames, %.3f ms waiting\n",
+    name, STREAM_REGIONS, (long)stream.region_size, stream.fence_waits, stream.frames,
+    stream.wait_seconds * 1000.0);
+}
@@ -0,0 +1,59 @@
+#ifndef _STREAM_BUFFER_H
+#define _STREAM_BUFFER_H
+
+#include <vector>
+#include <GL/glew.h>
+
+#include "gpu_resources.h"
+
+// frames the CPU may run ahead of the GPU
+#define STREAM_REGIONS 3
+
+// Ring allocator for data rewritten every frame. One buffer is created with
+// GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT and mapped once; it is split
+// into STREAM_REGIONS regions, each guarded by a fence placed after the last
+// draw reading it. The CPU writes straight into the mapping, no driver copy.
+// Without ARB_buffer_storage the data goes through a CPU staging copy and
+// glBufferSubData instead.
+struct StreamBuffer
+{
+  GLuint buffer;
+  char* mapped;  // NULL on the fallback path
+  GLsizeiptr region_size;
+  int region;    // region written this frame
+  GLsizeiptr offset;  // first free byte in it
+  GLsync fences[STREAM_REGIONS];
+  std::vector<char> staging;  // fallback path only
+
+  // a wait means the GPU was STREAM_REGIONS frames behind, so the ring is too small
+  int frames;
+  int fence_waits;
+  double wait_seconds;
+};
+
+// GL 4.4 or ARB_buffer_storage
+int stream_buffer_supported();
+
+// returns 1 when all is ok, 0 with a displayed error
+int stream_buffer_create(StreamBuffer &stream, GLsizeiptr region_size);
+// with resources, the buffer goes through its deletion queue once unmapped
+void stream_buffer_free(StreamBuffer &stream, GpuResources* resources = NULL);
+
+// move to the next region, waiting until the GPU is done with it
+void stream_buffer_begin_frame(StreamBuffer &stream);
+
+// Room for size bytes at a multiple of alignment in this frame's region.
+// Returns where to write them and sets offset to their place in the buffer,
+// or returns NULL when the region is full.
+void* stream_buffer_alloc(StreamBuffer &stream, GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset);
+
+// make this frame's writes visible to GL; a no-op for the coherent mapping
+void stream_buffer_flush(StreamBuffer &stream);
+
+// fence the region, call after the last draw that reads it; calling it again
+// before the next begin_frame replaces the fence
+void stream_buffer_end_frame(StreamBuffer &stream);
+
+void stream_buffer_print_stats(const StreamBuffer &stream, const char* name);
+
+#endif
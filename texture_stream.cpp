@@ -0,0 +1,543 @@
+#include "texture_stream.h"
+#include "gl_state.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+int texture_stream_supported()
+{
+  return (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object) ? 1 : 0;
+}
+
+static GLsizei level_size(GLsizei size, int level)
+{
+  return (size >> level) > 0 ? size >> level : 1;
+}
+
+// Average the input texels each output texel covers; sizes need not halve
+// exactly, as with odd or non-square levels.
+static void downsample(const uint8_t* in, GLsizei in_width, GLsizei in_height, int components,
+  uint8_t* out, GLsizei width, GLsizei height)
+{
+  size_t stride = (size_t)in_width * components;
+  for (GLsizei y = 0; y < height; y++)
+  {
+    GLsizei y0 = (GLsizei)((long long)y * in_height / height);
+    GLsizei y1 = max(y0 + 1, (GLsizei)((long long)(y + 1) * in_height / height));
+    for (GLsizei x = 0; x < width; x++)
+    {
+      GLsizei x0 = (GLsizei)((long long)x * in_width / width);
+      GLsizei x1 = max(x0 + 1, (GLsizei)((long long)(x + 1) * in_width / width));
+      unsigned sum[4] = { 0, 0, 0, 0 };
+      for (GLsizei sy = y0; sy < y1; sy++)
+      {
+        const uint8_t* texel = in + sy * stride + (size_t)x0 * components;
+        for (GLsizei sx = x0; sx < x1; sx++, texel += components)
+          for (int c = 0; c < components; c++)
+            sum[c] += texel[c];
+      }
+      unsigned count = (y1 - y0) * (x1 - x0);
+      for (int c = 0; c < 4; c++)
+        out[c] = (c < components) ? (uint8_t)((sum[c] + count / 2) / count) : 255;
+      out += 4;
+    }
+  }
+}
+
+static void build_mips(StreamSource &source)
+{
+  source.mips.resize(source.levels);
+  for (int level = 1; level < source.levels; level++)
+  {
+    GLsizei width = level_size(source.width, level), height = level_size(source.height, level);
+    source.mips[level].resize((size_t)width * height * 4);
+    if (1 == level)
+      downsample(source.pixels, source.width, source.height, source.components, &source.mips[1][0], width, height);
+    else
+      downsample(&source.mips[level - 1][0], level_size(source.width, level - 1),
+        level_size(source.height, level - 1), 4, &source.mips[level][0], width, height);
+  }
+}
+
+// the band's rows in RGBA8
+static void decode_band(const StreamJob &job, uint8_t* out)
+{
+  StreamSource &source = *job.source;
+  GLsizei width = level_size(source.width, job.level);
+  if (0 == job.level)
+  {
+    size_t stride = (size_t)source.width * source.components;
+    downsample(source.pixels + job.first_row * stride, source.width, job.rows, source.components,
+      out, width, job.rows);
+    return;
+  }
+  // the coarsest bands come first, so this runs before anything is visible
+  call_once(source.built, build_mips, ref(source));
+  memcpy(out, &source.mips[job.level][(size_t)job.first_row * width * 4], (size_t)width * job.rows * 4);
+}
+
+static void worker(TextureStream* stream)
+{
+  for (;;)
+  {
+    int slot;
+    {
+      unique_lock<mutex> guard(stream->lock);
+      stream->work.wait(guard, [&] { return stream->stopping || !stream->decode.empty(); });
+      if (stream->stopping) return;
+      slot = stream->decode.front();
+      stream->decode.pop_front();
+    }
+
+    Clock::time_point start = Clock::now();
+    StreamSlot &decoding = stream->slots[slot];
+    decode_band(decoding.job, stream->mapped ? stream->mapped + slot * stream->slot_size : &decoding.staging[0]);
+
+    lock_guard<mutex> guard(stream->lock);
+    decoding.state = SLOT_DECODED;
+    stream->decode_seconds += seconds_since(start);
+  }
+}
+
+int texture_stream_init(TextureStream &stream, GLsizeiptr slot_size, size_t frame_budget, int threads)
+{
+  // slots start 4-byte aligned, as glTexSubImage2D wants RGBA8 rows to
+  stream.slot_size = (slot_size + 255) & ~(GLsizeiptr)255;
+  stream.frame_budget = frame_budget;
+  stream.mapped = NULL;
+  stream.textures.clear();
+  stream.pending.clear();
+  stream.sequence = 0;
+  stream.frame = 0;
+  stream.decode.clear();
+  stream.stopping = false;
+  stream.frames = stream.budget_frames = 0;
+  stream.uploads = 0;
+  stream.upload_bytes = 0;
+  stream.upload_seconds = stream.decode_seconds = 0.0;
+  for (int i = 0; i < TEXTURE_STREAM_SLOTS; i++)
+  {
+    stream.slots[i].state = SLOT_FREE;
+    stream.slots[i].fence = 0;
+  }
+
+  GLsizeiptr size = stream.slot_size * TEXTURE_STREAM_SLOTS;
+  glGenBuffers(1, &stream.pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream.pbo);
+  if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)
+  {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+    stream.mapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    if (NULL == stream.mapped)
+    {
+      cerr << "texture_stream_init: could not map " << size << " bytes" << endl;
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return 0;
+    }
+  }
+  else
+  {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    for (int i = 0; i < TEXTURE_STREAM_SLOTS; i++)
+      stream.slots[i].staging.resize(stream.slot_size);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  for (int i = 0; i < max(threads, 1); i++)
+    stream.workers.push_back(thread(worker, &stream));
+  return 1;
+}
+
+void texture_stream_free(TextureStream &stream)
+{
+  {
+    lock_guard<mutex> guard(stream.lock);
+    stream.stopping = true;
+  }
+  stream.work.notify_all();
+  for (size_t i = 0; i < stream.workers.size(); i++)
+    stream.workers[i].join();
+  stream.workers.clear();
+  stream.decode.clear();
+  stream.pending.clear();
+
+  for (int i = 0; i < TEXTURE_STREAM_SLOTS; i++)
+  {
+    if (stream.slots[i].fence)
+      glDeleteSync(stream.slots[i].fence);
+    stream.slots[i].fence = 0;
+    stream.slots[i].state = SLOT_FREE;
+    vector<uint8_t>().swap(stream.slots[i].staging);
+  }
+  if (stream.mapped)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream.pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  glDeleteBuffers(1, &stream.pbo);
+  stream.pbo = 0;
+  stream.mapped = NULL;
+
+  for (size_t i = 0; i < stream.textures.size(); i++)
+    glDeleteTextures(1, &stream.textures[i].name);
+  stream.textures.clear();
+  gl_state_invalidate();
+}
+
+int texture_stream_load(TextureStream &stream, GLsizei width, GLsizei height, int components,
+  const uint8_t* pixels)
+{
+  if (components != 3 && components != 4)
+  {
+    cerr << "texture_stream_load: " << components << " bytes per pixel, only RGB and RGBA stream" << endl;
+    return -1;
+  }
+  if ((GLsizeiptr)width * 4 > stream.slot_size)
+  {
+    cerr << "texture_stream_load: a row of " << width << " texels does not fit a slot of "
+      << stream.slot_size << " bytes" << endl;
+    return -1;
+  }
+
+  StreamTexture texture;
+  texture.width = width;
+  texture.height = height;
+  texture.levels = 1;
+  while ((max(width, height) >> texture.levels) > 0)
+    texture.levels++;
+  texture.base_level = texture.levels;
+  texture.load_frame = stream.frame;
+  texture.visible_frame = texture.done_frame = -1;
+
+  // every level allocated up front, sampled from the coarsest until more arrive
+  glGenTextures(1, &texture.name);
+  gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture.name);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.levels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+  for (int level = 0; level < texture.levels; level++)
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, level_size(width, level), level_size(height, level), 0,
+      GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  int id = stream.textures.size();
+  StreamJob job;
+  job.texture = id;
+  job.source = make_shared<StreamSource>();
+  job.source->pixels = pixels;
+  job.source->width = width;
+  job.source->height = height;
+  job.source->components = components;
+  job.source->levels = texture.levels;
+  texture.bands_left.resize(texture.levels);
+  for (int level = 0; level < texture.levels; level++)
+  {
+    GLsizei level_width = level_size(width, level), level_height = level_size(height, level);
+    GLsizei band_rows = stream.slot_size / (level_width * 4);
+    size_t bytes = (size_t)level_width * level_height * 4;
+    job.level = level;
+    texture.bands_left[level] = 0;
+    for (GLsizei row = 0; row < level_height; row += band_rows)
+    {
+      job.first_row = row;
+      job.rows = min(band_rows, level_height - row);
+      job.sequence = stream.sequence++;
+      stream.pending.insert(make_pair(bytes, job));
+      texture.bands_left[level]++;
+    }
+  }
+  stream.textures.push_back(texture);
+  return id;
+}
+
+// the band in a slot into its level, then what it completes
+static void upload(TextureStream &stream, int slot_index)
+{
+  StreamSlot &slot = stream.slots[slot_index];
+  StreamTexture &texture = stream.textures[slot.job.texture];
+  GLsizei width = level_size(texture.width, slot.job.level);
+  GLsizeiptr offset = slot_index * stream.slot_size;
+  size_t bytes = (size_t)width * slot.job.rows * 4;
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream.pbo);
+  if (!stream.mapped)
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, bytes, &slot.staging[0]);
+  gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture.name);
+  glTexSubImage2D(GL_TEXTURE_2D, slot.job.level, 0, slot.job.first_row, width, slot.job.rows,
+    GL_RGBA, GL_UNSIGNED_BYTE, (const void*)offset);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // glBufferSubData already waits for the previous upload out of the slot
+  if (stream.mapped)
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  {
+    lock_guard<mutex> guard(stream.lock);
+    slot.state = stream.mapped ? SLOT_UPLOADING : SLOT_FREE;
+  }
+  stream.uploads++;
+  stream.upload_bytes += bytes;
+
+  texture.bands_left[slot.job.level]--;
+  slot.job.source.reset();
+  int base_level = texture.base_level;
+  while (base_level > 0 && 0 == texture.bands_left[base_level - 1])
+    base_level--;
+  if (base_level != texture.base_level)
+  {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base_level);
+    texture.base_level = base_level;
+    if (texture.visible_frame < 0)
+      texture.visible_frame = stream.frame;
+    if (0 == base_level)
+      texture.done_frame = stream.frame;
+  }
+}
+
+// recycle, upload, then refill the slots
+static void stream_step(TextureStream &stream)
+{
+  // the workers write the states under the lock; fences stay on this thread
+  vector<int> uploading;
+  {
+    lock_guard<mutex> guard(stream.lock);
+    for (int i = 0; i < TEXTURE_STREAM_SLOTS; i++)
+      if (SLOT_UPLOADING == stream.slots[i].state)
+        uploading.push_back(i);
+  }
+  vector<int> completed;
+  for (size_t i = 0; i < uploading.size(); i++)
+  {
+    StreamSlot &slot = stream.slots[uploading[i]];
+    GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (GL_TIMEOUT_EXPIRED == status) continue;
+    if (GL_WAIT_FAILED == status)
+    {
+      // the fence says nothing, the slot is only free once the GPU is idle
+      cerr << "texture_stream_update: glClientWaitSync failed, finishing before reusing slot "
+        << uploading[i] << endl;
+      glFinish();
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+    completed.push_back(uploading[i]);
+  }
+  if (!completed.empty())
+  {
+    lock_guard<mutex> guard(stream.lock);
+    for (size_t i = 0; i < completed.size(); i++)
+      stream.slots[completed[i]].state = SLOT_FREE;
+  }
+
+  // the workers finish in any order, the bands go up in the order they were queued
+  vector<int> decoded;
+  {
+    lock_guard<mutex> guard(stream.lock);
+    for (int i = 0; i < TEXTURE_STREAM_SLOTS; i++)
+      if (SLOT_DECODED == stream.slots[i].state)
+        decoded.push_back(i);
+  }
+  sort(decoded.begin(), decoded.end(), [&](int a, int b) {
+    return stream.slots[a].job.sequence < stream.slots[b].job.sequence;
+  });
+
+  Clock::time_point start = Clock::now();
+  size_t uploaded = 0;
+  for (size_t i = 0; i < decoded.size(); i++)
+  {
+    const StreamJob &job = stream.slots[decoded[i]].job;
+    size_t bytes = (size_t)level_size(job.source->width, job.level) * job.rows * 4;
+    // the first band always goes, however large
+    if (stream.frame_budget && uploaded > 0 && uploaded + bytes > stream.frame_budget)
+    {
+      stream.budget_frames++;
+      break;
+    }
+    upload(stream, decoded[i]);
+    uploaded += bytes;
+  }
+  stream.upload_seconds += seconds_since(start);
+
+  bool queued = false;
+  {
+    lock_guard<mutex> guard(stream.lock);
+    for (int i = 0; i < TEXTURE_STREAM_SLOTS && !stream.pending.empty(); i++)
+    {
+      if (SLOT_FREE != stream.slots[i].state) continue;
+      stream.slots[i].job = stream.pending.begin()->second;
+      stream.slots[i].state = SLOT_DECODING;
+      stream.pending.erase(stream.pending.begin());
+      stream.decode.push_back(i);
+      queued = true;
+    }
+  }
+  if (queued)
+    stream.work.notify_all();
+}
+
+size_t texture_stream_bytes(const TextureStream &stream, int id)
+{
+  const StreamTexture &texture = stream.textures[id];
+  size_t bytes = 0;
+  for (int level = 0; level < texture.levels; level++)
+    bytes += 4 * (size_t)level_size(texture.width, level) * level_size(texture.height, level);
+  return bytes;
+}
+
+void texture_stream_update(TextureStream &stream)
+{
+  stream.frame++;
+  stream.frames++;
+  stream_step(stream);
+}
+
+bool texture_stream_idle(TextureStream &stream)
+{
+  lock_guard<mutex> guard(stream.lock);
+  if (!stream.pending.empty()) return false;
+  for (int i = 0; i < TEXTURE_STREAM_SLOTS; i++)
+    if (SLOT_FREE != stream.slots[i].state)
+      return false;
+  return true;
+}
+
+void texture_stream_finish(TextureStream &stream)
+{
+  size_t frame_budget = stream.frame_budget;
+  stream.frame_budget = 0;
+  stream_step(stream);
+  while (!texture_stream_idle(stream))
+  {
+    this_thread::sleep_for(chrono::milliseconds(1));
+    stream_step(stream);
+  }
+  stream.frame_budget = frame_budget;
+}
+
+void texture_stream_report(TextureStream &stream, FILE* out)
+{
+  if (0 == stream.frames) return;
+  int loading = 0;
+  for (size_t i = 0; i < stream.textures.size(); i++)
+    if (stream.textures[i].done_frame < 0)
+      loading++;
+  double decode_seconds;
+  {
+    lock_guard<mutex> guard(stream.lock);
+    decode_seconds = stream.decode_seconds;
+    stream.decode_seconds = 0.0;
+  }
+  double frames = stream.frames;
+  fprintf(out, "texture stream: per frame %.1f uploads %.1f KB in %.3f ms, %.3f ms decoding on %d workers; "
+    "%d frames at the budget; %d of %d textures loading\n", stream.uploads / frames,
+    stream.upload_bytes / 1024.0 / frames, stream.upload_seconds * 1000.0 / frames,
+    decode_seconds * 1000.0 / frames, (int)stream.workers.size(), stream.budget_frames, loading,
+    (int)stream.textures.size());
+  stream.frames = stream.budget_frames = 0;
+  stream.uploads = 0;
+  stream.upload_bytes = 0;
+  stream.upload_seconds = 0.0;
+}
+
+// ----- BENCHMARK -----
+
+void texture_stream_benchmark(int count, int size)
+{
+  if (!texture_stream_supported())
+  {
+    cerr << "texture_stream_benchmark: pixel buffer objects need OpenGL 2.1" << endl;
+    return;
+  }
+
+  // every texture filled with its own value, which each of its levels must then have
+  vector<vector<uint8_t> > sources(count);
+  for (int i = 0; i < count; i++)
+    sources[i].assign((size_t)size * size * 3, (uint8_t)(i * 37 + 11));
+  printf("%d textures of %dx%d RGB\n", count, size, size);
+
+  // one texture per frame, as init_resources did it
+  if (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object)
+  {
+    vector<GLuint> names(count);
+    double longest = 0.0;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < count; i++)
+    {
+      Clock::time_point frame_start = Clock::now();
+      glGenTextures(1, &names[i]);
+      gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, names[i]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, &sources[i][0]);
+      glGenerateMipmap(GL_TEXTURE_2D);
+      glFinish();
+      longest = max(longest, seconds_since(frame_start));
+    }
+    printf("  glTexImage2D: %d frames in %.3f ms, the longest %.3f ms\n", count, seconds_since(start) * 1000.0,
+      longest * 1000.0);
+    glDeleteTextures(count, &names[0]);
+    gl_state_invalidate();
+  }
+
+  TextureStream stream;
+  if (!texture_stream_init(stream, 256 << 10, 1 << 20, max((int)thread::hardware_concurrency() / 2, 1)))
+    return;
+  Clock::time_point start = Clock::now();
+  double longest = 0.0;
+  vector<int> ids(count);
+  for (int i = 0; i < count; i++)
+    ids[i] = texture_stream_load(stream, size, size, 3, &sources[i][0]);
+  longest = seconds_since(start);
+  // frames at 60 Hz, the workers decode in between
+  int frames = 0;
+  while (!texture_stream_idle(stream))
+  {
+    Clock::time_point frame_start = Clock::now();
+    texture_stream_update(stream);
+    glFinish();
+    longest = max(longest, seconds_since(frame_start));
+    frames++;
+    this_thread::sleep_until(frame_start + chrono::microseconds(16667));
+  }
+  double seconds = seconds_since(start);
+
+  int visible = 0, done = 0, damaged = 0;
+  vector<uint8_t> pixels((size_t)size * size * 4);
+  for (int i = 0; i < count; i++)
+  {
+    const StreamTexture &texture = stream.textures[ids[i]];
+    visible = max(visible, texture.visible_frame - texture.load_frame);
+    done = max(done, texture.done_frame - texture.load_frame);
+    uint8_t value = (uint8_t)(i * 37 + 11);
+    gl_state_bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, texture.name);
+    // the finest level and the coarsest
+    bool intact = true;
+    int levels[2] = { 0, texture.levels - 1 };
+    for (int k = 0; k < 2; k++)
+    {
+      glGetTexImage(GL_TEXTURE_2D, levels[k], GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+      size_t last = (size_t)level_size(size, levels[k]) * level_size(size, levels[k]) * 4 - 1;
+      if (pixels[0] != value || pixels[last - 1] != value || pixels[last] != 255)
+        intact = false;
+    }
+    if (!intact)
+      damaged++;
+  }
+  printf("  streamed: %d frames in %.3f ms, the longest %.3f ms; all visible after %d frames, complete after %d\n",
+    frames, seconds * 1000.0, longest * 1000.0, visible, done);
+  printf("  ");
+  texture_stream_report(stream, stdout);
+  printf("  %d of %d textures uploaded intact\n", count - damaged, count);
+  texture_stream_free(stream);
+}
@@ -0,0 +1,136 @@
+#ifndef _TEXTURE_STREAM_H
+#define _TEXTURE_STREAM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <GL/glew.h>
+
+// pixel buffer slots in the ring, each holding one band of rows
+#define TEXTURE_STREAM_SLOTS 8
+
+// A texture's pixels as the workers see them. The levels below the first
+// are built on the first band that needs one, all at once, each from the
+// one above it; the first level is converted band by band.
+struct StreamSource
+{
+  const uint8_t* pixels;  // the caller's, tightly packed
+  GLsizei width, height;
+  int components;         // 3 for RGB or 4 for RGBA
+  int levels;
+  std::once_flag built;
+  std::vector<std::vector<uint8_t> > mips;  // RGBA8, by level, the first left empty
+};
+
+// Rows first_row to first_row + rows of one mip level. It carries its
+// source, so the workers never read textures while the GL thread grows it.
+struct StreamJob
+{
+  int texture;
+  int level;
+  GLsizei first_row, rows;
+  long sequence;  // order of submission, uploads follow it
+  std::shared_ptr<StreamSource> source;  // freed with the texture's last band
+};
+
+// FREE -> DECODING on a worker -> DECODED -> UPLOADING until its fence signals -> FREE
+enum StreamSlotState { SLOT_FREE, SLOT_DECODING, SLOT_DECODED, SLOT_UPLOADING };
+
+struct StreamSlot
+{
+  StreamSlotState state;
+  StreamJob job;
+  GLsync fence;
+  std::vector<uint8_t> staging;  // fallback path only
+};
+
+// A texture filling in from its coarsest level. Its base level is the finest
+// level uploaded along with every coarser one, so it samples at whatever
+// resolution has arrived so far.
+struct StreamTexture
+{
+  GLuint name;
+  GLsizei width, height;
+  int levels;
+  int base_level;          // levels until the coarsest has arrived
+  std::vector<int> bands_left;  // by level
+  int load_frame, visible_frame, done_frame;  // -1 until then
+};
+
+// Textures uploaded a few bands per frame. Worker threads decode the
+// source's RGBA8 mip levels straight into one buffer of TEXTURE_STREAM_SLOTS
+// slots, mapped once with GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT; the
+// GL thread issues glTexSubImage2D from the slots' offsets, at most
+// frame_budget bytes per frame, and fences them before they are reused.
+// Levels are decoded and uploaded smallest first, across all textures.
+// Without ARB_buffer_storage the workers decode into staging memory and
+// glBufferSubData fills the buffer instead.
+struct TextureStream
+{
+  GLuint pbo;
+  uint8_t* mapped;  // NULL on the fallback path
+  GLsizeiptr slot_size;
+  size_t frame_budget;
+  StreamSlot slots[TEXTURE_STREAM_SLOTS];
+  std::vector<StreamTexture> textures;
+  std::multimap<size_t, StreamJob> pending;  // by the level's bytes, then submission
+  long sequence;
+  int frame;
+
+  // the workers take slots from decode and hand them back DECODED
+  std::mutex lock;
+  std::condition_variable work;
+  std::deque<int> decode;
+  std::vector<std::thread> workers;
+  bool stopping;
+
+  // since the last report
+  int frames, budget_frames;  // budget_frames: frames that left decoded bands for later
+  long uploads;
+  size_t upload_bytes;
+  double upload_seconds, decode_seconds;  // GL thread issuing uploads, workers decoding
+};
+
+// pixel buffer objects, GL 2.1
+int texture_stream_supported();
+
+// Slots of slot_size bytes, decoded by threads workers. Returns 1 when all
+// is ok, 0 with a displayed error.
+int texture_stream_init(TextureStream &stream, GLsizeiptr slot_size, size_t frame_budget, int threads);
+// stops the workers, deletes the buffer and every texture
+void texture_stream_free(TextureStream &stream);
+
+// Create a mipmapped RGBA8 texture for tightly packed 8-bit RGB or RGBA
+// pixels and queue its levels, returns its index in textures or -1 with a
+// displayed error. The name is usable right away; the pixels must stay
+// valid until the texture is done.
+int texture_stream_load(TextureStream &stream, GLsizei width, GLsizei height, int components,
+  const uint8_t* pixels);
+
+// the texture's RGBA8 levels, all allocated at load
+size_t texture_stream_bytes(const TextureStream &stream, int id);
+
+// Recycle the slots whose uploads completed, upload decoded bands within
+// the budget and hand the free slots the next levels. Call once per frame.
+void texture_stream_update(TextureStream &stream);
+// nothing left to decode or upload
+bool texture_stream_idle(TextureStream &stream);
+// update until idle, ignoring the budget
+void texture_stream_finish(TextureStream &stream);
+
+// uploads per frame, time spent on either side and the textures still loading
+void texture_stream_report(TextureStream &stream, FILE* out);
+
+// Load count textures of size x size with glTexImage2D and glGenerateMipmap,
+// then through the stream, printing the longest frame of each and how many
+// frames the textures took to appear and to complete.
+void texture_stream_benchmark(int count, int size);
+
+#endif
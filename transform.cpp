@@ -0,0 +1,256 @@
+#include "transform.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+void transform_init(TransformHierarchy &hierarchy)
+{
+  hierarchy.parent.clear();
+  hierarchy.depth.clear();
+  hierarchy.slot_of.clear();
+  hierarchy.node.clear();
+  hierarchy.parent_slot.clear();
+  hierarchy.child_start.clear();
+  hierarchy.child_end.clear();
+  hierarchy.local.clear();
+  hierarchy.world.clear();
+  hierarchy.dirty.clear();
+  hierarchy.level_start.assign(1, 0);
+  hierarchy.sorted = true;
+  hierarchy.dirty_nodes.clear();
+}
+
+int transform_add(TransformHierarchy &hierarchy, int parent, const glm::mat4 &local)
+{
+  int id = hierarchy.parent.size();
+  hierarchy.parent.push_back(parent);
+  hierarchy.depth.push_back(parent >= 0 ? hierarchy.depth[parent] + 1 : 0);
+
+  // appended for now, transform_update moves it to its level
+  hierarchy.slot_of.push_back(hierarchy.node.size());
+  hierarchy.node.push_back(id);
+  hierarchy.parent_slot.push_back(parent >= 0 ? hierarchy.slot_of[parent] : -1);
+  hierarchy.child_start.push_back(0);
+  hierarchy.child_end.push_back(0);
+  hierarchy.local.push_back(local);
+  hierarchy.world.push_back(local);
+  hierarchy.dirty.push_back(1);
+  hierarchy.dirty_nodes.push_back(id);
+  hierarchy.sorted = false;
+  return id;
+}
+
+void transform_set_local(TransformHierarchy &hierarchy, int node, const glm::mat4 &local)
+{
+  int slot = hierarchy.slot_of[node];
+  hierarchy.local[slot] = local;
+  if (!hierarchy.dirty[slot])
+  {
+    hierarchy.dirty[slot] = 1;
+    hierarchy.dirty_nodes.push_back(node);
+  }
+}
+
+const glm::mat4 &transform_world(const TransformHierarchy &hierarchy, int node)
+{
+  return hierarchy.world[hierarchy.slot_of[node]];
+}
+
+// Breadth-first order: the roots by id, then the children of every slot in
+// slot order, which keeps each level together and siblings next to each other.
+static void sort_levels(TransformHierarchy &hierarchy)
+{
+  int count = hierarchy.node.size();
+
+  // children by node id, counting sorted by parent
+  vector<int> first_child(count + 1, 0), children(count);
+  for (int id = 0; id < count; id++)
+    if (hierarchy.parent[id] >= 0)
+      first_child[hierarchy.parent[id] + 1]++;
+  for (int id = 0; id < count; id++)
+    first_child[id + 1] += first_child[id];
+  vector<int> next_child(first_child.begin(), first_child.end() - 1);
+  for (int id = 0; id < count; id++)
+    if (hierarchy.parent[id] >= 0)
+      children[next_child[hierarchy.parent[id]]++] = id;
+
+  vector<int> order;
+  order.reserve(count);
+  for (int id = 0; id < count; id++)
+    if (hierarchy.parent[id] < 0)
+      order.push_back(id);
+  for (size_t i = 0; i < order.size(); i++)
+    for (int c = first_child[order[i]]; c < first_child[order[i] + 1]; c++)
+      order.push_back(children[c]);
+
+  vector<glm::mat4> local(count), world(count);
+  vector<uint8_t> dirty(count);
+  for (int slot = 0; slot < count; slot++)
+  {
+    int id = order[slot];
+    int old_slot = hierarchy.slot_of[id];
+    local[slot] = hierarchy.local[old_slot];
+    world[slot] = hierarchy.world[old_slot];
+    dirty[slot] = hierarchy.dirty[old_slot];
+  }
+  for (int slot = 0; slot < count; slot++)
+    hierarchy.slot_of[order[slot]] = slot;
+
+  // a slot's children were appended together, in slot order, after the roots
+  vector<int> &level_start = hierarchy.level_start;
+  level_start.clear();
+  int child = 0;
+  for (int slot = 0; slot < count; slot++)
+  {
+    int id = order[slot];
+    if (hierarchy.parent[id] < 0)
+      child++;
+    if (0 == slot || hierarchy.depth[id] != hierarchy.depth[order[slot - 1]])
+      level_start.push_back(slot);
+  }
+  level_start.push_back(count);
+  for (int slot = 0; slot < count; slot++)
+  {
+    int id = order[slot];
+    int parent = hierarchy.parent[id];
+    hierarchy.parent_slot[slot] = parent >= 0 ? hierarchy.slot_of[parent] : -1;
+    hierarchy.child_start[slot] = child;
+    child += first_child[id + 1] - first_child[id];
+    hierarchy.child_end[slot] = child;
+  }
+
+  hierarchy.node.swap(order);
+  hierarchy.local.swap(local);
+  hierarchy.world.swap(world);
+  hierarchy.dirty.swap(dirty);
+  hierarchy.sorted = true;
+}
+
+static int slot_depth(const TransformHierarchy &hierarchy, int slot)
+{
+  return hierarchy.depth[hierarchy.node[slot]];
+}
+
+int transform_update(TransformHierarchy &hierarchy)
+{
+  if (!hierarchy.sorted)
+    sort_levels(hierarchy);
+
+  // the changed nodes by slot, so by depth
+  vector<int> &roots = hierarchy.roots;
+  roots.clear();
+  for (size_t i = 0; i < hierarchy.dirty_nodes.size(); i++)
+    roots.push_back(hierarchy.slot_of[hierarchy.dirty_nodes[i]]);
+  hierarchy.dirty_nodes.clear();
+  sort(roots.begin(), roots.end());
+
+  // Level by level, the children of the slots just recomputed plus the
+  // changed nodes of that depth whose parent was not. A level only reads the
+  // level above it, which is already done.
+  vector<int> &level = hierarchy.level, &next_level = hierarchy.next_level, &previous = hierarchy.previous_level;
+  level.clear();
+  previous.clear();
+  size_t root = 0;
+  int depth = 0, updated = 0;
+  while (root < roots.size() || !level.empty())
+  {
+    if (level.empty())
+      depth = slot_depth(hierarchy, roots[root]);
+    for (; root < roots.size() && slot_depth(hierarchy, roots[root]) == depth; root++)
+    {
+      int parent = hierarchy.parent_slot[roots[root]];
+      if (parent < 0 || 2 != hierarchy.dirty[parent])
+        level.push_back(roots[root]);
+    }
+
+    parallel_for(level.size(), 4096, [&](int begin, int end) {
+      for (int i = begin; i < end; i++)
+      {
+        int slot = level[i];
+        int parent = hierarchy.parent_slot[slot];
+        hierarchy.world[slot] = parent >= 0 ? hierarchy.world[parent] * hierarchy.local[slot] : hierarchy.local[slot];
+        hierarchy.dirty[slot] = 2;
+      }
+    });
+    updated += level.size();
+
+    for (size_t i = 0; i < previous.size(); i++)
+      hierarchy.dirty[previous[i]] = 0;
+    next_level.clear();
+    for (size_t i = 0; i < level.size(); i++)
+      for (int child = hierarchy.child_start[level[i]]; child < hierarchy.child_end[level[i]]; child++)
+        next_level.push_back(child);
+    previous.swap(level);
+    level.swap(next_level);
+    depth++;
+  }
+
+  // the last level, and the changed nodes an ancestor's update covered
+  for (size_t i = 0; i < previous.size(); i++)
+    hierarchy.dirty[previous[i]] = 0;
+  for (size_t i = 0; i < roots.size(); i++)
+    hierarchy.dirty[roots[i]] = 0;
+  return updated;
+}
+
+// ----- BENCHMARK -----
+
+void transform_benchmark(int count)
+{
+  const int FRAMES = 100;
+  TransformHierarchy hierarchy;
+  transform_init(hierarchy);
+  for (int i = 0; i < count; i++)
+  {
+    glm::mat4 local = glm::translate(glm::mat4(1.0f), glm::vec3(1.0, 0.0, 0.0));
+    transform_add(hierarchy, i > 0 ? (i - 1) / 4 : -1, glm::rotate(local, i * 0.1f, glm::vec3(0.0, 1.0, 0.0)));
+  }
+  transform_update(hierarchy);
+  printf("%d nodes, %d levels, %d threads\n", count, (int)hierarchy.level_start.size() - 1, parallel_threads());
+
+  // changes at leaves recompute only themselves, so 5% of the nodes changing is 5% recomputed
+  vector<int> leaves;
+  for (int id = 0; id < count; id++)
+  {
+    int slot = hierarchy.slot_of[id];
+    if (hierarchy.child_start[slot] == hierarchy.child_end[slot])
+      leaves.push_back(id);
+  }
+
+  srand(1);
+  for (int everything = 0; everything < 2; everything++)
+  {
+    double seconds = 0.0;
+    long updated = 0;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+      int changes = everything ? count : count / 20;
+      for (int i = 0; i < changes; i++)
+      {
+        int node = everything ? i : leaves[rand() % leaves.size()];
+        glm::mat4 local = glm::translate(glm::mat4(1.0f), glm::vec3(1.0, 0.0, 0.0));
+        transform_set_local(hierarchy, node, glm::rotate(local, frame * 0.01f + node, glm::vec3(0.0, 1.0, 0.0)));
+      }
+      Clock::time_point start = Clock::now();
+      updated += transform_update(hierarchy);
+      seconds += seconds_since(start);
+    }
+    printf("  %-22s %10.3f ms/update %10ld nodes recomputed/update\n",
+      everything ? "every node changing" : "5% of nodes changing", seconds * 1000.0 / FRAMES, updated / FRAMES);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef _TRANSFORM_H
+#define _TRANSFORM_H
+
+#include <stdint.h>
+#include <vector>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+// Parent/child transforms. Node ids stay valid for good, but the matrices
+// live in slots in breadth-first order, so a parent is always updated before
+// its children, the children of a slot are contiguous and every depth level
+// can be updated in parallel. Only nodes whose local matrix changed, and
+// their descendants, are recomputed; an update walks down from the changed
+// nodes and never visits the rest of the tree.
+struct TransformHierarchy
+{
+  // per node id
+  std::vector<int> parent;       // -1 for roots
+  std::vector<int> depth;
+  std::vector<int> slot_of;
+
+  // per slot, in breadth-first order
+  std::vector<int> node;         // the node id in the slot
+  std::vector<int> parent_slot;  // -1 for roots
+  std::vector<int> child_start, child_end;  // the children are slots [child_start, child_end)
+  std::vector<glm::mat4> local, world;
+  std::vector<uint8_t> dirty;    // 1: local changed, 2: recomputed by the running update
+  std::vector<int> level_start;  // slots of depth d are [level_start[d], level_start[d + 1])
+  bool sorted;                   // false after transform_add, until the next update
+
+  std::vector<int> dirty_nodes;  // ids of the nodes with dirty 1, each once
+  std::vector<int> roots, level, next_level, previous_level;  // scratch of transform_update
+};
+
+void transform_init(TransformHierarchy &hierarchy);
+// returns the node id; parent is a node id, or -1 for a root
+int transform_add(TransformHierarchy &hierarchy, int parent, const glm::mat4 &local);
+void transform_set_local(TransformHierarchy &hierarchy, int node, const glm::mat4 &local);
+// valid after transform_update
+const glm::mat4 &transform_world(const TransformHierarchy &hierarchy, int node);
+
+// Recompute the world matrices of dirty subtrees, one depth level at a
+// time across parallel_for threads. Costs in proportion to the nodes
+// recomputed, which it returns.
+int transform_update(TransformHierarchy &hierarchy);
+
+// Time updates of a 4-ary tree of count nodes (100k by default) with the
+// local matrices of 5% of the nodes, all leaves, changing per frame, against
+// recomputing every node.
+// Needs no GL context.
+void transform_benchmark(int count);
+
+#endif
@@ -0,0 +1,107 @@
+#include "uniform_buffer.h"
+
+#include <iostream>
+
+using namespace std;
+
+int ubo_supported()
+{
+  return GLEW_VERSION_3_1 ? 1 : 0;
+}
+
+int ubo_init(UniformBuffers &ubo, int max_objects)
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  if (alignment <= 0)
+  {
+    cerr << "ubo_init: bad GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT " << alignment << endl;
+    return 0;
+  }
+
+  ubo.object_alignment = alignment;
+  ubo.object_stride = (sizeof(PerObjectBlock) + alignment - 1) / alignment * alignment;
+  ubo.object_capacity = max_objects;
+  ubo.object_count = 0;
+  ubo.object_data = NULL;
+  ubo.object_offset = 0;
+  // one extra alignment of slack, the region start need not be aligned
+  if (!stream_buffer_create(ubo.objects, ubo.object_stride * max_objects + alignment)) return 0;
+
+  glGenBuffers(1, &ubo.frame_buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo.frame_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(PerFrameBlock), NULL, GL_DYNAMIC_DRAW);
+
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  // the frame block never moves, bind it once
+  glBindBufferBase(GL_UNIFORM_BUFFER, UBO_BINDING_FRAME, ubo.frame_buffer);
+  return 1;
+}
+
+void ubo_free(UniformBuffers &ubo, GpuResources* resources)
+{
+  gpu_delete(resources, GPU_BUFFER, ubo.frame_buffer);
+  stream_buffer_free(ubo.objects, resources);
+  ubo.object_data = NULL;
+  ubo.object_count = ubo.object_capacity = 0;
+}
+
+int ubo_bind_program(const ProgramInfo &info)
+{
+  const ProgramVarName blocks[] = {
+    { "PerFrame", VAR_BLOCK },
+    { "PerObject", VAR_BLOCK },
+  };
+  GLint indices[2];
+  if (!program_require(info, blocks, 2, indices)) return 0;
+
+  glUniformBlockBinding(info.program, indices[0], UBO_BINDING_FRAME);
+  glUniformBlockBinding(info.program, indices[1], UBO_BINDING_OBJECT);
+  return 1;
+}
+
+void ubo_set_frame(UniformBuffers &ubo, const PerFrameBlock &frame)
+{
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo.frame_buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameBlock), &frame);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+int ubo_alloc_object(UniformBuffers &ubo)
+{
+  if (ubo.object_count == ubo.object_capacity)
+  {
+    cerr << "ubo_alloc_object: all " << ubo.object_capacity << " object blocks in use" << endl;
+    return -1;
+  }
+  return ubo.object_count++;
+}
+
+void ubo_begin_frame(UniformBuffers &ubo)
+{
+  stream_buffer_begin_frame(ubo.objects);
+  ubo.object_data = (char*)stream_buffer_alloc(ubo.objects, ubo.object_stride * ubo.object_capacity,
+    ubo.object_alignment, ubo.object_offset);
+}
+
+PerObjectBlock* ubo_object(UniformBuffers &ubo, int slot)
+{
+  return (PerObjectBlock*)(ubo.object_data + slot * ubo.object_stride);
+}
+
+void ubo_upload_objects(UniformBuffers &ubo)
+{
+  stream_buffer_flush(ubo.objects);
+}
+
+void ubo_end_frame(UniformBuffers &ubo)
+{
+  stream_buffer_end_frame(ubo.objects);
+}
+
+void ubo_bind_object(const UniformBuffers &ubo, int slot)
+{
+  glBindBufferRange(GL_UNIFORM_BUFFER, UBO_BINDING_OBJECT, ubo.objects.buffer,
+    ubo.object_offset + slot * ubo.object_stride, sizeof(PerObjectBlock));
+}
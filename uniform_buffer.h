@@ -0,0 +1,85 @@
+#ifndef _UNIFORM_BUFFER_H
+#define _UNIFORM_BUFFER_H
+
+#include <stddef.h>
+#include <vector>
+#include <GL/glew.h>
+
+// glm math libs
+#define GLM_FORCE_RADIANS // force glm functions to use radians instead of degrees
+#include <glm/glm.hpp>
+
+#include "program_info.h"
+#include "stream_buffer.h"
+
+// binding points shared by every program using the blocks
+enum { UBO_BINDING_FRAME = 0, UBO_BINDING_OBJECT = 1 };
+
+// C++ mirrors of the std140 blocks in cube.v.glsl. Under std140 a mat4 is four
+// vec4 columns and a vec4 is 16-byte aligned, so the offsets below are exactly
+// what the GLSL compiler computes; the asserts catch any member added out of line.
+struct PerFrameBlock
+{
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::vec4 time;  // x = seconds since start, y = seconds since last frame
+};
+static_assert(offsetof(PerFrameBlock, view) == 0, "std140: view at 0");
+static_assert(offsetof(PerFrameBlock, projection) == 64, "std140: projection at 64");
+static_assert(offsetof(PerFrameBlock, time) == 128, "std140: time at 128");
+static_assert(sizeof(PerFrameBlock) == 144, "std140: PerFrame is 144 bytes");
+
+struct PerObjectBlock
+{
+  glm::mat4 model;
+};
+static_assert(offsetof(PerObjectBlock, model) == 0, "std140: model at 0");
+static_assert(sizeof(PerObjectBlock) % 16 == 0, "std140: block size is a multiple of vec4");
+
+// One buffer for the per-frame block and a stream buffer holding every
+// object's block, each at a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+// Object blocks live in the stream buffer's region for the current frame,
+// so they are written straight into mapped memory and rewritten every frame.
+struct UniformBuffers
+{
+  GLuint frame_buffer;
+  StreamBuffer objects;
+  GLint object_alignment;
+  GLsizeiptr object_stride;
+  int object_capacity;
+  int object_count;
+  char* object_data;  // this frame's blocks
+  GLintptr object_offset;  // and their place in objects.buffer
+};
+
+// uniform blocks need GL 3.1 and GLSL 1.40
+int ubo_supported();
+
+// returns 1 when all is ok, 0 with a displayed error
+int ubo_init(UniformBuffers &ubo, int max_objects);
+// with resources, the buffers go through its deletion queue
+void ubo_free(UniformBuffers &ubo, GpuResources* resources = NULL);
+
+// point the program's PerFrame/PerObject blocks at our binding points
+int ubo_bind_program(const ProgramInfo &info);
+
+void ubo_set_frame(UniformBuffers &ubo, const PerFrameBlock &frame);
+
+// reserve a per-object block, returns its slot or -1 when the buffer is full
+int ubo_alloc_object(UniformBuffers &ubo);
+
+// start a frame, before writing any object block
+void ubo_begin_frame(UniformBuffers &ubo);
+// a slot's block for this frame, valid until ubo_end_frame
+PerObjectBlock* ubo_object(UniformBuffers &ubo, int slot);
+
+// make the object blocks visible to GL, before drawing
+void ubo_upload_objects(UniformBuffers &ubo);
+
+// after the frame's last draw, fences the blocks for reuse
+void ubo_end_frame(UniformBuffers &ubo);
+
+// select the object whose block the next draw reads
+void ubo_bind_object(const UniformBuffers &ubo, int slot);
+
+#endif